@@ -69,6 +69,12 @@ static void client_console(int sock)
                 break;
             }
         }
+        else if(cid == STATS){
+            if(recv_stats_msg_and_print(sock, 0) < 0){
+                fprintf(stderr, "Error in stats message\n");
+                break;
+            }
+        }
         else{
             if(answer_expected){
                 server_buf = recv_one_msg(sock);
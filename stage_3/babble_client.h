@@ -8,6 +8,7 @@ unsigned long client_login(int sock, char* id);
 /* receiving msg for the server */
 void* recv_one_msg(int sock);
 int recv_timeline_msg_and_print(int sock, int silent);
+int recv_stats_msg_and_print(int sock, int silent);
 
 /* interact for tests */
 int client_follow(int sock, char* id, int with_streaming);
@@ -16,5 +17,14 @@ int client_publish(int sock, char* msg, int with_streaming);
 int client_timeline(int sock, int silent);
 int client_rdv(int sock);
 
+/* latency of the commands measured by the server (count, p50, p99,
+ * p999 and max per command and phase), printed unless silent --
+ * returns the nb of lines */
+int client_stats(int sock, int silent);
+
+/* nb of streamed commands dropped by the server because it was
+ * overloaded (BUSY), since the login */
+unsigned long client_busy_count(int sock);
+
 
 #endif
@@ -2,34 +2,160 @@
 #include <sys/types.h>
 #include <stdio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include "babble_client.h"
 #include "babble_types.h"
 #include "babble_communication.h"
 #include "babble_utils.h"
 
-void *recv_one_msg(int sock)
+/* flow control state of each socket, indexed by the fd: the streamed
+ * commands take a credit, the server gives them back with grant frames
+ * once they are executed */
+typedef struct flow_state{
+    int credits;            /* -1 if the server does no flow control */
+    unsigned long nb_busy;  /* streamed commands dropped by the server */
+} flow_state_t;
+
+#define CLIENT_MAX_SOCKETS 65536
+
+static flow_state_t *flow_states;
+static pthread_once_t flow_states_once = PTHREAD_ONCE_INIT;
+
+static void flow_states_init(void)
+{
+    flow_states = malloc(CLIENT_MAX_SOCKETS * sizeof(flow_state_t));
+    for (int i = 0; i < CLIENT_MAX_SOCKETS; i++)
+    {
+        flow_states[i].credits = -1;
+        flow_states[i].nb_busy = 0;
+    }
+}
+
+static flow_state_t *flow_state(int sock)
+{
+    pthread_once(&flow_states_once, flow_states_init);
+
+    if (sock < 0 || sock >= CLIENT_MAX_SOCKETS)
+    {
+        return NULL;
+    }
+    return &flow_states[sock];
+}
+
+static void flow_grant(int sock, unsigned int grant)
 {
-    unsigned int *nb_items;
+    flow_state_t *fs = flow_state(sock);
+    unsigned int credits = grant & BABBLE_CREDIT_MASK;
+
+    if (fs == NULL || fs->credits < 0)
+    {
+        return;
+    }
+    fs->credits += credits;
+    if (grant & BABBLE_CREDIT_BUSY)
+    {
+        fs->nb_busy += credits;
+    }
+}
+
+/* receive a header frame, grant or answer header */
+static int recv_header_frame(int sock, unsigned int *value)
+{
+    unsigned int *header = NULL;
     int recv_bytes = 0;
 
-    if ((recv_bytes = network_recv(sock, (void **)&nb_items)) != sizeof(unsigned int))
+    if ((recv_bytes = network_recv(sock, (void **)&header)) != sizeof(unsigned int))
     {
         fprintf(stderr, "ERROR in msg reception -- expected msg size -- received %d bytes\n", recv_bytes);
+        free(header);
+        return -1;
+    }
+    *value = *header;
+    free(header);
+
+    return 0;
+}
+
+/* receive the header of an answer, absorbing the grants sent before
+ * it -- returns the nb of items of the answer, -1 on error */
+static int recv_answer_header(int sock)
+{
+    unsigned int value;
+
+    do
+    {
+        if (recv_header_frame(sock, &value))
+        {
+            return -1;
+        }
+        if (value & BABBLE_CREDIT_GRANT)
+        {
+            flow_grant(sock, value);
+        }
+    } while (value & BABBLE_CREDIT_GRANT);
+
+    return value;
+}
+
+/* take a credit before sending a streamed command, waiting for a
+ * grant if there is none left */
+static int flow_take_credit(int sock)
+{
+    flow_state_t *fs = flow_state(sock);
+    unsigned int value;
+
+    if (fs == NULL || fs->credits < 0)
+    {
+        return 0;
+    }
+
+    while (fs->credits == 0)
+    {
+        /* only grants can come: the answers of the acknowledged
+         * commands are waited for when they are sent */
+        if (recv_header_frame(sock, &value))
+        {
+            return -1;
+        }
+        if (!(value & BABBLE_CREDIT_GRANT))
+        {
+            fprintf(stderr, "ERROR in msg reception -- credit grant expected -- got header %u\n", value);
+            return -1;
+        }
+        flow_grant(sock, value);
+    }
+    fs->credits--;
+
+    return 1;
+}
+
+unsigned long client_busy_count(int sock)
+{
+    flow_state_t *fs = flow_state(sock);
+
+    return fs ? fs->nb_busy : 0;
+}
+
+void *recv_one_msg(int sock)
+{
+    int nb_items = recv_answer_header(sock);
+
+    if (nb_items < 0)
+    {
         return NULL;
     }
 
-    if (*nb_items != 1)
+    if (nb_items != 1)
     {
-        fprintf(stderr, "ERROR in msg reception -- a single msg expected -- %d annouced\n", *nb_items);
-        free(nb_items);
+        fprintf(stderr, "ERROR in msg reception -- a single msg expected -- %d annouced\n", nb_items);
         return NULL;
     }
-    free(nb_items);
 
     char *msg = NULL;
 
@@ -45,17 +171,14 @@ void *recv_one_msg(int sock)
 int recv_timeline_msg_and_print(int sock, int silent)
 {
     unsigned int *buf1;
-    unsigned int nb_items = 0;
+    int nb_items = 0;
     unsigned int timeline_size = 0;
     int recv_bytes = 0;
 
-    if ((recv_bytes = network_recv(sock, (void **)&buf1)) != sizeof(unsigned int))
+    if ((nb_items = recv_answer_header(sock)) < 0)
     {
-        fprintf(stderr, "ERROR in msg reception -- expected msg size -- received %d bytes\n", recv_bytes);
         return -1;
     }
-    nb_items = *buf1;
-    free(buf1);
 
     /* first data is the number of msgs in the most recent timeline */
     if ((recv_bytes = network_recv(sock, (void **)&buf1)) != sizeof(unsigned int))
@@ -69,7 +192,7 @@ int recv_timeline_msg_and_print(int sock, int silent)
     nb_items--;
 
     /* receive each publication in the timeline */
-    while (nb_items)
+    while (nb_items > 0)
     {
         char *publi = NULL;
 
@@ -91,6 +214,39 @@ int recv_timeline_msg_and_print(int sock, int silent)
     return timeline_size;
 }
 
+int recv_stats_msg_and_print(int sock, int silent)
+{
+    int nb_items = 0;
+    int nb_lines = 0;
+
+    if ((nb_items = recv_answer_header(sock)) < 0)
+    {
+        return -1;
+    }
+
+    /* one line per command and phase */
+    while (nb_lines < nb_items)
+    {
+        char *line = NULL;
+
+        if (network_recv(sock, (void **)&line) == -1)
+        {
+            return -1;
+        }
+
+        if (!silent)
+        {
+            printf("%s", line);
+        }
+
+        free(line);
+
+        nb_lines++;
+    }
+
+    return nb_lines;
+}
+
 int connect_to_server(char *host, int port)
 {
     /* creating the socket */
@@ -149,6 +305,14 @@ int connect_to_server(char *host, int port)
         return -1;
     }
 
+    int one = 1;
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+    {
+        perror("setsockopt failed\n");
+        close(sockfd);
+        return -1;
+    }
+
     return sockfd;
 }
 
@@ -180,8 +344,15 @@ unsigned long client_login(int sock, char *id)
         return 0;
     }
 
-    /* parsing the answer to get the key */
+    /* parsing the answer to get the key and the credit window */
     unsigned long key = parse_login_ack(login_ack);
+    flow_state_t *fs = flow_state(sock);
+
+    if (fs)
+    {
+        fs->credits = parse_login_credits(login_ack);
+        fs->nb_busy = 0;
+    }
 
     free(login_ack);
 
@@ -209,6 +380,12 @@ int client_follow(int sock, char *id, int with_streaming)
         snprintf(buffer, BABBLE_BUFFER_SIZE, "%d %s\n", FOLLOW, id);
     }
 
+    if (with_streaming && flow_take_credit(sock) < 0)
+    {
+        fprintf(stderr, "Error -- waiting for credits\n");
+        return -1;
+    }
+
     if (network_send(sock, strlen(buffer) + 1, buffer) != strlen(buffer) + 1)
     {
         fprintf(stderr, "Error -- sending FOLLOW message\n");
@@ -295,6 +472,13 @@ int client_publish(int sock, char *msg, int with_streaming)
         snprintf(buffer, BABBLE_BUFFER_SIZE, "%d %s\n", PUBLISH, msg);
     }
 
+    int flow_controlled = with_streaming ? flow_take_credit(sock) : 0;
+    if (flow_controlled < 0)
+    {
+        fprintf(stderr, "Error -- waiting for credits\n");
+        return -1;
+    }
+
     if (network_send(sock, strlen(buffer) + 1, buffer) != strlen(buffer) + 1)
     {
         fprintf(stderr, "Error -- sending PUBLISH message\n");
@@ -322,8 +506,9 @@ int client_publish(int sock, char *msg, int with_streaming)
         free(ack);
         return -1;
     }
-    else
+    else if (!flow_controlled)
     {
+        /* no credits to pace the stream */
         usleep(1);
     }
 
@@ -388,4 +573,28 @@ int client_rdv(int sock)
 
     free(ack);
     return -1;
-}
\ No newline at end of file
+}
+
+int client_stats(int sock, int silent)
+{
+    char buffer[BABBLE_BUFFER_SIZE];
+    memset(buffer, 0, BABBLE_BUFFER_SIZE);
+
+    snprintf(buffer, BABBLE_BUFFER_SIZE, "%d\n", STATS);
+
+    if (network_send(sock, strlen(buffer) + 1, buffer) != strlen(buffer) + 1)
+    {
+        fprintf(stderr, "Error -- sending STATS message\n");
+        return -1;
+    }
+
+    int nb_lines = recv_stats_msg_and_print(sock, silent);
+
+    if (nb_lines < 0)
+    {
+        fprintf(stderr, "Error in stats message\n");
+        return -1;
+    }
+
+    return nb_lines;
+}
@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "babble_command_buffer.h"
+#include "babble_memory.h"
+
+/* get the slot containing cmd */
+static command_slot_t *slot_of(command_t *cmd)
+{
+    return (command_slot_t *)((char *)cmd - offsetof(command_slot_t, cmd));
+}
+
+/* allocate the slots, slot i being free for position i */
+static command_slot_t *slots_alloc(unsigned long capacity)
+{
+    command_slot_t *slots;
+
+    if ((slots = mem_memalign(MEM_COMMANDS, CACHE_LINE_SIZE, capacity * sizeof(command_slot_t))) == NULL)
+    {
+        perror("command buffer");
+        abort();
+    }
+    for (unsigned long i = 0; i < capacity; i++)
+    {
+        slots[i].seq = i;
+    }
+
+    return slots;
+}
+
+void command_buffer_destroy(command_buffer_t *buffer)
+{
+    mem_free(MEM_COMMANDS, buffer->slots);
+}
+
+#ifdef BABBLE_MUTEX_BUFFERS
+
+static lock_prof_t buffer_prof = LOCK_PROF_INITIALIZER("command buffer");
+
+void command_buffer_init(command_buffer_t *buffer, unsigned long capacity)
+{
+    buffer->slots = slots_alloc(capacity);
+    buffer->capacity = capacity;
+    buffer->buffer_in = 0;
+    buffer->buffer_out = 0;
+    buffer->buffer_count = 0;
+    prof_mutex_init(&buffer->mutex, &buffer_prof);
+    pthread_cond_init(&buffer->not_empty, NULL);
+    pthread_cond_init(&buffer->not_full, NULL);
+}
+
+command_t *command_buffer_reserve(command_buffer_t *buffer)
+{
+    command_slot_t *slot;
+
+    prof_mutex_lock(&buffer->mutex);
+    while (buffer->buffer_count == buffer->capacity)
+    {
+        prof_cond_wait(&buffer->not_full, &buffer->mutex);
+    }
+
+    slot = &buffer->slots[buffer->buffer_in % buffer->capacity];
+    slot->pos = buffer->buffer_in;
+    buffer->buffer_in++;
+    buffer->buffer_count++;
+    prof_mutex_unlock(&buffer->mutex);
+
+    slot->cancelled = 0;
+    slot->cmd.answer_expected = 0;
+
+    return &slot->cmd;
+}
+
+/* same as command_buffer_reserve(), NULL if the buffer is full */
+command_t *command_buffer_try_reserve(command_buffer_t *buffer)
+{
+    command_slot_t *slot;
+
+    prof_mutex_lock(&buffer->mutex);
+    if (buffer->buffer_count == buffer->capacity)
+    {
+        prof_mutex_unlock(&buffer->mutex);
+        return NULL;
+    }
+
+    slot = &buffer->slots[buffer->buffer_in % buffer->capacity];
+    slot->pos = buffer->buffer_in;
+    buffer->buffer_in++;
+    buffer->buffer_count++;
+    prof_mutex_unlock(&buffer->mutex);
+
+    slot->cancelled = 0;
+    slot->cmd.answer_expected = 0;
+
+    return &slot->cmd;
+}
+
+void command_buffer_commit(command_buffer_t *buffer, command_t *cmd)
+{
+    command_slot_t *slot = slot_of(cmd);
+
+    prof_mutex_lock(&buffer->mutex);
+    slot->seq = slot->pos + 1;
+    /* the consumer only waits for the oldest slot */
+    if (slot->pos == buffer->buffer_out)
+    {
+        pthread_cond_signal(&buffer->not_empty);
+    }
+    prof_mutex_unlock(&buffer->mutex);
+}
+
+/* get the oldest committed command, NULL if there is none -- called
+ * with the mutex held */
+static command_slot_t *command_buffer_poll(command_buffer_t *buffer)
+{
+    command_slot_t *slot;
+
+    while (1)
+    {
+        slot = &buffer->slots[buffer->buffer_out % buffer->capacity];
+
+        if (buffer->buffer_out == buffer->buffer_in || slot->seq != buffer->buffer_out + 1)
+        {
+            return NULL;
+        }
+
+        buffer->buffer_out++;
+
+        if (!slot->cancelled)
+        {
+            return slot;
+        }
+
+        /* nothing to do with it, give it back right away */
+        slot->seq = slot->pos + buffer->capacity;
+        buffer->buffer_count--;
+        pthread_cond_signal(&buffer->not_full);
+    }
+}
+
+command_t *command_buffer_acquire(command_buffer_t *buffer)
+{
+    command_slot_t *slot;
+
+    prof_mutex_lock(&buffer->mutex);
+    while ((slot = command_buffer_poll(buffer)) == NULL)
+    {
+        prof_cond_wait(&buffer->not_empty, &buffer->mutex);
+    }
+    prof_mutex_unlock(&buffer->mutex);
+
+    return &slot->cmd;
+}
+
+command_t *command_buffer_try_acquire(command_buffer_t *buffer)
+{
+    command_slot_t *slot;
+
+    prof_mutex_lock(&buffer->mutex);
+    slot = command_buffer_poll(buffer);
+    prof_mutex_unlock(&buffer->mutex);
+
+    return slot ? &slot->cmd : NULL;
+}
+
+/* fill cmds with at most max committed commands -- called with the
+ * mutex held */
+static int command_buffer_poll_batch(command_buffer_t *buffer, command_t **cmds, int max)
+{
+    command_slot_t *slot;
+    int n = 0;
+
+    while (n < max && (slot = command_buffer_poll(buffer)) != NULL)
+    {
+        cmds[n++] = &slot->cmd;
+    }
+
+    return n;
+}
+
+int command_buffer_acquire_batch(command_buffer_t *buffer, command_t **cmds, int max)
+{
+    int n;
+
+    prof_mutex_lock(&buffer->mutex);
+    while ((n = command_buffer_poll_batch(buffer, cmds, max)) == 0)
+    {
+        prof_cond_wait(&buffer->not_empty, &buffer->mutex);
+    }
+    prof_mutex_unlock(&buffer->mutex);
+
+    return n;
+}
+
+int command_buffer_try_acquire_batch(command_buffer_t *buffer, command_t **cmds, int max)
+{
+    int n;
+
+    prof_mutex_lock(&buffer->mutex);
+    n = command_buffer_poll_batch(buffer, cmds, max);
+    prof_mutex_unlock(&buffer->mutex);
+
+    return n;
+}
+
+void command_buffer_release_batch(command_buffer_t *buffer, command_t **cmds, int n)
+{
+    prof_mutex_lock(&buffer->mutex);
+    for (int i = 0; i < n; i++)
+    {
+        command_slot_t *slot = slot_of(cmds[i]);
+        slot->seq = slot->pos + buffer->capacity;
+    }
+    buffer->buffer_count -= n;
+    pthread_cond_broadcast(&buffer->not_full);
+    prof_mutex_unlock(&buffer->mutex);
+}
+
+int command_buffer_ready(command_buffer_t *buffer)
+{
+    int ready;
+
+    prof_mutex_lock(&buffer->mutex);
+    ready = buffer->buffer_out != buffer->buffer_in &&
+            buffer->slots[buffer->buffer_out % buffer->capacity].seq == buffer->buffer_out + 1;
+    prof_mutex_unlock(&buffer->mutex);
+
+    return ready;
+}
+
+void command_buffer_release(command_buffer_t *buffer, command_t *cmd)
+{
+    command_slot_t *slot = slot_of(cmd);
+
+    prof_mutex_lock(&buffer->mutex);
+    slot->seq = slot->pos + buffer->capacity;
+    buffer->buffer_count--;
+    pthread_cond_signal(&buffer->not_full);
+    prof_mutex_unlock(&buffer->mutex);
+}
+
+#else
+
+static void futex_wait(unsigned int *addr, unsigned int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(unsigned int *addr, int nb)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, nb, NULL, NULL, 0);
+}
+
+void command_buffer_init(command_buffer_t *buffer, unsigned long capacity)
+{
+    buffer->slots = slots_alloc(capacity);
+    buffer->capacity = capacity;
+    buffer->tail = 0;
+    buffer->head = 0;
+    buffer->not_empty = 0;
+    buffer->consumer_parked = 0;
+    buffer->not_full = 0;
+    buffer->producers_parked = 0;
+    buffer->wake_pending = 0;
+    spin_wait_init(&buffer->consumer_spin);
+    spin_wait_init(&buffer->producer_spin);
+}
+
+/* a producer waiting for a slot of the previous lap to be released */
+typedef struct slot_wait{
+    command_slot_t *slot;
+    unsigned long seq;
+} slot_wait_t;
+
+static int slot_released(void *arg)
+{
+    slot_wait_t *w = arg;
+    return __atomic_load_n(&w->slot->seq, __ATOMIC_ACQUIRE) != w->seq;
+}
+
+static int buffer_ready(void *arg)
+{
+    return command_buffer_ready(arg);
+}
+
+command_t *command_buffer_reserve(command_buffer_t *buffer)
+{
+    unsigned long pos = __atomic_load_n(&buffer->tail, __ATOMIC_RELAXED);
+    command_slot_t *slot;
+
+    while (1)
+    {
+        slot = &buffer->slots[pos % buffer->capacity];
+        unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        long dif = (long)seq - (long)pos;
+
+        if (dif == 0)
+        {
+            /* the slot is free for this lap, try to take it */
+            if (__atomic_compare_exchange_n(&buffer->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+            /* pos was updated by the failed CAS */
+        }
+        else if (dif < 0)
+        {
+            /* the slot still holds a command of the previous lap: the
+             * ring is full, park until the consumer releases a slot */
+            slot_wait_t w = {slot, seq};
+            if (spin_wait(&buffer->producer_spin, slot_released, &w))
+            {
+                pos = __atomic_load_n(&buffer->tail, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            unsigned int v = __atomic_load_n(&buffer->not_full, __ATOMIC_ACQUIRE);
+            __atomic_fetch_add(&buffer->producers_parked, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) == seq)
+            {
+                futex_wait(&buffer->not_full, v);
+            }
+            __atomic_fetch_sub(&buffer->producers_parked, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&buffer->wake_pending, 0, __ATOMIC_RELAXED);
+            pos = __atomic_load_n(&buffer->tail, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            /* another producer took it */
+            pos = __atomic_load_n(&buffer->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->pos = pos;
+    slot->cancelled = 0;
+    slot->cmd.answer_expected = 0;
+
+    return &slot->cmd;
+}
+
+/* same as command_buffer_reserve(), NULL if the ring is full */
+command_t *command_buffer_try_reserve(command_buffer_t *buffer)
+{
+    unsigned long pos = __atomic_load_n(&buffer->tail, __ATOMIC_RELAXED);
+    command_slot_t *slot;
+
+    while (1)
+    {
+        slot = &buffer->slots[pos % buffer->capacity];
+        unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        long dif = (long)seq - (long)pos;
+
+        if (dif == 0)
+        {
+            if (__atomic_compare_exchange_n(&buffer->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (dif < 0)
+        {
+            return NULL;
+        }
+        else
+        {
+            pos = __atomic_load_n(&buffer->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->pos = pos;
+    slot->cancelled = 0;
+    slot->cmd.answer_expected = 0;
+
+    return &slot->cmd;
+}
+
+void command_buffer_commit(command_buffer_t *buffer, command_t *cmd)
+{
+    command_slot_t *slot = slot_of(cmd);
+
+    __atomic_store_n(&slot->seq, slot->pos + 1, __ATOMIC_RELEASE);
+
+    /* pairs with the check done by the consumer before parking */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&buffer->consumer_parked, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&buffer->consumer_parked, 0, __ATOMIC_RELAXED))
+    {
+        __atomic_fetch_add(&buffer->not_empty, 1, __ATOMIC_RELEASE);
+        futex_wake(&buffer->not_empty, 1);
+    }
+}
+
+/* wake up at most nb producers waiting for a free slot, if any */
+static void command_buffer_wake_producers(command_buffer_t *buffer, int nb)
+{
+    /* pairs with the check done by producers before parking */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    /* a single wake-up in flight: the woken producer clears
+     * wake_pending, so a burst of releases does not turn into a burst
+     * of syscalls while it is not scheduled yet */
+    if (__atomic_load_n(&buffer->producers_parked, __ATOMIC_RELAXED) &&
+        !__atomic_exchange_n(&buffer->wake_pending, 1, __ATOMIC_RELAXED))
+    {
+        __atomic_fetch_add(&buffer->not_full, 1, __ATOMIC_RELEASE);
+        futex_wake(&buffer->not_full, nb);
+    }
+}
+
+/* make a slot available to the producers for the next lap */
+static void command_buffer_free_slot(command_buffer_t *buffer, command_slot_t *slot)
+{
+    __atomic_store_n(&slot->seq, slot->pos + buffer->capacity, __ATOMIC_RELEASE);
+    command_buffer_wake_producers(buffer, 1);
+}
+
+/* get the oldest committed command, NULL if there is none */
+static command_slot_t *command_buffer_poll(command_buffer_t *buffer)
+{
+    command_slot_t *slot;
+
+    while (1)
+    {
+        unsigned long pos = buffer->head;
+        slot = &buffer->slots[pos % buffer->capacity];
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        {
+            return NULL;
+        }
+
+        buffer->head = pos + 1;
+
+        if (!slot->cancelled)
+        {
+            return slot;
+        }
+
+        /* nothing to do with it, give it back right away */
+        command_buffer_free_slot(buffer, slot);
+    }
+}
+
+command_t *command_buffer_acquire(command_buffer_t *buffer)
+{
+    command_slot_t *slot;
+
+    while ((slot = command_buffer_poll(buffer)) == NULL)
+    {
+        /* empty (or oldest slot not committed yet): park */
+        if (spin_wait(&buffer->consumer_spin, buffer_ready, buffer))
+        {
+            continue;
+        }
+        unsigned long pos = buffer->head;
+        unsigned int v = __atomic_load_n(&buffer->not_empty, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&buffer->consumer_parked, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&buffer->slots[pos % buffer->capacity].seq, __ATOMIC_SEQ_CST) != pos + 1)
+        {
+            futex_wait(&buffer->not_empty, v);
+        }
+        __atomic_store_n(&buffer->consumer_parked, 0, __ATOMIC_RELAXED);
+    }
+
+    return &slot->cmd;
+}
+
+command_t *command_buffer_try_acquire(command_buffer_t *buffer)
+{
+    command_slot_t *slot = command_buffer_poll(buffer);
+
+    return slot ? &slot->cmd : NULL;
+}
+
+int command_buffer_try_acquire_batch(command_buffer_t *buffer, command_t **cmds, int max)
+{
+    command_slot_t *slot;
+    int n = 0;
+
+    while (n < max && (slot = command_buffer_poll(buffer)) != NULL)
+    {
+        cmds[n++] = &slot->cmd;
+    }
+
+    return n;
+}
+
+int command_buffer_acquire_batch(command_buffer_t *buffer, command_t **cmds, int max)
+{
+    /* block for the first one, take what is already there for the
+     * others */
+    cmds[0] = command_buffer_acquire(buffer);
+
+    return 1 + command_buffer_try_acquire_batch(buffer, cmds + 1, max - 1);
+}
+
+void command_buffer_release_batch(command_buffer_t *buffer, command_t **cmds, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        command_slot_t *slot = slot_of(cmds[i]);
+        __atomic_store_n(&slot->seq, slot->pos + buffer->capacity, __ATOMIC_RELEASE);
+    }
+    command_buffer_wake_producers(buffer, n);
+}
+
+int command_buffer_ready(command_buffer_t *buffer)
+{
+    unsigned long pos = __atomic_load_n(&buffer->head, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&buffer->slots[pos % buffer->capacity].seq, __ATOMIC_SEQ_CST) == pos + 1;
+}
+
+void command_buffer_release(command_buffer_t *buffer, command_t *cmd)
+{
+    command_buffer_free_slot(buffer, slot_of(cmd));
+}
+
+#endif
+
+void command_buffer_cancel(command_buffer_t *buffer, command_t *cmd)
+{
+    slot_of(cmd)->cancelled = 1;
+    command_buffer_commit(buffer, cmd);
+}
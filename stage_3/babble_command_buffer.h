@@ -0,0 +1,106 @@
+#ifndef __BABBLE_COMMAND_BUFFER_H__
+#define __BABBLE_COMMAND_BUFFER_H__
+
+#include <pthread.h>
+
+#include "babble_types.h"
+#include "babble_server.h"
+#include "babble_spin.h"
+
+/**** Prod-cons buffer of commands between communication threads and
+ **** executors ****/
+
+/* commands are built in place in the slots of the buffer:
+ *  - a producer reserves a slot, parses the command directly into it
+ *    and commits it (or cancels it if the command is invalid)
+ *  - the consumer acquires the oldest committed slot, processes the
+ *    command in place and releases the slot, which only then becomes
+ *    available to producers again
+ * Slots are handed to the consumer in reservation order, so commands
+ * of a given client stay ordered. There must be a single consumer
+ * per buffer.
+ *
+ * The default implementation is a lock-free multi-producer
+ * single-consumer ring: each slot carries a sequence number telling
+ * whether it is free, reserved or committed for a given lap, and
+ * threads only sleep (on a futex) when the ring is empty or full,
+ * after spinning for a while (see babble_spin.h).
+ * Building with -DBABBLE_MUTEX_BUFFERS selects the previous
+ * mutex/condition variables implementation, for comparison. */
+
+#define CACHE_LINE_SIZE 64
+
+typedef struct command_slot{
+    command_t cmd;
+    unsigned long seq;  /* pos when free, pos + 1 when committed */
+    unsigned long pos;  /* position of the slot in the sequence of
+                         * reservations */
+    int cancelled;      /* dropped by the producer */
+} command_slot_t;
+
+#ifdef BABBLE_MUTEX_BUFFERS
+
+typedef struct command_buffer{
+    command_slot_t *slots;
+    unsigned long capacity;     /* nb of slots */
+    unsigned long buffer_in;    /* next slot to reserve */
+    unsigned long buffer_out;   /* next slot to acquire */
+    unsigned long buffer_count; /* slots not free */
+    prof_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} command_buffer_t;
+
+#else
+
+typedef struct command_buffer{
+    /* written by producers only */
+    unsigned long tail __attribute__((aligned(CACHE_LINE_SIZE)));
+    /* written by the consumer only */
+    unsigned long head __attribute__((aligned(CACHE_LINE_SIZE)));
+    spin_wait_t consumer_spin;
+
+    /* futex words and nb of threads parked on them */
+    unsigned int not_empty __attribute__((aligned(CACHE_LINE_SIZE)));
+    unsigned int consumer_parked;
+    unsigned int not_full __attribute__((aligned(CACHE_LINE_SIZE)));
+    unsigned int producers_parked;
+    unsigned int wake_pending;
+    spin_wait_t producer_spin;
+
+    /* read-only after init */
+    command_slot_t *slots __attribute__((aligned(CACHE_LINE_SIZE)));
+    unsigned long capacity;     /* nb of slots */
+} __attribute__((aligned(CACHE_LINE_SIZE))) command_buffer_t;
+
+#endif
+
+/* capacity is the number of slots of the buffer */
+void command_buffer_init(command_buffer_t *buffer, unsigned long capacity);
+void command_buffer_destroy(command_buffer_t *buffer);
+
+/* producer side -- reserve blocks while the buffer is full,
+ * try_reserve returns NULL instead */
+command_t *command_buffer_reserve(command_buffer_t *buffer);
+command_t *command_buffer_try_reserve(command_buffer_t *buffer);
+void command_buffer_commit(command_buffer_t *buffer, command_t *cmd);
+void command_buffer_cancel(command_buffer_t *buffer, command_t *cmd);
+
+/* consumer side -- acquire blocks until a command is committed,
+ * try_acquire returns NULL if there is none */
+command_t *command_buffer_acquire(command_buffer_t *buffer);
+command_t *command_buffer_try_acquire(command_buffer_t *buffer);
+
+/* batch versions: acquire at most max commands at once (blocking
+ * until there is at least one, or returning 0 for try_acquire), and
+ * release them in one go */
+int command_buffer_acquire_batch(command_buffer_t *buffer, command_t **cmds, int max);
+int command_buffer_try_acquire_batch(command_buffer_t *buffer, command_t **cmds, int max);
+void command_buffer_release_batch(command_buffer_t *buffer, command_t **cmds, int n);
+
+/* tells if the oldest slot is committed (can be called by any thread,
+ * the answer may be outdated as soon as it is returned) */
+int command_buffer_ready(command_buffer_t *buffer);
+void command_buffer_release(command_buffer_t *buffer, command_t *cmd);
+
+#endif
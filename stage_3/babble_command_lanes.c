@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "babble_command_lanes.h"
+#include "babble_memory.h"
+
+static lock_prof_t lanes_prof = LOCK_PROF_INITIALIZER("executor lanes");
+
+static const char *lane_names[NB_LANES] = {"priority", "normal"};
+
+void command_lanes_init(command_lanes_t *lanes, unsigned long priority_capacity,
+                        unsigned long normal_capacity, lane_policy_t policy)
+{
+    command_buffer_init(&lanes->lanes[LANE_PRIORITY], priority_capacity);
+    command_buffer_init(&lanes->lanes[LANE_NORMAL], normal_capacity);
+
+    lanes->consumer_parked = 0;
+    lanes->kicked = 0;
+    spin_wait_init(&lanes->consumer_spin);
+    prof_mutex_init(&lanes->mutex, &lanes_prof);
+    pthread_cond_init(&lanes->not_empty, NULL);
+
+    lanes->policy = policy;
+    lanes->starvation_limit = BABBLE_LANES_STARVATION_LIMIT;
+    lanes->weight = BABBLE_LANES_WEIGHT;
+    lanes->served = 0;
+    lanes->turn = LANE_PRIORITY;
+    memset(lanes->nb_served, 0, sizeof(lanes->nb_served));
+    memset(lanes->nb_batches, 0, sizeof(lanes->nb_batches));
+}
+
+int lane_policy_from_str(const char *str)
+{
+    if (!strcmp(str, "strict"))
+    {
+        return LANES_STRICT;
+    }
+    if (!strcmp(str, "weighted"))
+    {
+        return LANES_WEIGHTED;
+    }
+    return -1;
+}
+
+lane_id_t command_lanes_select(lane_counts_t *counts, int priority)
+{
+    lane_id_t lane = priority ? LANE_PRIORITY : LANE_NORMAL;
+    lane_id_t other = priority ? LANE_NORMAL : LANE_PRIORITY;
+
+    /* commands of the client are still waiting in the other lane:
+     * queue this one behind them */
+    if (__atomic_load_n(&counts->pending[other], __ATOMIC_ACQUIRE))
+    {
+        lane = other;
+    }
+    __atomic_fetch_add(&counts->pending[lane], 1, __ATOMIC_RELAXED);
+
+    return lane;
+}
+
+/* wake up the consumer if it is parked */
+static void command_lanes_wake(command_lanes_t *lanes)
+{
+    /* pairs with the check done by the consumer before parking */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&lanes->consumer_parked, __ATOMIC_RELAXED))
+    {
+        prof_mutex_lock(&lanes->mutex);
+        pthread_cond_signal(&lanes->not_empty);
+        prof_mutex_unlock(&lanes->mutex);
+    }
+}
+
+void command_lanes_kick(command_lanes_t *lanes)
+{
+    __atomic_store_n(&lanes->kicked, 1, __ATOMIC_RELEASE);
+    command_lanes_wake(lanes);
+}
+
+void command_lanes_commit(command_lanes_t *lanes, lane_id_t lane, command_t *cmd)
+{
+    command_buffer_commit(&lanes->lanes[lane], cmd);
+    command_lanes_wake(lanes);
+}
+
+void command_lanes_cancel(command_lanes_t *lanes, lane_id_t lane, command_t *cmd)
+{
+    /* the command will never reach the executor */
+    __atomic_fetch_sub(&cmd->counts->pending[lane], 1, __ATOMIC_RELEASE);
+    command_buffer_cancel(&lanes->lanes[lane], cmd);
+    command_lanes_wake(lanes);
+}
+
+void command_lanes_unselect(lane_counts_t *counts, lane_id_t lane)
+{
+    __atomic_fetch_sub(&counts->pending[lane], 1, __ATOMIC_RELEASE);
+}
+
+/* take a batch from the lane, 0 if it is empty */
+static int command_lanes_poll(command_lanes_t *lanes, lane_id_t lane, command_t **cmds, int max)
+{
+    int n = command_buffer_try_acquire_batch(&lanes->lanes[lane], cmds, max);
+    if (n)
+    {
+        lanes->nb_served[lane] += n;
+        lanes->nb_batches[lane]++;
+    }
+    return n;
+}
+
+static int command_lanes_poll_strict(command_lanes_t *lanes, command_t **cmds, int max, lane_id_t *lane)
+{
+    int n;
+
+    if (lanes->served < lanes->starvation_limit &&
+        (n = command_lanes_poll(lanes, LANE_PRIORITY, cmds, max)))
+    {
+        lanes->served += n;
+        *lane = LANE_PRIORITY;
+        return n;
+    }
+
+    if ((n = command_lanes_poll(lanes, LANE_NORMAL, cmds, max)))
+    {
+        lanes->served = 0;
+        *lane = LANE_NORMAL;
+        return n;
+    }
+
+    /* starvation limit reached, but nobody is starving */
+    lanes->served = 0;
+    if ((n = command_lanes_poll(lanes, LANE_PRIORITY, cmds, max)))
+    {
+        lanes->served = n;
+        *lane = LANE_PRIORITY;
+    }
+    return n;
+}
+
+static int command_lanes_poll_weighted(command_lanes_t *lanes, command_t **cmds, int max, lane_id_t *lane)
+{
+    int n, quota;
+
+    for (int i = 0; i < NB_LANES; i++)
+    {
+        /* commands left to the current lane in this round */
+        quota = (lanes->turn == LANE_PRIORITY ? lanes->weight * max : max) - lanes->served;
+
+        n = command_lanes_poll(lanes, lanes->turn, cmds, quota < max ? quota : max);
+        *lane = lanes->turn;
+        lanes->served += n;
+
+        if (n == 0 || n == quota)
+        {
+            lanes->turn = (lanes->turn == LANE_PRIORITY) ? LANE_NORMAL : LANE_PRIORITY;
+            lanes->served = 0;
+        }
+        if (n)
+        {
+            return n;
+        }
+    }
+    return 0;
+}
+
+static int command_lanes_ready(void *arg)
+{
+    command_lanes_t *lanes = arg;
+    return command_buffer_ready(&lanes->lanes[LANE_PRIORITY]) ||
+           command_buffer_ready(&lanes->lanes[LANE_NORMAL]) ||
+           __atomic_load_n(&lanes->kicked, __ATOMIC_RELAXED);
+}
+
+int command_lanes_acquire_batch(command_lanes_t *lanes, command_t **cmds, int max, lane_id_t *lane)
+{
+    int n;
+
+    while (1)
+    {
+        if (lanes->policy == LANES_STRICT)
+        {
+            n = command_lanes_poll_strict(lanes, cmds, max, lane);
+        }
+        else
+        {
+            n = command_lanes_poll_weighted(lanes, cmds, max, lane);
+        }
+        if (n)
+        {
+            return n;
+        }
+        if (__atomic_load_n(&lanes->kicked, __ATOMIC_RELAXED) &&
+            __atomic_exchange_n(&lanes->kicked, 0, __ATOMIC_ACQUIRE))
+        {
+            return 0;
+        }
+
+        /* both lanes are empty: park */
+        if (spin_wait(&lanes->consumer_spin, command_lanes_ready, lanes))
+        {
+            continue;
+        }
+        prof_mutex_lock(&lanes->mutex);
+        __atomic_store_n(&lanes->consumer_parked, 1, __ATOMIC_SEQ_CST);
+        if (!command_lanes_ready(lanes))
+        {
+            prof_cond_wait(&lanes->not_empty, &lanes->mutex);
+        }
+        __atomic_store_n(&lanes->consumer_parked, 0, __ATOMIC_RELAXED);
+        prof_mutex_unlock(&lanes->mutex);
+    }
+}
+
+void command_lanes_done(command_t *cmd)
+{
+    lane_counts_t *counts = cmd->counts;
+
+    /* UNREGISTER is the last command of the client, all the others
+     * have been executed */
+    if (cmd->cid == UNREGISTER)
+    {
+        mem_free(MEM_COMMANDS, counts);
+        return;
+    }
+    __atomic_fetch_sub(&counts->pending[cmd->lane], 1, __ATOMIC_RELEASE);
+}
+
+int command_lanes_idle(lane_counts_t *counts)
+{
+    return __atomic_load_n(&counts->pending[LANE_PRIORITY], __ATOMIC_ACQUIRE) == 0 &&
+           __atomic_load_n(&counts->pending[LANE_NORMAL], __ATOMIC_ACQUIRE) == 0;
+}
+
+void command_lanes_stats_display(command_lanes_t *lanes, FILE *stream)
+{
+    for (int i = 0; i < NB_LANES; i++)
+    {
+        unsigned long served = __atomic_load_n(&lanes->nb_served[i], __ATOMIC_RELAXED);
+        unsigned long batches = __atomic_load_n(&lanes->nb_batches[i], __ATOMIC_RELAXED);
+
+        fprintf(stream, "    %-10s %10lu commands %8lu batches (%.1f per batch)\n",
+                lane_names[i], served, batches, batches ? (double)served / batches : 0.0);
+    }
+    spin_wait_display(&lanes->consumer_spin, "executor wait", stream);
+    spin_wait_display(&lanes->lanes[LANE_PRIORITY].producer_spin, "priority producers", stream);
+    spin_wait_display(&lanes->lanes[LANE_NORMAL].producer_spin, "normal producers", stream);
+}
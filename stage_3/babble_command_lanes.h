@@ -0,0 +1,114 @@
+#ifndef __BABBLE_COMMAND_LANES_H__
+#define __BABBLE_COMMAND_LANES_H__
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "babble_types.h"
+#include "babble_command_buffer.h"
+
+/**** Priority lanes on top of the command buffers ****/
+
+/* the commands sent to an executor are split between two buffers:
+ * latency-sensitive commands (TIMELINE, FOLLOW_COUNT, RDV) go to the
+ * priority lane, so that they do not wait behind floods of streamed
+ * PUBLISH in the normal lane. The executor picks the lane it serves
+ * according to a policy:
+ *  - LANES_STRICT: the priority lane always comes first, but after
+ *    starvation_limit priority commands in a row while the normal
+ *    lane has commands waiting, a batch of the normal lane is served
+ *  - LANES_WEIGHTED: the lanes are served in turn, the priority lane
+ *    getting weight times more commands per round than the normal
+ *    lane; an empty lane gives its turn away
+ *
+ * The commands of a client are all in the same lane at any time
+ * (see lane_counts_t), so they are still executed in order: a
+ * TIMELINE sent right after streamed PUBLISH goes to the normal lane,
+ * behind them. */
+
+typedef enum{
+    LANE_PRIORITY = 0,
+    LANE_NORMAL,
+    NB_LANES
+} lane_id_t;
+
+typedef enum{
+    LANES_STRICT = 0,
+    LANES_WEIGHTED
+} lane_policy_t;
+
+/* nb of commands of a client queued in each lane and not executed
+ * yet -- allocated by the communication thread of the client and
+ * freed once its UNREGISTER is executed. Also holds the flow control
+ * state of the client: streamed commands queued or executed whose
+ * credit was not given back yet (in_flight), and executed ones to be
+ * given back with the next grant (to_grant, executor side only), and
+ * its commands parked by simulated delays (see babble_delay.h) */
+typedef struct lane_counts{
+    unsigned int pending[NB_LANES];
+    unsigned int in_flight;
+    unsigned int to_grant;
+    struct delayed_command *delayed_first, *delayed_last;
+} lane_counts_t;
+
+typedef struct command_lanes{
+    command_buffer_t lanes[NB_LANES];
+
+    /* consumer parking, shared by the lanes */
+    int consumer_parked __attribute__((aligned(CACHE_LINE_SIZE)));
+    int kicked;             /* see command_lanes_kick() */
+    spin_wait_t consumer_spin;
+    prof_mutex_t mutex;
+    pthread_cond_t not_empty;
+
+    /* used by the consumer only */
+    lane_policy_t policy __attribute__((aligned(CACHE_LINE_SIZE)));
+    int starvation_limit;   /* LANES_STRICT */
+    int weight;             /* LANES_WEIGHTED */
+    int served;             /* priority commands since the last normal
+                             * batch (strict), or commands of the
+                             * current turn (weighted) */
+    lane_id_t turn;         /* lane being served (weighted) */
+    unsigned long nb_served[NB_LANES];
+    unsigned long nb_batches[NB_LANES];
+} command_lanes_t;
+
+void command_lanes_init(command_lanes_t *lanes, unsigned long priority_capacity,
+                        unsigned long normal_capacity, lane_policy_t policy);
+
+/* parse a policy name ("strict" or "weighted"), -1 if unknown */
+int lane_policy_from_str(const char *str);
+
+/* producer side -- choose the lane of the next command of a client
+ * (priority tells if the command is latency-sensitive) and count it
+ * as pending in counts, then reserve/commit in lanes->lanes[lane]
+ * through the functions below */
+lane_id_t command_lanes_select(lane_counts_t *counts, int priority);
+void command_lanes_commit(command_lanes_t *lanes, lane_id_t lane, command_t *cmd);
+void command_lanes_cancel(command_lanes_t *lanes, lane_id_t lane, command_t *cmd);
+
+/* undo command_lanes_select() when no slot could be reserved */
+void command_lanes_unselect(lane_counts_t *counts, lane_id_t lane);
+
+/* consumer side -- get at most max commands of a single lane
+ * (blocking until there is one), stored in *lane, and give them back
+ * with command_buffer_release_batch(&lanes->lanes[*lane], ...).
+ * Returns 0 when the lanes are empty and the consumer was kicked */
+int command_lanes_acquire_batch(command_lanes_t *lanes, command_t **cmds, int max, lane_id_t *lane);
+
+/* make the consumer return from command_lanes_acquire_batch(), even
+ * without commands, to do some work of its own */
+void command_lanes_kick(command_lanes_t *lanes);
+
+/* to be called once a command taken from the lanes has been executed
+ * and answered */
+void command_lanes_done(command_t *cmd);
+
+/* tells if the client has no command pending in any lane */
+int command_lanes_idle(lane_counts_t *counts);
+
+/* display the nb of commands and batches served per lane, and how
+ * often the consumer and the producers spun or parked */
+void command_lanes_stats_display(command_lanes_t *lanes, FILE *stream);
+
+#endif
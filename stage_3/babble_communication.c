@@ -5,19 +5,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
 
 /* writing data of file descriptor */
 static int write_data(int fd, unsigned long size, void* buf)
 {
     unsigned long total_sent=0;
-    unsigned long sent=0;
+    ssize_t sent=0;
     
+    /* stop on errors other than EINTR (eg, the client is gone) */
     do {
         sent = write(fd, ((char*) buf+total_sent), size - total_sent);
         if(sent > 0){
             total_sent += sent;
         }
-    } while(total_sent < size || (sent == -1 && errno != EINTR) );
+    } while(total_sent < size && (sent > 0 || (sent == -1 && errno == EINTR)));
 
     if(sent == -1){
         perror("write_data");
@@ -35,20 +37,22 @@ static int write_data(int fd, unsigned long size, void* buf)
 static int read_data(int fd, unsigned long size, void* buf)
 {
     unsigned long total_recv=0;
-    unsigned long recv=0;
+    ssize_t recv=0;
 
+    /* stop at the end of the stream or on errors other than EINTR */
     do {
         recv = read(fd, ((char*) buf+total_recv), size - total_recv);
         if (recv > 0){
             total_recv += recv;
         }
-    } while(total_recv < size  || (recv == -1 && errno == EINTR));
+    } while(total_recv < size && (recv > 0 || (recv == -1 && errno == EINTR)));
 
     if(recv == -1){
         perror("read_data");
     }
     else{    
-        if(total_recv < size){
+        /* nothing at all: the peer closed the connection */
+        if(total_recv > 0 && total_recv < size){
             fprintf(stderr,"received only %lu/%lu bytes\n", total_recv, size);
         }
     }
@@ -59,8 +63,35 @@ static int read_data(int fd, unsigned long size, void* buf)
 
 
 
+int network_frame_encode(void* out, unsigned long capacity, unsigned long size, void* buf)
+{
+    if(capacity < sizeof(unsigned long) + size){
+        return -1;
+    }
+
+    memcpy(out, &size, sizeof(unsigned long));
+    memcpy((char*) out + sizeof(unsigned long), buf, size);
+
+    return sizeof(unsigned long) + size;
+}
+
+
 int network_send(int fd, unsigned long size, void* buf)
 {   
+    /* small frames are sent with a single write: sending the header
+     * alone would leave the payload waiting for its ack (Nagle) */
+    if(size <= BABBLE_BUFFER_SIZE){
+        char frame[sizeof(unsigned long) + BABBLE_BUFFER_SIZE];
+
+        network_frame_encode(frame, sizeof(frame), size, buf);
+
+        if(write_data(fd, sizeof(unsigned long) + size, frame) != sizeof(unsigned long) + size){
+            perror("writing on socket");
+            return -1;
+        }
+        return size;
+    }
+
     if(write_data(fd, sizeof(unsigned long), &size) != sizeof(unsigned long)){
         perror("writing on socket");
         return -1;
@@ -76,6 +107,17 @@ int network_send(int fd, unsigned long size, void* buf)
 }
 
 
+int network_send_raw(int fd, unsigned long size, void* buf)
+{
+    if(write_data(fd, size, buf) != size){
+        perror("writing on socket");
+        return -1;
+    }
+
+    return size;
+}
+
+
 int network_recv(int fd, void **buf)
 {
     unsigned long payload_size = 0;
@@ -103,4 +145,87 @@ int network_recv(int fd, void **buf)
 }
 
 
+void frame_reader_init(frame_reader_t *reader)
+{
+    reader->data = NULL;
+    reader->capacity = 0;
+    reader->start = 0;
+    reader->end = 0;
+}
+
+
+void frame_reader_free(frame_reader_t *reader)
+{
+    free(reader->data);
+    frame_reader_init(reader);
+}
+
 
+/* make room for need bytes from start: the bytes consumed are dropped
+ * first, the buffer grows if it is not enough */
+static void frame_reader_reserve(frame_reader_t *reader, unsigned long need)
+{
+    if(reader->capacity - reader->start >= need){
+        return;
+    }
+
+    if(reader->start > 0){
+        memmove(reader->data, reader->data + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    if(reader->capacity < need){
+        unsigned long capacity = reader->capacity ? reader->capacity : FRAME_READER_SIZE;
+
+        while(capacity < need){
+            capacity *= 2;
+        }
+        reader->data = realloc(reader->data, capacity);
+        reader->capacity = capacity;
+    }
+}
+
+
+int frame_reader_fill(int fd, frame_reader_t *reader)
+{
+    int r;
+
+    if(reader->start == reader->end){
+        reader->start = reader->end = 0;
+    }
+    if(reader->end == reader->capacity){
+        frame_reader_reserve(reader, reader->end - reader->start + FRAME_READER_SIZE);
+    }
+
+    r = read(fd, reader->data + reader->end, reader->capacity - reader->end);
+    if(r > 0){
+        reader->end += r;
+    }
+
+    return r;
+}
+
+
+void* frame_reader_next(frame_reader_t *reader, unsigned long *size)
+{
+    unsigned long payload_size;
+    void *payload;
+
+    if(reader->end - reader->start < sizeof(unsigned long)){
+        return NULL;
+    }
+    memcpy(&payload_size, reader->data + reader->start, sizeof(unsigned long));
+
+    if(reader->end - reader->start < sizeof(unsigned long) + payload_size){
+        /* the rest of the frame has to fit */
+        frame_reader_reserve(reader, sizeof(unsigned long) + payload_size);
+        return NULL;
+    }
+
+    payload = reader->data + reader->start + sizeof(unsigned long);
+    reader->start += sizeof(unsigned long) + payload_size;
+    *size = payload_size;
+
+    return payload;
+}
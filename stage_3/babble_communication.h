@@ -15,8 +15,41 @@
 /* send the buffer buf of size "size" using the file descriptor fd */
 int network_send(int fd, unsigned long size, void* buf);
 
+/* send size bytes of buf without adding a header -- buf must already
+ * be formatted according to the protocol */
+int network_send_raw(int fd, unsigned long size, void* buf);
+
 /* recv data from the file descriptor fd */
 /* a buffer is allocated to store the data, its size is returned */
 int network_recv(int fd, void **buf);
 
+/* write the frame of a payload (header and payload) in out, returns
+ * its size, -1 if it does not fit in capacity bytes */
+int network_frame_encode(void* out, unsigned long capacity, unsigned long size, void* buf);
+
+/**** Frames received on non-blocking sockets ****/
+
+/* the bytes are read as they come into a buffer, that grows to hold
+ * the largest frame received */
+#define FRAME_READER_SIZE 512
+
+typedef struct frame_reader{
+    char *data;
+    unsigned long capacity;
+    unsigned long start;    /* first byte not consumed */
+    unsigned long end;      /* end of the bytes read */
+} frame_reader_t;
+
+void frame_reader_init(frame_reader_t *reader);
+void frame_reader_free(frame_reader_t *reader);
+
+/* read the bytes available on fd, returns the nb of bytes read, 0 on
+ * end of file, -1 on error (errno set, EAGAIN if nothing available).
+ * The frames returned by frame_reader_next() are not valid anymore */
+int frame_reader_fill(int fd, frame_reader_t *reader);
+
+/* next complete frame: returns its payload and sets its size, NULL if
+ * more bytes are needed */
+void* frame_reader_next(frame_reader_t *reader, unsigned long *size);
+
 #endif
@@ -9,6 +9,9 @@
 #define BABBLE_ID_SIZE 32          /* Maximum size for a client identifier */
 /*********************************************/
 
+/* the options below are the defaults of the settings of the server,
+ * which can be changed at runtime (see babble_settings.h) */
+
 #define BABBLE_BACKLOG 100
 
 #define BABBLE_PORT 5656
@@ -17,15 +20,63 @@
 
 #define BABBLE_TIMELINE_MAX 4
 
-#define BABBLE_EXECUTOR_THREADS 1
+/* workers of the work-stealing pool (0: half the cores) */
+#define BABBLE_EXECUTOR_THREADS 0
 
 /* defines the size of the prod-cons buffer */
 #define BABBLE_PRODCONS_SIZE 4
 
-/* defines the number of prodcons buffers in stage 3 */
-#define BABBLE_PRODCONS_NB 1
+/* defines the number of prodcons buffers (and executors) in stage 3
+ * (0: half the cores) */
+#define BABBLE_PRODCONS_NB 0
+
+/* max nb of commands an executor takes from its buffer at once */
+#define BABBLE_BATCH_SIZE 16
+#define BABBLE_BATCH_MAX 256
+
+/* priority lanes of the executor buffers: size of the priority lane,
+ * max nb of priority commands served in a row while normal commands
+ * wait (strict policy), and nb of priority commands served per normal
+ * command (weighted policy) */
+#define BABBLE_PRIORITY_LANE_SIZE 128
+#define BABBLE_LANES_STARVATION_LIMIT 64
+#define BABBLE_LANES_WEIGHT 4
+
+/* defines the size of the per-client mailboxes of the work-stealing
+ * executor pool */
+#define BABBLE_MAILBOX_SIZE 64
 
 /* expressed in micro-seconds */
 #define MAX_DELAY 10000
 
+/* seed of the random delays, so that runs can be reproduced (0: taken
+ * from the clock) */
+#define BABBLE_DELAY_SEED 1
+
+/* tracing of the commands: one command in BABBLE_TRACE_SAMPLE is
+ * traced (0: no tracing), the traces are written to BABBLE_TRACE_FILE
+ * on SIGUSR2 and by the "STATS trace" command */
+#define BABBLE_TRACE_SAMPLE 0
+#define BABBLE_TRACE_FILE "babble_trace.json"
+
+/* the BABBLE_HOT_CLIENTS clients with the highest cost are reported
+ * by STATS and on SIGUSR1 (0: no accounting). The accounting costs a
+ * few records per command: it is opt-in, as the traces */
+#define BABBLE_HOT_CLIENTS 0
+
+/* the memory used by each subsystem is reported every
+ * BABBLE_MEM_REPORT seconds (0: only on SIGUSR1) */
+#define BABBLE_MEM_REPORT 60
+
+/* flow control of the streamed commands: nb of commands a client may
+ * have in flight (0 disables flow control). Credits are given back by
+ * grant frames: a header frame with BABBLE_CREDIT_GRANT set and the
+ * nb of credits in the low bits, not followed by any message.
+ * BABBLE_CREDIT_BUSY is set when the grant returns the credit of a
+ * command dropped because the server was overloaded. */
+#define BABBLE_CREDIT_WINDOW 32
+#define BABBLE_CREDIT_GRANT 0x80000000u
+#define BABBLE_CREDIT_BUSY 0x40000000u
+#define BABBLE_CREDIT_MASK 0x3fffffffu
+
 #endif
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "babble_delay.h"
+#include "babble_command_lanes.h"
+#include "babble_latency.h"
+#include "babble_pool.h"
+
+/* the wheel and the queues of parked commands of the clients are
+ * protected by lock */
+static timer_wheel_t wheel;
+static lock_prof_t delay_prof = LOCK_PROF_INITIALIZER("delay wheel");
+static prof_mutex_t lock = PROF_MUTEX_INITIALIZER(&delay_prof);
+static pthread_cond_t wakeup;
+static unsigned long sleep_until;   /* tick the delay thread sleeps
+                                     * until, 0 if it is running */
+static int sleeping;
+
+static void (*complete_command)(command_t *cmd);
+static void (*wake_home)(int home);
+static pthread_t delay_thread;
+
+/* commands whose delay is over, per home (pushed by the delay thread,
+ * taken by their home), NULL if delays are not active */
+static delayed_command_t **resumed;
+static __thread int local_home = -1;
+
+/* stats */
+static unsigned long nb_delayed;    /* parked with a delay of their own */
+static unsigned long nb_behind;     /* parked behind another command */
+static unsigned long nb_parked;     /* currently parked */
+static unsigned long max_parked;
+
+static unsigned long now_tick(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000UL + ts.tv_nsec / 1000) / DELAY_TICK;
+}
+
+/* called with lock held */
+static void delay_schedule(delayed_command_t *dc)
+{
+    timer_wheel_add(&wheel, &dc->timer, dc->deadline);
+
+    /* the delay thread sleeps past the deadline */
+    if (sleeping && (sleep_until == 0 || dc->deadline < sleep_until))
+    {
+        pthread_cond_signal(&wakeup);
+    }
+}
+
+int delay_command(command_t *cmd)
+{
+    lane_counts_t *counts = cmd->counts;
+    unsigned int delay = latency_draw(cmd->cid);
+    delayed_command_t *dc;
+
+    prof_mutex_lock(&lock);
+    if (counts->delayed_first == NULL && delay == 0)
+    {
+        prof_mutex_unlock(&lock);
+        return 0;
+    }
+
+    dc = pool_alloc(POOL_DELAYED);
+    dc->cmd = *cmd;
+    dc->deadline = now_tick() + (delay + DELAY_TICK - 1) / DELAY_TICK;
+    dc->home = local_home;
+    dc->next = NULL;
+
+    if (counts->delayed_first == NULL)
+    {
+        counts->delayed_first = counts->delayed_last = dc;
+        delay_schedule(dc);
+        nb_delayed++;
+    }
+    else
+    {
+        counts->delayed_last->next = dc;
+        counts->delayed_last = dc;
+        nb_behind++;
+    }
+    if (++nb_parked > max_parked)
+    {
+        max_parked = nb_parked;
+    }
+    prof_mutex_unlock(&lock);
+
+    return 1;
+}
+
+/* complete the expired command of a client, then the commands parked
+ * behind it whose deadline is over -- called by its home, without the
+ * lock */
+static void delay_complete_client(delayed_command_t *dc)
+{
+    while (dc != NULL)
+    {
+        lane_counts_t *counts = dc->cmd.counts;
+        delayed_command_t *next;
+
+        /* UNREGISTER is the last command of the client, and its
+         * counts are gone once it is completed */
+        int last = (dc->cmd.cid == UNREGISTER);
+
+        complete_command(&dc->cmd);
+
+        prof_mutex_lock(&lock);
+        nb_parked--;
+        next = last ? NULL : dc->next;
+        if (!last)
+        {
+            /* the following commands of the client were held back
+             * until now */
+            counts->delayed_first = next;
+            if (next == NULL)
+            {
+                counts->delayed_last = NULL;
+            }
+            else if (next->deadline > now_tick())
+            {
+                delay_schedule(next);
+                next = NULL;
+            }
+        }
+        prof_mutex_unlock(&lock);
+
+        pool_free(POOL_DELAYED, dc);
+        dc = next;
+    }
+}
+
+static void tick_to_timespec(unsigned long tick, struct timespec *ts)
+{
+    unsigned long us = tick * DELAY_TICK;
+    ts->tv_sec = us / 1000000;
+    ts->tv_nsec = (us % 1000000) * 1000;
+}
+
+/* give an expired command back to its home -- the delay thread is
+ * the only producer, but the home takes the whole list at once */
+static void delay_hand_back(delayed_command_t *dc)
+{
+    delayed_command_t *head = __atomic_load_n(&resumed[dc->home], __ATOMIC_RELAXED);
+
+    do
+    {
+        dc->resumed_next = head;
+    } while (!__atomic_compare_exchange_n(&resumed[dc->home], &head, dc, 0,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    wake_home(dc->home);
+}
+
+void delay_resume(void)
+{
+    delayed_command_t *list, *fifo = NULL, *next;
+
+    if (resumed == NULL || local_home < 0 ||
+        __atomic_load_n(&resumed[local_home], __ATOMIC_RELAXED) == NULL)
+    {
+        return;
+    }
+
+    /* the list is in reverse order of expiry */
+    list = __atomic_exchange_n(&resumed[local_home], NULL, __ATOMIC_ACQUIRE);
+    for (; list != NULL; list = next)
+    {
+        next = list->resumed_next;
+        list->resumed_next = fifo;
+        fifo = list;
+    }
+
+    for (; fifo != NULL; fifo = next)
+    {
+        next = fifo->resumed_next;
+        delay_complete_client(fifo);
+    }
+}
+
+void delay_home_register(int home)
+{
+    local_home = home;
+}
+
+/* the delay thread only manages the wheel: the expired commands are
+ * run by their homes */
+static void *delay_thread_routine(void *arg)
+{
+    wheel_timer_t *expired, *next;
+    struct timespec ts;
+
+    prof_mutex_lock(&lock);
+    while (1)
+    {
+        expired = timer_wheel_advance(&wheel, now_tick());
+        if (expired != NULL)
+        {
+            prof_mutex_unlock(&lock);
+            for (; expired != NULL; expired = next)
+            {
+                next = expired->next;
+                delay_hand_back((delayed_command_t *)expired);
+            }
+            prof_mutex_lock(&lock);
+            continue;
+        }
+
+        sleep_until = timer_wheel_next_tick(&wheel);
+        sleeping = 1;
+        if (sleep_until == 0)
+        {
+            prof_cond_wait(&wakeup, &lock);
+        }
+        else
+        {
+            tick_to_timespec(sleep_until, &ts);
+            prof_cond_timedwait(&wakeup, &lock, &ts);
+        }
+        sleeping = 0;
+    }
+
+    return NULL;
+}
+
+void delay_init(int nb_homes, void (*complete)(command_t *cmd), void (*wake)(int home))
+{
+    pthread_condattr_t attr;
+
+    complete_command = complete;
+    wake_home = wake;
+    if ((resumed = calloc(nb_homes, sizeof(delayed_command_t *))) == NULL)
+    {
+        perror("delay init");
+        exit(EXIT_FAILURE);
+    }
+    timer_wheel_init(&wheel, now_tick());
+
+    /* deadlines are taken from the monotonic clock */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wakeup, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&delay_thread, NULL, delay_thread_routine, NULL) != 0)
+    {
+        fprintf(stderr, "Error -- unable to create delay thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void delay_stats_display(FILE *stream)
+{
+    prof_mutex_lock(&lock);
+    fprintf(stream, "### delays: %lu commands delayed, %lu parked behind them, %lu parked now (max %lu), %lu cascaded on the wheel\n",
+            nb_delayed, nb_behind, nb_parked, max_parked, wheel.nb_cascaded);
+    prof_mutex_unlock(&lock);
+}
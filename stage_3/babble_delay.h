@@ -0,0 +1,60 @@
+#ifndef __BABBLE_DELAY_H__
+#define __BABBLE_DELAY_H__
+
+#include <stdio.h>
+
+#include "babble_types.h"
+#include "babble_timer_wheel.h"
+
+/**** Simulated latency of the commands ****/
+
+/* commands get a delay drawn from their latency profile (see
+ * babble_latency.h), as if they waited for a backend. Instead of
+ * sleeping in the executor, the command is copied and parked on a
+ * timer wheel; the executor goes on with the commands of other
+ * clients. A delay thread manages the wheel: when the delay of a
+ * command is over, the command is handed back to the executor (or
+ * worker) that parked it, which completes it between two batches.
+ *
+ * The commands of a client stay ordered: once a command of the client
+ * is parked, the following ones are parked behind it (whatever their
+ * own delay) and completed in order. Only the oldest parked command of
+ * a client is on the wheel. */
+
+/* tick of the timer wheel, expressed in micro-seconds */
+#define DELAY_TICK 100
+
+typedef struct delayed_command{
+    wheel_timer_t timer;
+    command_t cmd;                  /* copy of the command */
+    unsigned long deadline;         /* tick */
+    int home;                       /* executor or worker that parked
+                                     * it */
+    struct delayed_command *next;   /* next parked command of the
+                                     * client */
+    struct delayed_command *resumed_next;   /* in the list of commands
+                                             * handed back to home */
+} delayed_command_t;
+
+/* start the delay thread for nb_homes executors (or workers):
+ * complete() runs a parked command and answers it (the copy is freed
+ * afterwards), wake(home) makes home call delay_resume() soon */
+void delay_init(int nb_homes, void (*complete)(command_t *cmd), void (*wake)(int home));
+
+/* to be called by each executor (or worker) with its id, before it
+ * runs commands */
+void delay_home_register(int home);
+
+/* called by the executors on each command when some profile is set:
+ * returns 1 if the command was parked (the caller is done with it),
+ * 0 if it must be executed now */
+int delay_command(command_t *cmd);
+
+/* complete the commands handed back to the calling executor, and the
+ * ones of their clients parked behind them whose delay is over */
+void delay_resume(void);
+
+/* display the nb of parked commands and the activity of the wheel */
+void delay_stats_display(FILE *stream);
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "babble_distribution.h"
+#include "fastrand.h"
+
+static const char *dist_names[] = {"none", "fixed", "uniform", "exp", "lognormal", "bimodal"};
+static const int dist_nb_params[] = {0, 1, 2, 1, 2, 3};
+
+int latency_profile_parse(const char *spec, latency_profile_t *profile)
+{
+    double params[3] = {0, 0, 0};
+    const char *p = strchr(spec, ':');
+    size_t len = p ? (size_t)(p - spec) : strlen(spec);
+    int dist, n = 0;
+    char *end;
+
+    for (dist = LATENCY_NONE; dist <= LATENCY_BIMODAL; dist++)
+    {
+        if (strlen(dist_names[dist]) == len && !strncmp(dist_names[dist], spec, len))
+        {
+            break;
+        }
+    }
+    if (dist > LATENCY_BIMODAL)
+    {
+        return -1;
+    }
+
+    while (p != NULL)
+    {
+        if (n == 3)
+        {
+            return -1;
+        }
+        params[n++] = strtod(p + 1, &end);
+        if (end == p + 1 || params[n - 1] < 0 || (*end != ':' && *end != '\0'))
+        {
+            return -1;
+        }
+        p = (*end == ':') ? end : NULL;
+    }
+    if (n != dist_nb_params[dist])
+    {
+        return -1;
+    }
+
+    /* uniform needs MIN <= MAX, bimodal a probability */
+    if ((dist == LATENCY_UNIFORM && params[0] > params[1]) ||
+        (dist == LATENCY_BIMODAL && params[2] > 1))
+    {
+        return -1;
+    }
+
+    profile->dist = dist;
+    profile->a = params[0];
+    profile->b = params[1];
+    profile->p = params[2];
+    return 0;
+}
+
+int latency_spec_check(const char *spec)
+{
+    latency_profile_t profile;
+    return latency_profile_parse(spec, &profile);
+}
+
+/* uniform in ]0, 1[ */
+static double uniform01(void)
+{
+    return (fastRandom32() + 0.5) / 4294967296.0;
+}
+
+static double draw_exp(double mean)
+{
+    return -mean * log(uniform01());
+}
+
+/* standard normal (Box-Muller) */
+static double draw_normal(void)
+{
+    return sqrt(-2 * log(uniform01())) * cos(2 * M_PI * uniform01());
+}
+
+double latency_profile_draw(const latency_profile_t *profile)
+{
+    switch (profile->dist)
+    {
+    case LATENCY_NONE:
+        return 0;
+    case LATENCY_FIXED:
+        return profile->a;
+    case LATENCY_UNIFORM:
+        return profile->a + (profile->b - profile->a) * uniform01();
+    case LATENCY_EXP:
+        return draw_exp(profile->a);
+    case LATENCY_LOGNORMAL:
+        return profile->a * exp(profile->b * draw_normal());
+    case LATENCY_BIMODAL:
+        return draw_exp(uniform01() < profile->p ? profile->b : profile->a);
+    }
+
+    return 0;
+}
+
+void latency_profile_print(FILE *stream, const latency_profile_t *profile)
+{
+    fprintf(stream, "%s", dist_names[profile->dist]);
+    switch (dist_nb_params[profile->dist])
+    {
+    case 1:
+        fprintf(stream, ":%g", profile->a);
+        break;
+    case 2:
+        fprintf(stream, ":%g:%g", profile->a, profile->b);
+        break;
+    case 3:
+        fprintf(stream, ":%g:%g:%g", profile->a, profile->b, profile->p);
+        break;
+    }
+}
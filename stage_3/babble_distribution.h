@@ -0,0 +1,46 @@
+#ifndef __BABBLE_DISTRIBUTION_H__
+#define __BABBLE_DISTRIBUTION_H__
+
+#include <stdio.h>
+
+/**** Random durations drawn from a distribution ****/
+
+/* a distribution is given as a spec (all durations in micro-seconds):
+ *  - none
+ *  - fixed:D
+ *  - uniform:MIN:MAX
+ *  - exp:MEAN                  exponential
+ *  - lognormal:MEDIAN:SIGMA    sigma of the underlying normal
+ *  - bimodal:FAST:SLOW:P       exponential of mean SLOW with
+ *                              probability P, of mean FAST otherwise
+ * The values are drawn from fastrand.c, that has a state per thread.
+ * Used by the server for the simulated delays of the commands and by
+ * the test clients for their think times. */
+
+typedef enum{
+    LATENCY_NONE = 0,
+    LATENCY_FIXED,
+    LATENCY_UNIFORM,
+    LATENCY_EXP,
+    LATENCY_LOGNORMAL,
+    LATENCY_BIMODAL
+} latency_dist_t;
+
+typedef struct latency_profile{
+    latency_dist_t dist;
+    double a, b, p;     /* parameters, in the order of the spec */
+} latency_profile_t;
+
+/* parse a spec, returns -1 if it is not valid */
+int latency_profile_parse(const char *spec, latency_profile_t *profile);
+
+/* same, only to validate a setting */
+int latency_spec_check(const char *spec);
+
+/* draw a duration, in micro-seconds (0 for none) */
+double latency_profile_draw(const latency_profile_t *profile);
+
+/* print the profile as a spec */
+void latency_profile_print(FILE *stream, const latency_profile_t *profile);
+
+#endif
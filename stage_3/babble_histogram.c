@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include "babble_histogram.h"
+
+static unsigned int hist_index(unsigned long value)
+{
+    if (value < 2 * HIST_SUB_COUNT)
+    {
+        return value;
+    }
+    if (value >= (1UL << HIST_MAX_BITS))
+    {
+        return HIST_NB_BUCKETS - 1;
+    }
+
+    /* value >> shift has HIST_SUB_BITS + 1 bits */
+    unsigned int shift = 63 - __builtin_clzl(value) - HIST_SUB_BITS;
+    return shift * HIST_SUB_COUNT + (value >> shift);
+}
+
+/* highest value of a bucket */
+static unsigned long hist_value(unsigned int index)
+{
+    if (index < 2 * HIST_SUB_COUNT)
+    {
+        return index;
+    }
+
+    unsigned int shift = index / HIST_SUB_COUNT - 1;
+    unsigned long sub = index % HIST_SUB_COUNT + HIST_SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+void hist_init(histogram_t *h)
+{
+    memset(h, 0, sizeof(histogram_t));
+}
+
+/* the writer does plain read-modify-write: only the stores have to be
+ * atomic for the readers */
+void hist_record(histogram_t *h, unsigned long value)
+{
+    unsigned int index = hist_index(value);
+
+    __atomic_store_n(&h->counts[index], h->counts[index] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum, h->sum + value, __ATOMIC_RELAXED);
+    if (value > h->max)
+    {
+        __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&h->total, h->total + 1, __ATOMIC_RELAXED);
+}
+
+void hist_record_atomic(histogram_t *h, unsigned long value)
+{
+    unsigned long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&h->counts[hist_index(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+    while (value > max &&
+           !__atomic_compare_exchange_n(&h->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+    __atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+}
+
+/* the total is recomputed from the buckets, so that the merged
+ * histogram is consistent even if src is being written */
+void hist_merge(histogram_t *dst, histogram_t *src)
+{
+    unsigned long max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&src->total, __ATOMIC_RELAXED) == 0)
+    {
+        return;
+    }
+
+    for (unsigned int i = 0; i < HIST_NB_BUCKETS; i++)
+    {
+        unsigned long count = __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED);
+        dst->counts[i] += count;
+        dst->total += count;
+    }
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    if (max > dst->max)
+    {
+        dst->max = max;
+    }
+}
+
+unsigned long hist_percentile(histogram_t *h, double q)
+{
+    unsigned long rank = (unsigned long)(q * h->total + 0.5), seen = 0;
+
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+
+    for (unsigned int i = 0; i < HIST_NB_BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if (seen >= rank)
+        {
+            /* the bucket may go beyond the largest value seen */
+            unsigned long value = hist_value(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+
+    return h->max;
+}
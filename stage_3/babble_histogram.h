@@ -0,0 +1,39 @@
+#ifndef __BABBLE_HISTOGRAM_H__
+#define __BABBLE_HISTOGRAM_H__
+
+/**** Log-linear histograms of durations ****/
+
+/* in the spirit of HdrHistogram: values (nano-seconds) below
+ * 2^(HIST_SUB_BITS+1) have a bucket each, above, each power of two is
+ * split in 2^HIST_SUB_BITS buckets, so that a value is known within
+ * 1/2^HIST_SUB_BITS (3%). Values above 2^HIST_MAX_BITS ns (68s) are
+ * counted in the last bucket. */
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1UL << HIST_SUB_BITS)
+#define HIST_MAX_BITS 36
+#define HIST_NB_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct histogram{
+    unsigned long counts[HIST_NB_BUCKETS];
+    unsigned long total;    /* nb of values */
+    unsigned long sum;      /* to compute the mean */
+    unsigned long max;
+} histogram_t;
+
+void hist_init(histogram_t *h);
+
+/* record a value -- a histogram has a single writer, other threads
+ * may read it at any time with hist_merge() */
+void hist_record(histogram_t *h, unsigned long value);
+
+/* same, for a histogram shared by several writers */
+void hist_record_atomic(histogram_t *h, unsigned long value);
+
+/* add the values of src to dst (dst is private to the caller) */
+void hist_merge(histogram_t *dst, histogram_t *src);
+
+/* value at quantile q (0 < q <= 1), as the highest value of its
+ * bucket */
+unsigned long hist_percentile(histogram_t *h, double q);
+
+#endif
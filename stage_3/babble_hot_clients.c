@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "babble_hot_clients.h"
+#include "babble_registration.h"
+#include "babble_lock_prof.h"
+
+static const char *metric_names[NB_HOT_METRICS] = {"commands", "fanout", "bytes", "cpu"};
+
+/* space-saving counters, indexed by key with linear probing */
+typedef struct hot_set{
+    prof_mutex_t lock;      /* taken by the readers only, besides its
+                             * thread */
+    int nb;                 /* counters in use */
+    hot_client_t *counters;
+    unsigned long *ranks;   /* their ranking costs, packed for the
+                             * search of the minimum */
+    int *index;             /* counter + 1, 0 for an empty slot */
+    int in_use;             /* by a running thread */
+    struct hot_set *next;
+} hot_set_t;
+
+static int nb_reported;
+static hot_metric_t rank_metric;
+static int nb_counters;
+static unsigned long index_mask;
+
+/* the sets of all threads (never freed) */
+static hot_set_t *sets;
+static pthread_mutex_t sets_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t sets_key;
+static pthread_once_t sets_once = PTHREAD_ONCE_INIT;
+static lock_prof_t hot_prof = LOCK_PROF_INITIALIZER("hot clients");
+
+static __thread hot_set_t *local_set;
+
+static hot_set_t *hot_set_create(void)
+{
+    hot_set_t *set = calloc(1, sizeof(hot_set_t));
+
+    if (set == NULL
+        || (set->counters = malloc(nb_counters * sizeof(hot_client_t))) == NULL
+        || (set->ranks = malloc(nb_counters * sizeof(unsigned long))) == NULL
+        || (set->index = calloc(index_mask + 1, sizeof(int))) == NULL)
+    {
+        perror("hot clients");
+        exit(EXIT_FAILURE);
+    }
+    prof_mutex_init(&set->lock, &hot_prof);
+
+    return set;
+}
+
+void hot_clients_init(int nb, hot_metric_t metric)
+{
+    nb_reported = nb;
+    rank_metric = metric;
+    if (nb == 0)
+    {
+        return;
+    }
+
+    /* at most half of the index slots are used */
+    nb_counters = nb * HOT_CLIENTS_FACTOR;
+    for (index_mask = 1; index_mask < 2UL * nb_counters; index_mask <<= 1)
+        ;
+    index_mask--;
+}
+
+/* called when a thread exits: its set (and the costs it holds) goes
+ * to the next thread */
+static void set_release(void *arg)
+{
+    hot_set_t *set = arg;
+
+    pthread_mutex_lock(&sets_lock);
+    set->in_use = 0;
+    pthread_mutex_unlock(&sets_lock);
+}
+
+static void sets_key_create(void)
+{
+    pthread_key_create(&sets_key, set_release);
+}
+
+static hot_set_t *get_set(void)
+{
+    hot_set_t *set = local_set;
+
+    if (set != NULL)
+    {
+        return set;
+    }
+
+    pthread_once(&sets_once, sets_key_create);
+
+    pthread_mutex_lock(&sets_lock);
+    for (set = sets; set != NULL && set->in_use; set = set->next)
+        ;
+    if (set == NULL)
+    {
+        set = hot_set_create();
+        set->next = sets;
+        sets = set;
+    }
+    set->in_use = 1;
+    pthread_mutex_unlock(&sets_lock);
+
+    pthread_setspecific(sets_key, set);
+    local_set = set;
+
+    return set;
+}
+
+void hot_clients_thread_register(void)
+{
+    if (nb_reported == 0)
+    {
+        return;
+    }
+
+    get_set();
+}
+
+static unsigned long slot_of(unsigned long key)
+{
+    /* the keys are djb2 hashes of the names: mix their bits */
+    return ((key * 0x9e3779b97f4a7c15UL) >> 32) & index_mask;
+}
+
+/* slot of the index pointing to the counter of key, or to the empty
+ * slot where it would be inserted */
+static unsigned long index_find(hot_set_t *set, unsigned long key)
+{
+    unsigned long s = slot_of(key);
+
+    while (set->index[s] && set->counters[set->index[s] - 1].key != key)
+    {
+        s = (s + 1) & index_mask;
+    }
+
+    return s;
+}
+
+/* remove the slot s from the index: the following slots of its
+ * cluster are shifted back when s is on their probing path */
+static void index_remove(hot_set_t *set, unsigned long s)
+{
+    unsigned long next = s, home;
+
+    while (1)
+    {
+        next = (next + 1) & index_mask;
+        if (set->index[next] == 0)
+        {
+            break;
+        }
+        home = slot_of(set->counters[set->index[next] - 1].key);
+        if (((next - home) & index_mask) >= ((next - s) & index_mask))
+        {
+            set->index[s] = set->index[next];
+            s = next;
+        }
+    }
+    set->index[s] = 0;
+}
+
+/* the counter of the cheapest client is given to key */
+static int counter_evict(hot_set_t *set, unsigned long key)
+{
+    int min = 0;
+
+    for (int i = 1; i < set->nb; i++)
+    {
+        if (set->ranks[i] < set->ranks[min])
+        {
+            min = i;
+        }
+    }
+
+    index_remove(set, index_find(set, set->counters[min].key));
+    set->index[index_find(set, key)] = min + 1;
+
+    hot_client_t *c = &set->counters[min];
+    c->error = set->ranks[min];
+    memset(c->costs, 0, sizeof(c->costs));
+    c->costs[rank_metric] = c->error;
+    c->key = key;
+
+    return min;
+}
+
+void hot_clients_record(unsigned long key, unsigned long commands, unsigned long fanout,
+                        unsigned long bytes, unsigned long cpu_ns)
+{
+    unsigned long costs[NB_HOT_METRICS] = {commands, fanout, bytes, cpu_ns};
+    hot_set_t *set;
+    unsigned long s;
+    int c;
+
+    if (nb_reported == 0)
+    {
+        return;
+    }
+    set = get_set();
+
+    prof_mutex_lock(&set->lock);
+    s = index_find(set, key);
+    if (set->index[s])
+    {
+        c = set->index[s] - 1;
+    }
+    else if (costs[rank_metric] == 0)
+    {
+        /* nothing to rank it by: not worth a counter */
+        prof_mutex_unlock(&set->lock);
+        return;
+    }
+    else if (set->nb < nb_counters)
+    {
+        c = set->nb++;
+        memset(&set->counters[c], 0, sizeof(hot_client_t));
+        set->counters[c].key = key;
+        set->index[s] = c + 1;
+    }
+    else
+    {
+        c = counter_evict(set, key);
+    }
+
+    for (int m = 0; m < NB_HOT_METRICS; m++)
+    {
+        set->counters[c].costs[m] += costs[m];
+    }
+    set->ranks[c] = set->counters[c].costs[rank_metric];
+    prof_mutex_unlock(&set->lock);
+}
+
+static void set_copy(hot_set_t *set, hot_client_t *out, int *nb)
+{
+    prof_mutex_lock(&set->lock);
+    memcpy(out + *nb, set->counters, set->nb * sizeof(hot_client_t));
+    *nb += set->nb;
+    prof_mutex_unlock(&set->lock);
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+    unsigned long ka = ((const hot_client_t *)a)->key, kb = ((const hot_client_t *)b)->key;
+    return ka < kb ? -1 : ka > kb;
+}
+
+static int compare_costs(const void *a, const void *b)
+{
+    unsigned long ca = ((const hot_client_t *)a)->costs[rank_metric];
+    unsigned long cb = ((const hot_client_t *)b)->costs[rank_metric];
+    return ca > cb ? -1 : ca < cb;
+}
+
+int hot_clients_top(hot_client_t *top, int nb)
+{
+    hot_client_t *all;
+    int nb_sets = 0, nb_all = 0, nb_merged = 0;
+
+    if (nb_reported == 0)
+    {
+        return 0;
+    }
+
+    /* the sets are never freed: the ones registered after the count
+     * are ignored */
+    pthread_mutex_lock(&sets_lock);
+    hot_set_t *first = sets;
+    for (hot_set_t *set = sets; set != NULL; set = set->next)
+    {
+        nb_sets++;
+    }
+    pthread_mutex_unlock(&sets_lock);
+
+    if ((all = malloc(nb_sets * nb_counters * sizeof(hot_client_t))) == NULL)
+    {
+        return 0;
+    }
+
+    for (hot_set_t *set = first; set != NULL; set = set->next)
+    {
+        set_copy(set, all, &nb_all);
+    }
+
+    /* the costs of a client recorded by several threads are summed */
+    qsort(all, nb_all, sizeof(hot_client_t), compare_keys);
+    for (int i = 0; i < nb_all; i++)
+    {
+        if (nb_merged > 0 && all[nb_merged - 1].key == all[i].key)
+        {
+            all[nb_merged - 1].error += all[i].error;
+            for (int m = 0; m < NB_HOT_METRICS; m++)
+            {
+                all[nb_merged - 1].costs[m] += all[i].costs[m];
+            }
+        }
+        else
+        {
+            all[nb_merged++] = all[i];
+        }
+    }
+    qsort(all, nb_merged, sizeof(hot_client_t), compare_costs);
+
+    nb = nb < nb_merged ? nb : nb_merged;
+    memcpy(top, all, nb * sizeof(hot_client_t));
+    free(all);
+
+    return nb;
+}
+
+void hot_clients_summary(int rank, const hot_client_t *client, char *buf, size_t size)
+{
+    client_bundle_t *bundle = registration_lookup(client->key);
+    unsigned long cost = client->costs[rank_metric];
+    char name[BABBLE_ID_SIZE];
+
+    /* the clients that left are shown by their key */
+    if (bundle != NULL)
+    {
+        snprintf(name, sizeof(name), "%s", bundle->client_name);
+    }
+    else
+    {
+        snprintf(name, sizeof(name), "key %lu", client->key);
+    }
+
+    /* the error is the overestimation of the ranking cost */
+    snprintf(buf, size, "#%-3d %-24s %10lu cmds %10lu fanout %12lu bytes %10.1f cpu ms  (error %.1f%%)\n",
+             rank + 1, name,
+             client->costs[HOT_COMMANDS], client->costs[HOT_FANOUT],
+             client->costs[HOT_BYTES], client->costs[HOT_CPU] / 1000000.0,
+             cost ? 100.0 * client->error / cost : 0.0);
+}
+
+void hot_clients_display(FILE *stream)
+{
+    hot_client_t *top;
+    char line[BABBLE_BUFFER_SIZE];
+    int nb;
+
+    if (nb_reported == 0 || (top = malloc(nb_reported * sizeof(hot_client_t))) == NULL)
+    {
+        return;
+    }
+
+    nb = hot_clients_top(top, nb_reported);
+    fprintf(stream, "### hot clients (by %s, %d counters per thread)\n", metric_names[rank_metric], nb_counters);
+    for (int i = 0; i < nb; i++)
+    {
+        hot_clients_summary(i, &top[i], line, sizeof(line));
+        fprintf(stream, "    %s", line);
+    }
+    free(top);
+}
@@ -0,0 +1,71 @@
+#ifndef __BABBLE_HOT_CLIENTS_H__
+#define __BABBLE_HOT_CLIENTS_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**** The clients that cost the most (heavy hitters) ****/
+
+/* four costs are accounted per client:
+ *  - commands: commands it issued that were executed
+ *  - fanout:   timeline insertions done by its PUBLISH (one per
+ *              follower and msg)
+ *  - bytes:    sent to it (answers and credit grants)
+ *  - cpu:      execution time of its commands, in ns (the simulated
+ *              delays excluded)
+ * Tracking every client would cost as much memory as the registry:
+ * the clients are ranked by one of the costs with the space-saving
+ * algorithm instead, that keeps HOT_CLIENTS_FACTOR counters per
+ * reported client. A client without a counter takes the one of the
+ * cheapest client, whose cost becomes its error bound. Within the set
+ * of a thread, any client whose cost recorded by that thread is above
+ * its total/nb_counters is guaranteed to be kept; once the sets are
+ * merged, a client whose cost is spread over several threads may have
+ * been evicted from each of them, so the merged top is approximate.
+ * The other costs of a client are accounted from the moment it got
+ * its counter only.
+ *
+ * Each thread records into a set of counters of its own, registered
+ * on its first record, so that the communication threads do not
+ * contend on a lock; the sets of the threads that exited are reused
+ * by the new ones. The sets are merged when they are read. */
+
+typedef enum{
+    HOT_COMMANDS = 0,
+    HOT_FANOUT,
+    HOT_BYTES,
+    HOT_CPU,
+    NB_HOT_METRICS
+} hot_metric_t;
+
+/* counters kept per reported client */
+#define HOT_CLIENTS_FACTOR 4
+
+typedef struct hot_client{
+    unsigned long key;
+    unsigned long error;    /* overestimation of the ranking cost */
+    unsigned long costs[NB_HOT_METRICS];
+} hot_client_t;
+
+/* report the nb_reported clients with the highest cost of metric, 0
+ * disables the accounting */
+void hot_clients_init(int nb_reported, hot_metric_t metric);
+
+/* give the calling thread its counters now rather than on its first
+ * record */
+void hot_clients_thread_register(void);
+
+/* account costs to a client */
+void hot_clients_record(unsigned long key, unsigned long commands, unsigned long fanout,
+                        unsigned long bytes, unsigned long cpu_ns);
+
+/* the (at most) nb top clients by decreasing cost, returns their nb */
+int hot_clients_top(hot_client_t *top, int nb);
+
+/* one line of summary for the client ranked rank */
+void hot_clients_summary(int rank, const hot_client_t *client, char *buf, size_t size);
+
+/* display the summary of the top clients */
+void hot_clients_display(FILE *stream);
+
+#endif
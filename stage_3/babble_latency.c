@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "babble_latency.h"
+#include "babble_settings.h"
+#include "babble_utils.h"
+
+/* profile of each command id */
+static latency_profile_t profiles[NB_COMMAND_IDS];
+
+/* seed shared by the threads, fixed at init */
+static uint32_t seed;
+
+void latency_init(void)
+{
+    const char *specs[NB_COMMAND_IDS] = {NULL};
+
+    specs[PUBLISH] = settings.delay_publish;
+    specs[FOLLOW] = settings.delay_follow;
+    specs[TIMELINE] = settings.delay_timeline;
+    specs[FOLLOW_COUNT] = settings.delay_follow_count;
+    specs[RDV] = settings.delay_rdv;
+
+    for (int cid = LOGIN; cid < NB_COMMAND_IDS; cid++)
+    {
+        profiles[cid].dist = LATENCY_NONE;
+        if (specs[cid] != NULL)
+        {
+            /* already checked by the settings */
+            latency_profile_parse(specs[cid], &profiles[cid]);
+        }
+        else if (settings.random_delay && (cid == PUBLISH || cid == FOLLOW || cid == TIMELINE))
+        {
+            profiles[cid].dist = LATENCY_UNIFORM;
+            profiles[cid].a = 0;
+            profiles[cid].b = MAX_DELAY;
+        }
+    }
+
+    seed = settings.delay_seed ? settings.delay_seed : time(NULL);
+}
+
+int latency_active(int cid)
+{
+    if (cid >= 0)
+    {
+        return profiles[cid].dist != LATENCY_NONE;
+    }
+    for (cid = LOGIN; cid < NB_COMMAND_IDS; cid++)
+    {
+        if (profiles[cid].dist != LATENCY_NONE)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+unsigned int latency_draw(int cid)
+{
+    double d = latency_profile_draw(&profiles[cid]);
+
+    return d < LATENCY_MAX ? (unsigned int)d : LATENCY_MAX;
+}
+
+uint32_t latency_seed(int thread_index)
+{
+    return seed + thread_index * 100;
+}
+
+void latency_display(FILE *stream)
+{
+    fprintf(stream, "### delay profiles (seed %u)\n", seed);
+    for (int cid = PUBLISH; cid < UNREGISTER; cid++)
+    {
+        fprintf(stream, "    %-12s ", command_name(cid));
+        latency_profile_print(stream, &profiles[cid]);
+        fprintf(stream, "\n");
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef __BABBLE_LATENCY_H__
+#define __BABBLE_LATENCY_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "babble_types.h"
+#include "babble_distribution.h"
+
+/**** Latency injection profiles ****/
+
+/* each command can be given a delay distribution, as a spec (see
+ * babble_distribution.h). The specs come from the delay_<command>
+ * settings; -r gives PUBLISH, FOLLOW and TIMELINE the historical
+ * uniform:0:MAX_DELAY unless they have a spec. Delays are seeded from
+ * the delay_seed setting so that runs can be reproduced. */
+
+/* longest delay drawn, the tails are cut there */
+#define LATENCY_MAX 10000000
+
+/* build the profiles of the commands from the settings */
+void latency_init(void);
+
+/* tells if a command, or any command for cid -1, has a delay */
+int latency_active(int cid);
+
+/* draw the delay of a command, in micro-seconds */
+unsigned int latency_draw(int cid);
+
+/* seed of the random generator of a thread drawing delays */
+uint32_t latency_seed(int thread_index);
+
+/* display the profile of each command */
+void latency_display(FILE *stream);
+
+#endif
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "babble_lock_prof.h"
+
+/* max nb of profiles displayed */
+#define LOCK_PROF_MAX 64
+
+static int profiling;
+
+static lock_prof_t *profs;
+static pthread_mutex_t profs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* date of the acquisition of the read lock held by the thread */
+static __thread unsigned long read_acquired;
+
+static unsigned long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void lock_prof_enable(int enabled)
+{
+    profiling = enabled;
+}
+
+static void lock_prof_register(lock_prof_t *prof)
+{
+    if (__atomic_load_n(&prof->registered, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&profs_lock);
+    if (!prof->registered)
+    {
+        prof->next = profs;
+        profs = prof;
+        __atomic_store_n(&prof->registered, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&profs_lock);
+}
+
+/* an acquisition, start is 0 if it was not contended -- returns the
+ * date of the acquisition */
+static unsigned long lock_prof_acquired(lock_prof_t *prof, unsigned long start)
+{
+    unsigned long now = now_ns();
+
+    lock_prof_register(prof);
+    __atomic_fetch_add(&prof->nb_acquired, 1, __ATOMIC_RELAXED);
+    if (start)
+    {
+        __atomic_fetch_add(&prof->nb_contended, 1, __ATOMIC_RELAXED);
+        hist_record_atomic(&prof->wait, now - start);
+    }
+
+    return now;
+}
+
+void prof_mutex_init(prof_mutex_t *m, lock_prof_t *prof)
+{
+    pthread_mutex_init(&m->mutex, NULL);
+    m->prof = prof;
+    m->acquired = 0;
+}
+
+void prof_mutex_destroy(prof_mutex_t *m)
+{
+    pthread_mutex_destroy(&m->mutex);
+}
+
+void prof_mutex_lock(prof_mutex_t *m)
+{
+    unsigned long start = 0;
+
+    if (!profiling)
+    {
+        pthread_mutex_lock(&m->mutex);
+        return;
+    }
+
+    if (pthread_mutex_trylock(&m->mutex))
+    {
+        start = now_ns();
+        pthread_mutex_lock(&m->mutex);
+    }
+    m->acquired = lock_prof_acquired(m->prof, start);
+}
+
+void prof_mutex_unlock(prof_mutex_t *m)
+{
+    unsigned long hold;
+
+    if (!profiling || m->acquired == 0)
+    {
+        pthread_mutex_unlock(&m->mutex);
+        return;
+    }
+
+    /* recorded once the lock is released */
+    hold = now_ns() - m->acquired;
+    m->acquired = 0;
+    pthread_mutex_unlock(&m->mutex);
+    hist_record_atomic(&m->prof->hold, hold);
+}
+
+void prof_cond_wait(pthread_cond_t *cond, prof_mutex_t *m)
+{
+    if (profiling && m->acquired)
+    {
+        hist_record_atomic(&m->prof->hold, now_ns() - m->acquired);
+    }
+    pthread_cond_wait(cond, &m->mutex);
+    m->acquired = profiling ? now_ns() : 0;
+}
+
+int prof_cond_timedwait(pthread_cond_t *cond, prof_mutex_t *m, const struct timespec *ts)
+{
+    int res;
+
+    if (profiling && m->acquired)
+    {
+        hist_record_atomic(&m->prof->hold, now_ns() - m->acquired);
+    }
+    res = pthread_cond_timedwait(cond, &m->mutex, ts);
+    m->acquired = profiling ? now_ns() : 0;
+
+    return res;
+}
+
+void prof_rwlock_init(prof_rwlock_t *l, lock_prof_t *read_prof, lock_prof_t *write_prof)
+{
+    pthread_rwlock_init(&l->lock, NULL);
+    l->read_prof = read_prof;
+    l->write_prof = write_prof;
+    l->acquired = 0;
+}
+
+void prof_rwlock_destroy(prof_rwlock_t *l)
+{
+    pthread_rwlock_destroy(&l->lock);
+}
+
+void prof_rwlock_rdlock(prof_rwlock_t *l)
+{
+    unsigned long start = 0;
+
+    if (!profiling)
+    {
+        pthread_rwlock_rdlock(&l->lock);
+        return;
+    }
+
+    if (pthread_rwlock_tryrdlock(&l->lock))
+    {
+        start = now_ns();
+        pthread_rwlock_rdlock(&l->lock);
+    }
+    read_acquired = lock_prof_acquired(l->read_prof, start);
+}
+
+void prof_rwlock_rdunlock(prof_rwlock_t *l)
+{
+    pthread_rwlock_unlock(&l->lock);
+
+    if (profiling && read_acquired)
+    {
+        hist_record_atomic(&l->read_prof->hold, now_ns() - read_acquired);
+        read_acquired = 0;
+    }
+}
+
+void prof_rwlock_wrlock(prof_rwlock_t *l)
+{
+    unsigned long start = 0;
+
+    if (!profiling)
+    {
+        pthread_rwlock_wrlock(&l->lock);
+        return;
+    }
+
+    if (pthread_rwlock_trywrlock(&l->lock))
+    {
+        start = now_ns();
+        pthread_rwlock_wrlock(&l->lock);
+    }
+    l->acquired = lock_prof_acquired(l->write_prof, start);
+}
+
+void prof_rwlock_wrunlock(prof_rwlock_t *l)
+{
+    unsigned long hold;
+
+    if (!profiling || l->acquired == 0)
+    {
+        pthread_rwlock_unlock(&l->lock);
+        return;
+    }
+
+    hold = now_ns() - l->acquired;
+    l->acquired = 0;
+    pthread_rwlock_unlock(&l->lock);
+    hist_record_atomic(&l->write_prof->hold, hold);
+}
+
+static int compare_wait(const void *a, const void *b)
+{
+    unsigned long x = (*(lock_prof_t *const *)a)->wait.sum;
+    unsigned long y = (*(lock_prof_t *const *)b)->wait.sum;
+
+    return (x < y) - (x > y);
+}
+
+void lock_prof_display(FILE *stream)
+{
+    lock_prof_t *sorted[LOCK_PROF_MAX], *p;
+    histogram_t *wait, *hold;
+    int nb = 0;
+
+    fprintf(stream, "### lock contention (profiling %s)\n", profiling ? "on" : "off");
+    if (!profiling)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&profs_lock);
+    for (p = profs; p != NULL && nb < LOCK_PROF_MAX; p = p->next)
+    {
+        sorted[nb++] = p;
+    }
+    pthread_mutex_unlock(&profs_lock);
+    qsort(sorted, nb, sizeof(lock_prof_t *), compare_wait);
+
+    /* copies: the histograms are being written */
+    wait = malloc(sizeof(histogram_t));
+    hold = malloc(sizeof(histogram_t));
+
+    fprintf(stream, "    %-22s %10s %9s %10s %9s %9s %9s %9s %9s\n", "lock", "acquired", "contended",
+            "wait(ms)", "wait p50", "wait p99", "wait max", "hold p50", "hold p99");
+    for (int i = 0; i < nb; i++)
+    {
+        p = sorted[i];
+        unsigned long acquired = __atomic_load_n(&p->nb_acquired, __ATOMIC_RELAXED);
+        unsigned long contended = __atomic_load_n(&p->nb_contended, __ATOMIC_RELAXED);
+
+        hist_init(wait);
+        hist_merge(wait, &p->wait);
+        hist_init(hold);
+        hist_merge(hold, &p->hold);
+
+        fprintf(stream, "    %-22s %10lu %8.2f%% %10.3f %9.1f %9.1f %9.1f %9.1f %9.1f us\n", p->name,
+                acquired, acquired ? 100.0 * contended / acquired : 0.0,
+                wait->sum / 1e6,
+                hist_percentile(wait, 0.5) / 1000.0,
+                hist_percentile(wait, 0.99) / 1000.0,
+                wait->max / 1000.0,
+                hist_percentile(hold, 0.5) / 1000.0,
+                hist_percentile(hold, 0.99) / 1000.0);
+    }
+
+    free(wait);
+    free(hold);
+}
@@ -0,0 +1,77 @@
+#ifndef __BABBLE_LOCK_PROF_H__
+#define __BABBLE_LOCK_PROF_H__
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "babble_histogram.h"
+
+/**** Contention profiling of the locks of the server ****/
+
+/* the locks of the server are wrapped in prof_mutex_t/prof_rwlock_t.
+ * Each one reports to the profile of its kind (all the client write
+ * mutexes share one, for instance). Once enabled, a profile counts
+ * the acquisitions and the contended ones. Contended acquisitions
+ * have their wait time recorded in a histogram, and every acquisition
+ * has its hold time recorded. A lock is first tried, so an uncontended
+ * acquisition costs no clock read for the wait. When profiling is
+ * disabled, the wrappers only add a test of a global flag.
+ *
+ * The profiles register themselves on their first profiled
+ * acquisition, and are displayed by decreasing total wait time: the
+ * lock at the top is the one limiting the throughput. */
+
+typedef struct lock_prof{
+    const char *name;
+    int registered;
+    unsigned long nb_acquired;
+    unsigned long nb_contended;
+    histogram_t wait;       /* contended acquisitions only */
+    histogram_t hold;
+    struct lock_prof *next;
+} lock_prof_t;
+
+#define LOCK_PROF_INITIALIZER(name) {name}
+
+typedef struct prof_mutex{
+    pthread_mutex_t mutex;
+    lock_prof_t *prof;
+    unsigned long acquired;     /* by its current owner, in ns */
+} prof_mutex_t;
+
+#define PROF_MUTEX_INITIALIZER(prof) {PTHREAD_MUTEX_INITIALIZER, prof, 0}
+
+/* readers record the date of their acquisition themselves (a thread
+ * holds a single read lock at a time) */
+typedef struct prof_rwlock{
+    pthread_rwlock_t lock;
+    lock_prof_t *read_prof;
+    lock_prof_t *write_prof;
+    unsigned long acquired;     /* by the writer */
+} prof_rwlock_t;
+
+/* to be called before the locks are used */
+void lock_prof_enable(int enabled);
+
+void prof_mutex_init(prof_mutex_t *m, lock_prof_t *prof);
+void prof_mutex_destroy(prof_mutex_t *m);
+void prof_mutex_lock(prof_mutex_t *m);
+void prof_mutex_unlock(prof_mutex_t *m);
+
+/* the time spent waiting on the condition does not count as held */
+void prof_cond_wait(pthread_cond_t *cond, prof_mutex_t *m);
+int prof_cond_timedwait(pthread_cond_t *cond, prof_mutex_t *m, const struct timespec *ts);
+
+void prof_rwlock_init(prof_rwlock_t *l, lock_prof_t *read_prof, lock_prof_t *write_prof);
+void prof_rwlock_destroy(prof_rwlock_t *l);
+void prof_rwlock_rdlock(prof_rwlock_t *l);
+void prof_rwlock_rdunlock(prof_rwlock_t *l);
+void prof_rwlock_wrlock(prof_rwlock_t *l);
+void prof_rwlock_wrunlock(prof_rwlock_t *l);
+
+/* one line per profile: acquisitions, contention, wait and hold
+ * times */
+void lock_prof_display(FILE *stream);
+
+#endif
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "babble_log.h"
+
+int log_level = LOG_INFO;
+
+typedef struct log_record{
+    unsigned char level;
+    char text[LOG_MSG_SIZE];
+} log_record_t;
+
+/* single producer (its thread), single consumer (the log thread) */
+typedef struct log_ring{
+    log_record_t records[LOG_RING_SIZE];
+    unsigned long head;         /* nb of messages written */
+    unsigned long tail;         /* nb of messages drained */
+    int in_use;                 /* by a running thread */
+    struct log_ring *next;
+} log_ring_t;
+
+/* the rings of the threads that exited are reused by new threads
+ * once drained (rings_lock protects the list, that only grows at its
+ * front; drain_lock makes the drainers a single consumer) */
+static log_ring_t *rings;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_t log_thread;
+
+static __thread log_ring_t *local_ring;
+
+static unsigned long nb_written;
+static unsigned long nb_dropped;
+static unsigned long nb_suppressed;
+
+/* called when a thread exits */
+static void log_ring_release(void *arg)
+{
+    log_ring_t *ring = arg;
+
+    __atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static log_ring_t *log_ring_get(void)
+{
+    log_ring_t *ring;
+
+    pthread_mutex_lock(&rings_lock);
+    for (ring = rings; ring != NULL; ring = ring->next)
+    {
+        if (!__atomic_load_n(&ring->in_use, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head)
+        {
+            break;
+        }
+    }
+    if (ring == NULL)
+    {
+        if ((ring = calloc(1, sizeof(log_ring_t))) == NULL)
+        {
+            perror("log");
+            exit(EXIT_FAILURE);
+        }
+        ring->next = rings;
+        rings = ring;
+    }
+    ring->in_use = 1;
+    pthread_mutex_unlock(&rings_lock);
+
+    pthread_setspecific(ring_key, ring);
+    local_ring = ring;
+
+    return ring;
+}
+
+/* drain the rings, returns the nb of messages written */
+static int log_drain(void)
+{
+    unsigned long head, tail;
+    log_ring_t *first;
+    log_record_t *rec;
+    int nb = 0;
+
+    /* the rings are never freed nor unlinked: the list is walked
+     * without the lock, so that the threads registering a ring do not
+     * wait on the terminal */
+    pthread_mutex_lock(&rings_lock);
+    first = rings;
+    pthread_mutex_unlock(&rings_lock);
+
+    pthread_mutex_lock(&drain_lock);
+    for (log_ring_t *ring = first; ring != NULL; ring = ring->next)
+    {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (tail = ring->tail; tail != head; tail++)
+        {
+            rec = &ring->records[tail % LOG_RING_SIZE];
+            fputs(rec->text, rec->level <= LOG_WARN ? stderr : stdout);
+            nb++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    if (nb)
+    {
+        fflush(stdout);
+        __atomic_fetch_add(&nb_written, nb, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&drain_lock);
+
+    return nb;
+}
+
+void log_flush(void)
+{
+    log_drain();
+    fflush(stderr);
+}
+
+static void *log_thread_routine(void *arg)
+{
+    while (1)
+    {
+        usleep(log_drain() ? LOG_FLUSH_PERIOD : LOG_IDLE_PERIOD);
+    }
+
+    return NULL;
+}
+
+void log_init(int level)
+{
+    log_level = level;
+    pthread_key_create(&ring_key, log_ring_release);
+
+    /* the messages of a fatal error must not die with the process */
+    atexit(log_flush);
+
+    if (pthread_create(&log_thread, NULL, log_thread_routine, NULL) != 0)
+    {
+        fprintf(stderr, "Error -- unable to create the log thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void log_vwrite(log_level_t level, unsigned int suppressed, const char *fmt, va_list ap)
+{
+    log_ring_t *ring = local_ring;
+    log_record_t *rec;
+    int len;
+
+    if (ring == NULL)
+    {
+        ring = log_ring_get();
+    }
+    if (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_RING_SIZE)
+    {
+        __atomic_fetch_add(&nb_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    rec = &ring->records[ring->head % LOG_RING_SIZE];
+    rec->level = level;
+    len = vsnprintf(rec->text, LOG_MSG_SIZE - 1, fmt, ap);
+    if (len < 0)
+    {
+        return;
+    }
+    if (len > LOG_MSG_SIZE - 2)
+    {
+        len = LOG_MSG_SIZE - 2;
+    }
+    if (suppressed)
+    {
+        len += snprintf(rec->text + len, LOG_MSG_SIZE - 1 - len, " (%u similar messages suppressed)", suppressed);
+        if (len > LOG_MSG_SIZE - 2)
+        {
+            len = LOG_MSG_SIZE - 2;
+        }
+    }
+    rec->text[len] = '\n';
+    rec->text[len + 1] = '\0';
+
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void log_write(log_level_t level, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    log_vwrite(level, 0, fmt, ap);
+    va_end(ap);
+}
+
+void log_write_limited(log_limit_t *limit, log_level_t level, const char *fmt, ...)
+{
+    struct timespec ts;
+    unsigned long window;
+    unsigned int suppressed;
+    va_list ap;
+
+    /* a new second: the first thread to see it resets the count */
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    window = __atomic_load_n(&limit->window, __ATOMIC_RELAXED);
+    if (window != (unsigned long)ts.tv_sec &&
+        __atomic_compare_exchange_n(&limit->window, &window, ts.tv_sec, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&limit->nb, 0, __ATOMIC_RELAXED);
+    }
+
+    if (__atomic_add_fetch(&limit->nb, 1, __ATOMIC_RELAXED) > LOG_RATE_LIMIT)
+    {
+        __atomic_fetch_add(&limit->suppressed, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&nb_suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    suppressed = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+
+    va_start(ap, fmt);
+    log_vwrite(level, suppressed, fmt, ap);
+    va_end(ap);
+}
+
+void log_stats_display(FILE *stream)
+{
+    fprintf(stream, "### log: %lu messages written, %lu dropped (ring full), %lu suppressed (rate limit)\n",
+            __atomic_load_n(&nb_written, __ATOMIC_RELAXED),
+            __atomic_load_n(&nb_dropped, __ATOMIC_RELAXED),
+            __atomic_load_n(&nb_suppressed, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,89 @@
+#ifndef __BABBLE_LOG_H__
+#define __BABBLE_LOG_H__
+
+#include <stdio.h>
+
+/**** Asynchronous logging of the server ****/
+
+/* a thread formats its messages into a ring of its own, without
+ * locks, and a log thread drains the rings to stderr (errors and
+ * warnings) or stdout, a line per message -- the threads never wait
+ * on the stdio locks nor on the terminal. A message is dropped (and
+ * counted) if the ring of its thread is full. Messages above the
+ * log_level setting are not even formatted.
+ *
+ * Errors and warnings can be triggered by the clients: they are
+ * limited to LOG_RATE_LIMIT per second and per call site, the number
+ * of messages suppressed being reported with the next one. */
+
+typedef enum{
+    LOG_ERROR = 0,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG,
+    NB_LOG_LEVELS
+} log_level_t;
+
+/* messages per thread ring, and max size of a message */
+#define LOG_RING_SIZE 128
+#define LOG_MSG_SIZE 128
+
+/* errors and warnings per second and call site */
+#define LOG_RATE_LIMIT 10
+
+/* period of the log thread, in micro-seconds, while there are
+ * messages and when idle */
+#define LOG_FLUSH_PERIOD 1000
+#define LOG_IDLE_PERIOD 10000
+
+typedef struct log_limit{
+    unsigned long window;       /* second of the messages counted */
+    unsigned int nb;
+    unsigned int suppressed;
+} log_limit_t;
+
+extern int log_level;
+
+/* start the log thread, messages above level are ignored -- the
+ * rings are also flushed at exit() */
+void log_init(int level);
+
+/* write the messages queued so far, on the calling thread */
+void log_flush(void);
+
+/* a message, without its final new line (printf-like) */
+void log_write(log_level_t level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* same, unless the call site exceeded its rate */
+void log_write_limited(log_limit_t *limit, log_level_t level, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#define log_msg(level, ...)                  \
+    do                                       \
+    {                                        \
+        if ((level) <= log_level)            \
+        {                                    \
+            log_write(level, __VA_ARGS__);   \
+        }                                    \
+    } while (0)
+
+#define log_limited(level, ...)                               \
+    do                                                        \
+    {                                                         \
+        static log_limit_t _log_limit;                        \
+        if ((level) <= log_level)                             \
+        {                                                     \
+            log_write_limited(&_log_limit, level, __VA_ARGS__); \
+        }                                                     \
+    } while (0)
+
+#define log_error(...) log_limited(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) log_limited(LOG_WARN, __VA_ARGS__)
+#define log_info(...) log_msg(LOG_INFO, __VA_ARGS__)
+#define log_debug(...) log_msg(LOG_DEBUG, __VA_ARGS__)
+
+/* display the nb of messages written and dropped */
+void log_stats_display(FILE *stream);
+
+#endif
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <pthread.h>
+
+#include "babble_memory.h"
+
+static const char *subsystem_names[NB_MEM_SUBSYSTEMS] = {
+    "registry", "follow graph", "timelines", "answers", "commands", "io buffers"};
+
+typedef struct mem_counters{
+    long bytes[NB_MEM_SUBSYSTEMS];
+    long objects[NB_MEM_SUBSYSTEMS];
+    int in_use;             /* by a running thread */
+    struct mem_counters *next;
+} mem_counters_t;
+
+/* the counters of all threads (never freed) and the peaks of their
+ * sums, protected by counters_lock */
+static mem_counters_t *counters;
+static long peak_bytes[NB_MEM_SUBSYSTEMS];
+static long peak_objects[NB_MEM_SUBSYSTEMS];
+static long peak_total;
+static pthread_mutex_t counters_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t counters_key;
+static pthread_once_t counters_once = PTHREAD_ONCE_INIT;
+
+static __thread mem_counters_t *local_counters;
+
+static int report_period;
+static FILE *report_stream;
+
+/* called when a thread exits: its counters go to the next thread */
+static void counters_release(void *arg)
+{
+    mem_counters_t *c = arg;
+
+    pthread_mutex_lock(&counters_lock);
+    c->in_use = 0;
+    pthread_mutex_unlock(&counters_lock);
+}
+
+static void counters_key_create(void)
+{
+    pthread_key_create(&counters_key, counters_release);
+}
+
+static mem_counters_t *get_counters(void)
+{
+    mem_counters_t *c = local_counters;
+
+    if (c != NULL)
+    {
+        return c;
+    }
+
+    pthread_once(&counters_once, counters_key_create);
+
+    pthread_mutex_lock(&counters_lock);
+    for (c = counters; c != NULL && c->in_use; c = c->next)
+        ;
+    if (c == NULL)
+    {
+        if ((c = calloc(1, sizeof(mem_counters_t))) == NULL)
+        {
+            perror("memory counters");
+            abort();
+        }
+        c->next = counters;
+        counters = c;
+    }
+    c->in_use = 1;
+    pthread_mutex_unlock(&counters_lock);
+
+    pthread_setspecific(counters_key, c);
+    local_counters = c;
+
+    return c;
+}
+
+void mem_account(mem_subsystem_t sub, long bytes, long objects)
+{
+    mem_counters_t *c = get_counters();
+
+    c->bytes[sub] += bytes;
+    c->objects[sub] += objects;
+}
+
+void *mem_alloc(mem_subsystem_t sub, size_t size)
+{
+    void *ptr = malloc(size);
+
+    if (ptr != NULL)
+    {
+        mem_account(sub, malloc_usable_size(ptr), 1);
+    }
+
+    return ptr;
+}
+
+void *mem_calloc(mem_subsystem_t sub, size_t nb, size_t size)
+{
+    void *ptr = calloc(nb, size);
+
+    if (ptr != NULL)
+    {
+        mem_account(sub, malloc_usable_size(ptr), 1);
+    }
+
+    return ptr;
+}
+
+void *mem_realloc(mem_subsystem_t sub, void *ptr, size_t size)
+{
+    size_t old_size = ptr != NULL ? malloc_usable_size(ptr) : 0;
+    void *new_ptr = realloc(ptr, size);
+
+    if (new_ptr != NULL)
+    {
+        mem_account(sub, (long)malloc_usable_size(new_ptr) - (long)old_size, ptr == NULL);
+    }
+
+    return new_ptr;
+}
+
+void *mem_memalign(mem_subsystem_t sub, size_t alignment, size_t size)
+{
+    void *ptr;
+
+    if (posix_memalign(&ptr, alignment, size))
+    {
+        return NULL;
+    }
+    mem_account(sub, malloc_usable_size(ptr), 1);
+
+    return ptr;
+}
+
+void mem_free(mem_subsystem_t sub, void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    mem_account(sub, -(long)malloc_usable_size(ptr), -1);
+    free(ptr);
+}
+
+void mem_adopt(mem_subsystem_t sub, void *ptr)
+{
+    if (ptr != NULL)
+    {
+        mem_account(sub, malloc_usable_size(ptr), 1);
+    }
+}
+
+/* sum the counters of all threads, and update the peaks */
+static void mem_sample(long *bytes, long *objects)
+{
+    long total = 0;
+
+    memset(bytes, 0, NB_MEM_SUBSYSTEMS * sizeof(long));
+    memset(objects, 0, NB_MEM_SUBSYSTEMS * sizeof(long));
+
+    pthread_mutex_lock(&counters_lock);
+    for (mem_counters_t *c = counters; c != NULL; c = c->next)
+    {
+        for (int i = 0; i < NB_MEM_SUBSYSTEMS; i++)
+        {
+            bytes[i] += c->bytes[i];
+            objects[i] += c->objects[i];
+        }
+    }
+    for (int i = 0; i < NB_MEM_SUBSYSTEMS; i++)
+    {
+        total += bytes[i];
+        if (bytes[i] > peak_bytes[i])
+        {
+            peak_bytes[i] = bytes[i];
+        }
+        if (objects[i] > peak_objects[i])
+        {
+            peak_objects[i] = objects[i];
+        }
+    }
+    if (total > peak_total)
+    {
+        peak_total = total;
+    }
+    pthread_mutex_unlock(&counters_lock);
+}
+
+static void *report_thread_routine(void *arg)
+{
+    long bytes[NB_MEM_SUBSYSTEMS], objects[NB_MEM_SUBSYSTEMS];
+    unsigned long nb_samples = 0;
+    unsigned long samples_per_report = report_period * (1000000UL / MEM_SAMPLE_PERIOD);
+
+    while (1)
+    {
+        usleep(MEM_SAMPLE_PERIOD);
+        mem_sample(bytes, objects);
+
+        if (samples_per_report && ++nb_samples % samples_per_report == 0)
+        {
+            mem_stats_display(report_stream);
+            fflush(report_stream);
+        }
+    }
+
+    return NULL;
+}
+
+void mem_report_start(int period, FILE *stream)
+{
+    pthread_t thread;
+
+    report_period = period;
+    report_stream = stream;
+    if (pthread_create(&thread, NULL, report_thread_routine, NULL))
+    {
+        perror("memory report thread");
+        return;
+    }
+    pthread_detach(thread);
+}
+
+static void format_size(char *buf, size_t size, long bytes)
+{
+    if (bytes < 1024L)
+    {
+        snprintf(buf, size, "%ld B", bytes);
+    }
+    else if (bytes < 1024L * 1024L)
+    {
+        snprintf(buf, size, "%.1f KB", bytes / 1024.0);
+    }
+    else
+    {
+        snprintf(buf, size, "%.1f MB", bytes / (1024.0 * 1024.0));
+    }
+}
+
+void mem_stats_display(FILE *stream)
+{
+    long bytes[NB_MEM_SUBSYSTEMS], objects[NB_MEM_SUBSYSTEMS];
+    long peaks[NB_MEM_SUBSYSTEMS], peak_objs[NB_MEM_SUBSYSTEMS];
+    long total = 0, total_peak;
+    char current_str[32], peak_str[32];
+
+    mem_sample(bytes, objects);
+
+    pthread_mutex_lock(&counters_lock);
+    memcpy(peaks, peak_bytes, sizeof(peaks));
+    memcpy(peak_objs, peak_objects, sizeof(peak_objs));
+    total_peak = peak_total;
+    pthread_mutex_unlock(&counters_lock);
+
+    fprintf(stream, "### memory: current / peak\n");
+    for (int i = 0; i < NB_MEM_SUBSYSTEMS; i++)
+    {
+        format_size(current_str, sizeof(current_str), bytes[i]);
+        format_size(peak_str, sizeof(peak_str), peaks[i]);
+        fprintf(stream, "    %-14s %12s %9ld objects / %12s %9ld objects\n",
+                subsystem_names[i], current_str, objects[i], peak_str, peak_objs[i]);
+        total += bytes[i];
+    }
+
+    /* the subsystems do not peak at the same time: the peak of the
+     * total is not the sum of theirs */
+    format_size(current_str, sizeof(current_str), total);
+    format_size(peak_str, sizeof(peak_str), total_peak);
+    fprintf(stream, "    %-14s %12s %17s / %12s\n", "total", current_str, "", peak_str);
+}
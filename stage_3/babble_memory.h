@@ -0,0 +1,59 @@
+#ifndef __BABBLE_MEMORY_H__
+#define __BABBLE_MEMORY_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**** Memory accounting per subsystem ****/
+
+/* the memory of the server is accounted to the subsystem owning it,
+ * in bytes and in live objects. Heap blocks are accounted by their
+ * usable size (malloc_usable_size()), so the padding of the allocator
+ * is included. The pools never give their slabs back: the bytes of a
+ * pooled object type are its slabs, its objects are the ones
+ * allocated from them.
+ *
+ * Each thread updates counters of its own, without synchronization
+ * (a block freed by another thread than the one that allocated it
+ * makes their counters go negative, their sum is right). The
+ * counters of the threads that exited are reused by the new ones. The
+ * sums are sampled every MEM_SAMPLE_PERIOD by a thread, that keeps
+ * their peaks: a peak lasting less than the period may be missed. */
+
+typedef enum{
+    MEM_REGISTRY = 0,   /* registration table and client bundles */
+    MEM_FOLLOW_GRAPH,   /* follower arrays */
+    MEM_TIMELINES,
+    MEM_ANSWERS,        /* answers, their msgs and the names they use */
+    MEM_COMMANDS,       /* commands, buffer slots, mailboxes and
+                         * per-client queue counters */
+    MEM_IO_BUFFERS,     /* received msgs */
+    NB_MEM_SUBSYSTEMS
+} mem_subsystem_t;
+
+/* in micro-seconds */
+#define MEM_SAMPLE_PERIOD 100000
+
+/* malloc() and friends, accounting the block to sub (NULL if out of
+ * memory, as the originals) */
+void *mem_alloc(mem_subsystem_t sub, size_t size);
+void *mem_calloc(mem_subsystem_t sub, size_t nb, size_t size);
+void *mem_realloc(mem_subsystem_t sub, void *ptr, size_t size);
+void *mem_memalign(mem_subsystem_t sub, size_t alignment, size_t size);
+void mem_free(mem_subsystem_t sub, void *ptr);
+
+/* account a block allocated by malloc() elsewhere, to be freed with
+ * mem_free() */
+void mem_adopt(mem_subsystem_t sub, void *ptr);
+
+/* account memory managed by the caller (the pools) */
+void mem_account(mem_subsystem_t sub, long bytes, long objects);
+
+/* start the sampling thread, that also displays the report on stream
+ * every report_period seconds (0: never) */
+void mem_report_start(int report_period, FILE *stream);
+
+/* current and peak bytes and objects of each subsystem */
+void mem_stats_display(FILE *stream);
+
+#endif
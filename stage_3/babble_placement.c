@@ -0,0 +1,407 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "babble_placement.h"
+
+static const char *role_names[PLACE_NB] = {"acceptor", "executor", "connection"};
+
+/* topology: online cpus and node of each cpu */
+static int cpus[PLACEMENT_MAX_CPUS];
+static int nb_cpus;
+static int cpu_node[PLACEMENT_MAX_CPUS];
+static int nb_nodes;
+static int topology_read_done;
+
+/* cores of each role: executor i gets role_cpus[EXECUTOR][i % n], the
+ * other roles get the whole list */
+static int role_cpus[PLACE_NB][PLACEMENT_MAX_CPUS];
+static int role_nb[PLACE_NB];
+
+/* automatic placement of the communication threads: cores of the node
+ * of each executor */
+static cpu_set_t *conn_masks;
+static int nb_conn_masks;
+
+/* set once some role is placed */
+static int placement_active;
+
+/* parse a list such as "0-3,8,10-11", returns the nb of cpus or -1 */
+static int parse_cpulist(const char *str, int *list, int max)
+{
+    int n = 0;
+    char *end;
+
+    while (*str != '\0' && *str != '\n')
+    {
+        long first = strtol(str, &end, 10), last;
+        if (end == str || first < 0)
+        {
+            return -1;
+        }
+        last = first;
+        str = end;
+        if (*str == '-')
+        {
+            last = strtol(str + 1, &end, 10);
+            if (end == str + 1 || last < first)
+            {
+                return -1;
+            }
+            str = end;
+        }
+        for (long c = first; c <= last; c++)
+        {
+            if (n == max || c >= PLACEMENT_MAX_CPUS)
+            {
+                return -1;
+            }
+            list[n++] = c;
+        }
+        if (*str == ',')
+        {
+            str++;
+        }
+        else if (*str != '\0' && *str != '\n')
+        {
+            return -1;
+        }
+    }
+    return n;
+}
+
+/* read a cpu list from a sysfs file, -1 if it cannot be read */
+static int read_cpulist(const char *path, int *list, int max)
+{
+    char line[4096];
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL)
+    {
+        return -1;
+    }
+    if (fgets(line, sizeof(line), f) == NULL)
+    {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    return parse_cpulist(line, list, max);
+}
+
+static void topology_read(void)
+{
+    char path[320];
+    int node_cpus[PLACEMENT_MAX_CPUS];
+    struct dirent *entry;
+    DIR *dir;
+
+    if (topology_read_done)
+    {
+        return;
+    }
+    topology_read_done = 1;
+
+    if ((nb_cpus = read_cpulist("/sys/devices/system/cpu/online", cpus, PLACEMENT_MAX_CPUS)) <= 0)
+    {
+        /* no sysfs: cpus 0 to n-1, as many as cpus[] holds */
+        nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nb_cpus > PLACEMENT_MAX_CPUS)
+        {
+            nb_cpus = PLACEMENT_MAX_CPUS;
+        }
+        if (nb_cpus < 1)
+        {
+            nb_cpus = 1;
+        }
+        for (int i = 0; i < nb_cpus; i++)
+        {
+            cpus[i] = i;
+        }
+    }
+
+    memset(cpu_node, 0, sizeof(cpu_node));
+    nb_nodes = 1;
+
+    if ((dir = opendir("/sys/devices/system/node")) == NULL)
+    {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        int node, n;
+
+        if (sscanf(entry->d_name, "node%d", &node) != 1)
+        {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", entry->d_name);
+        if ((n = read_cpulist(path, node_cpus, PLACEMENT_MAX_CPUS)) <= 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            cpu_node[node_cpus[i]] = node;
+        }
+        if (node + 1 > nb_nodes)
+        {
+            nb_nodes = node + 1;
+        }
+    }
+    closedir(dir);
+}
+
+int placement_set_cpus(place_role_t role, const char *cpulist)
+{
+    int n = parse_cpulist(cpulist, role_cpus[role], PLACEMENT_MAX_CPUS);
+
+    topology_read();
+    if (n <= 0)
+    {
+        return -1;
+    }
+    role_nb[role] = n;
+    placement_active = 1;
+    return 0;
+}
+
+/* online cpus of a node */
+static int node_cpus(int node, int *list)
+{
+    int n = 0;
+
+    for (int i = 0; i < nb_cpus; i++)
+    {
+        if (cpu_node[cpus[i]] == node)
+        {
+            list[n++] = cpus[i];
+        }
+    }
+    return n;
+}
+
+static int cpu_taken(int cpu, int nb_executors)
+{
+    if (role_nb[PLACE_ACCEPTOR] && role_cpus[PLACE_ACCEPTOR][0] == cpu)
+    {
+        return 1;
+    }
+    for (int i = 0; i < nb_executors && i < role_nb[PLACE_EXECUTOR]; i++)
+    {
+        if (role_cpus[PLACE_EXECUTOR][i] == cpu)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void placement_auto(int nb_executors)
+{
+    int list[PLACEMENT_MAX_CPUS], cand[PLACEMENT_MAX_CPUS];
+    int n, nb_cand;
+
+    topology_read();
+    placement_active = 1;
+
+    if (role_nb[PLACE_ACCEPTOR] == 0)
+    {
+        role_cpus[PLACE_ACCEPTOR][0] = cpus[0];
+        role_nb[PLACE_ACCEPTOR] = 1;
+    }
+
+    /* executors: round robin over the nodes, avoiding the core of the
+     * acceptor when possible */
+    if (role_nb[PLACE_EXECUTOR] == 0)
+    {
+        for (int i = 0; i < nb_executors && i < PLACEMENT_MAX_CPUS; i++)
+        {
+            n = node_cpus(i % nb_nodes, list);
+            if (n == 0)
+            {
+                n = node_cpus(0, list);
+            }
+
+            nb_cand = 0;
+            for (int j = 0; j < n; j++)
+            {
+                if (list[j] != role_cpus[PLACE_ACCEPTOR][0])
+                {
+                    cand[nb_cand++] = list[j];
+                }
+            }
+            if (nb_cand == 0)
+            {
+                memcpy(cand, list, n * sizeof(int));
+                nb_cand = n;
+            }
+            role_cpus[PLACE_EXECUTOR][i] = cand[(i / nb_nodes) % nb_cand];
+        }
+        role_nb[PLACE_EXECUTOR] = nb_executors;
+    }
+
+    /* communication threads: the cores of the node of their home
+     * executor that are not used by the executors or the acceptor */
+    if (role_nb[PLACE_CONNECTION] == 0)
+    {
+        conn_masks = calloc(nb_executors, sizeof(cpu_set_t));
+        nb_conn_masks = nb_executors;
+
+        for (int i = 0; i < nb_executors; i++)
+        {
+            int exec_cpu = role_cpus[PLACE_EXECUTOR][i % role_nb[PLACE_EXECUTOR]];
+            n = node_cpus(cpu_node[exec_cpu], list);
+
+            CPU_ZERO(&conn_masks[i]);
+            for (int j = 0; j < n; j++)
+            {
+                if (!cpu_taken(list[j], nb_executors))
+                {
+                    CPU_SET(list[j], &conn_masks[i]);
+                }
+            }
+            if (CPU_COUNT(&conn_masks[i]) == 0)
+            {
+                for (int j = 0; j < n; j++)
+                {
+                    CPU_SET(list[j], &conn_masks[i]);
+                }
+            }
+        }
+    }
+}
+
+/* cores a thread of the role may run on, empty if it is not placed */
+static void placement_mask(place_role_t role, int index, cpu_set_t *mask)
+{
+    CPU_ZERO(mask);
+
+    if (role == PLACE_EXECUTOR)
+    {
+        if (role_nb[role])
+        {
+            CPU_SET(role_cpus[role][index % role_nb[role]], mask);
+        }
+        return;
+    }
+
+    if (role == PLACE_CONNECTION && role_nb[role] == 0)
+    {
+        if (nb_conn_masks)
+        {
+            *mask = conn_masks[index % nb_conn_masks];
+        }
+        return;
+    }
+
+    for (int i = 0; i < role_nb[role]; i++)
+    {
+        CPU_SET(role_cpus[role][i], mask);
+    }
+}
+
+void placement_pin(place_role_t role, int index)
+{
+    cpu_set_t mask;
+    int err;
+
+    if (!placement_active)
+    {
+        return;
+    }
+
+    /* threads of a role that is not placed may run anywhere, whatever
+     * the placement of the thread that created them */
+    placement_mask(role, index, &mask);
+    if (CPU_COUNT(&mask) == 0)
+    {
+        for (int i = 0; i < nb_cpus; i++)
+        {
+            CPU_SET(cpus[i], &mask);
+        }
+    }
+
+    if ((err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask)) != 0)
+    {
+        fprintf(stderr, "Warning -- could not pin %s %d: %s\n", role_names[role], index, strerror(err));
+    }
+}
+
+/* print the cpus of a mask as a list */
+static void display_mask(FILE *stream, cpu_set_t *mask)
+{
+    int first = 1;
+
+    for (int c = 0; c < PLACEMENT_MAX_CPUS; c++)
+    {
+        if (!CPU_ISSET(c, mask))
+        {
+            continue;
+        }
+        int last = c;
+        while (last + 1 < PLACEMENT_MAX_CPUS && CPU_ISSET(last + 1, mask))
+        {
+            last++;
+        }
+        fprintf(stream, first ? "%d" : ",%d", c);
+        if (last > c)
+        {
+            fprintf(stream, "-%d", last);
+        }
+        first = 0;
+        c = last;
+    }
+    if (first)
+    {
+        fprintf(stream, "any");
+    }
+}
+
+void placement_display(FILE *stream, int nb_executors)
+{
+    cpu_set_t mask;
+    int list[PLACEMENT_MAX_CPUS];
+
+    topology_read();
+
+    fprintf(stream, "### placement: %d cpus, %d nodes\n", nb_cpus, nb_nodes);
+    for (int node = 0; node < nb_nodes; node++)
+    {
+        int n = node_cpus(node, list);
+        if (n == 0)
+        {
+            continue;
+        }
+        CPU_ZERO(&mask);
+        for (int i = 0; i < n; i++)
+        {
+            CPU_SET(list[i], &mask);
+        }
+        fprintf(stream, "    node %-3d cpus ", node);
+        display_mask(stream, &mask);
+        fprintf(stream, "\n");
+    }
+
+    placement_mask(PLACE_ACCEPTOR, 0, &mask);
+    fprintf(stream, "    acceptor        cpus ");
+    display_mask(stream, &mask);
+    fprintf(stream, "\n");
+
+    for (int i = 0; i < nb_executors; i++)
+    {
+        placement_mask(PLACE_EXECUTOR, i, &mask);
+        fprintf(stream, "    executor %-3d    cpus ", i);
+        display_mask(stream, &mask);
+        fprintf(stream, ", connections on cpus ");
+        placement_mask(PLACE_CONNECTION, i, &mask);
+        display_mask(stream, &mask);
+        fprintf(stream, "\n");
+    }
+}
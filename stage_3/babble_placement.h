@@ -0,0 +1,48 @@
+#ifndef __BABBLE_PLACEMENT_H__
+#define __BABBLE_PLACEMENT_H__
+
+#include <stdio.h>
+
+/**** Placement of the server threads on cores and NUMA nodes ****/
+
+/* threads pin themselves when they start, through placement_pin():
+ *  - the acceptor (main thread)
+ *  - executor i (or worker i of the work-stealing pool)
+ *  - the communication thread of a client, placed next to the
+ *    executor running its commands (home executor)
+ * The cores of each role are either given as lists (-A, -E, -C
+ * options of the server) or computed from the topology read in /sys
+ * (-a): executors are spread over the NUMA nodes, and the
+ * communication threads of a client get the other cores of the node
+ * of its home executor. Threads of a role without cores are left
+ * free.
+ *
+ * Memory is placed by first touch: the buffers of an executor are
+ * allocated and initialized by the executor itself once pinned, and
+ * the pools allocate their slabs from the thread using them. */
+
+#define PLACEMENT_MAX_CPUS 1024
+
+typedef enum{
+    PLACE_ACCEPTOR = 0,
+    PLACE_EXECUTOR,
+    PLACE_CONNECTION,
+    PLACE_NB
+} place_role_t;
+
+/* set the cores of a role from a list such as "0-3,8,10-11", returns
+ * -1 if the list is not valid */
+int placement_set_cpus(place_role_t role, const char *cpulist);
+
+/* compute the placement of nb_executors executors from the topology,
+ * for the roles that have no explicit list */
+void placement_auto(int nb_executors);
+
+/* pin the calling thread -- index is the executor number, or the
+ * home executor of the client for PLACE_CONNECTION */
+void placement_pin(place_role_t role, int index);
+
+/* display the topology and the placement of each role */
+void placement_display(FILE *stream, int nb_executors);
+
+#endif
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "babble_pool.h"
+#include "babble_types.h"
+#include "babble_server_answer.h"
+#include "babble_delay.h"
+#include "babble_memory.h"
+
+/* a free object is reused to store the free list link */
+typedef struct pool_obj{
+    struct pool_obj *next;
+} pool_obj_t;
+
+/* per-thread allocation counters, chained in a global list so that
+ * they can be aggregated by pool_stats_display() */
+typedef struct pool_thread_stats{
+    unsigned long allocs[POOL_NB];   /* objects requested */
+    unsigned long slabs[POOL_NB];    /* slabs malloc'ed */
+    unsigned long heap_allocs;       /* remaining mallocs on the hot path */
+    unsigned long commands;          /* commands processed */
+    struct pool_thread_stats *next;
+} pool_thread_stats_t;
+
+static const char *pool_names[POOL_NB] = {"command", "answer", "name", "delayed"};
+
+static const size_t pool_obj_size[POOL_NB] = {
+    sizeof(command_t),
+    sizeof(answer_t),
+    BABBLE_ID_SIZE,
+    sizeof(delayed_command_t)};
+
+/* the names are used to format the answers */
+static const mem_subsystem_t pool_subsystem[POOL_NB] = {
+    MEM_COMMANDS,
+    MEM_ANSWERS,
+    MEM_ANSWERS,
+    MEM_COMMANDS};
+
+/* per-thread caches */
+static __thread pool_obj_t *cache[POOL_NB];
+static __thread unsigned int cache_count[POOL_NB];
+static __thread pool_thread_stats_t *my_stats;
+
+/* shared list receiving the surplus of threads that free more than
+ * they allocate */
+static pool_obj_t *shared_free[POOL_NB];
+static lock_prof_t shared_prof = LOCK_PROF_INITIALIZER("pool shared list");
+static prof_mutex_t shared_lock = PROF_MUTEX_INITIALIZER(&shared_prof);
+
+static pool_thread_stats_t *all_stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pool_thread_stats_t *get_stats(void)
+{
+    if (my_stats == NULL)
+    {
+        my_stats = calloc(1, sizeof(pool_thread_stats_t));
+        if (my_stats == NULL)
+        {
+            perror("pool stats");
+            abort();
+        }
+
+        pthread_mutex_lock(&stats_lock);
+        my_stats->next = all_stats;
+        all_stats = my_stats;
+        pthread_mutex_unlock(&stats_lock);
+    }
+    return my_stats;
+}
+
+/* fill the cache of the calling thread, first from the shared list,
+ * then with a new slab */
+static void pool_refill(pool_id_t id)
+{
+    prof_mutex_lock(&shared_lock);
+    if (shared_free[id] != NULL)
+    {
+        unsigned int n = 0;
+        pool_obj_t *last = shared_free[id];
+
+        while (last->next != NULL && n < POOL_SLAB_OBJECTS - 1)
+        {
+            last = last->next;
+            n++;
+        }
+        cache[id] = shared_free[id];
+        shared_free[id] = last->next;
+        last->next = NULL;
+        cache_count[id] = n + 1;
+        prof_mutex_unlock(&shared_lock);
+        return;
+    }
+    prof_mutex_unlock(&shared_lock);
+
+    size_t size = pool_obj_size[id];
+    if (size < sizeof(pool_obj_t))
+    {
+        size = sizeof(pool_obj_t);
+    }
+    /* keep objects aligned on 8 bytes */
+    size = (size + 7) & ~((size_t)7);
+
+    char *slab = malloc(size * POOL_SLAB_OBJECTS);
+    if (slab == NULL)
+    {
+        perror("pool slab");
+        abort();
+    }
+    get_stats()->slabs[id]++;
+    mem_account(pool_subsystem[id], size * POOL_SLAB_OBJECTS, 0);
+
+    for (int i = 0; i < POOL_SLAB_OBJECTS; i++)
+    {
+        pool_obj_t *obj = (pool_obj_t *)(slab + i * size);
+        obj->next = cache[id];
+        cache[id] = obj;
+    }
+    cache_count[id] += POOL_SLAB_OBJECTS;
+}
+
+void *pool_alloc(pool_id_t id)
+{
+    if (cache[id] == NULL)
+    {
+        pool_refill(id);
+    }
+
+    pool_obj_t *obj = cache[id];
+    cache[id] = obj->next;
+    cache_count[id]--;
+
+    get_stats()->allocs[id]++;
+    mem_account(pool_subsystem[id], 0, 1);
+
+    return obj;
+}
+
+void pool_free(pool_id_t id, void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    mem_account(pool_subsystem[id], 0, -1);
+
+    pool_obj_t *obj = ptr;
+    obj->next = cache[id];
+    cache[id] = obj;
+    cache_count[id]++;
+
+    /* give half of the cache back to the other threads */
+    if (cache_count[id] > POOL_CACHE_MAX)
+    {
+        pool_obj_t *first = cache[id], *last = cache[id];
+
+        for (unsigned int i = 1; i < POOL_CACHE_MAX / 2; i++)
+        {
+            last = last->next;
+        }
+        cache[id] = last->next;
+        cache_count[id] -= POOL_CACHE_MAX / 2;
+
+        prof_mutex_lock(&shared_lock);
+        last->next = shared_free[id];
+        shared_free[id] = first;
+        prof_mutex_unlock(&shared_lock);
+    }
+}
+
+void pool_count_command(void)
+{
+    get_stats()->commands++;
+}
+
+void pool_count_heap_alloc(void)
+{
+    get_stats()->heap_allocs++;
+}
+
+void pool_stats_display(FILE *stream)
+{
+    unsigned long allocs[POOL_NB] = {0}, slabs[POOL_NB] = {0};
+    unsigned long heap_allocs = 0, commands = 0;
+    unsigned long total_allocs = 0, total_slabs = 0;
+
+    pthread_mutex_lock(&stats_lock);
+    for (pool_thread_stats_t *s = all_stats; s != NULL; s = s->next)
+    {
+        for (int i = 0; i < POOL_NB; i++)
+        {
+            allocs[i] += s->allocs[i];
+            slabs[i] += s->slabs[i];
+        }
+        heap_allocs += s->heap_allocs;
+        commands += s->commands;
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    fprintf(stream, "### pool stats: %lu commands\n", commands);
+    for (int i = 0; i < POOL_NB; i++)
+    {
+        fprintf(stream, "    %-12s %10lu objects %8lu slabs\n", pool_names[i], allocs[i], slabs[i]);
+        total_allocs += allocs[i];
+        total_slabs += slabs[i];
+    }
+
+    if (commands)
+    {
+        /* every pooled object used to be a malloc */
+        fprintf(stream, "    allocations per command: %.2f without pools, %.2f with pools\n",
+                (double)(total_allocs + heap_allocs) / commands,
+                (double)(total_slabs + heap_allocs) / commands);
+    }
+}
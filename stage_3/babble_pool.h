@@ -0,0 +1,45 @@
+#ifndef __BABBLE_POOL_H__
+#define __BABBLE_POOL_H__
+
+#include <stdio.h>
+
+/**** Per-thread slab allocator for the fixed-size server objects ****/
+
+/* objects are carved out of slabs of POOL_SLAB_OBJECTS entries and
+ * recycled through a per-thread free list, so that the hot path
+ * (commands, answers) does not go through malloc once
+ * the server is warmed up. Objects are never given back to the
+ * system: a thread that frees more objects than it allocates pushes
+ * the surplus to a shared list where other threads pick them up. */
+
+#define POOL_SLAB_OBJECTS 64
+
+/* max number of free objects kept in a per-thread cache */
+#define POOL_CACHE_MAX 1024
+
+typedef enum{
+    POOL_COMMAND = 0,  /* command_t */
+    POOL_ANSWER,       /* answer_t */
+    POOL_NAME,         /* client names (BABBLE_ID_SIZE) */
+    POOL_DELAYED,      /* delayed_command_t */
+    POOL_NB
+} pool_id_t;
+
+/* get an object from the pool (never returns NULL, aborts on OOM) */
+void *pool_alloc(pool_id_t id);
+
+/* give back an object allocated with pool_alloc(id) */
+void pool_free(pool_id_t id, void *obj);
+
+/* count one processed command (used to compute allocations per
+ * command in the stats) */
+void pool_count_command(void);
+
+/* count an allocation that still goes through malloc on the hot
+ * path */
+void pool_count_heap_alloc(void);
+
+/* display allocation counters aggregated over all threads */
+void pool_stats_display(FILE *stream);
+
+#endif
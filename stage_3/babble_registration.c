@@ -1,19 +1,25 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 
 #include "babble_registration.h"
+#include "babble_settings.h"
+#include "babble_lock_prof.h"
+#include "babble_memory.h"
 
-client_bundle_t *registration_table[MAX_CLIENT];
+client_bundle_t **registration_table;
 int nb_registered_clients;
-pthread_rwlock_t registration_table_lock;
+prof_rwlock_t registration_table_lock;
+static lock_prof_t read_prof = LOCK_PROF_INITIALIZER("registration (read)");
+static lock_prof_t write_prof = LOCK_PROF_INITIALIZER("registration (write)");
 
 void registration_init(void)
 {
     nb_registered_clients = 0;
 
-    memset(registration_table, 0, MAX_CLIENT * sizeof(client_bundle_t *));
-    pthread_rwlock_init(&registration_table_lock, NULL);
+    registration_table = mem_calloc(MEM_REGISTRY, settings.max_clients, sizeof(client_bundle_t *));
+    prof_rwlock_init(&registration_table_lock, &read_prof, &write_prof);
 }
 
 client_bundle_t *registration_lookup(unsigned long key)
@@ -25,7 +31,7 @@ client_bundle_t *registration_lookup(unsigned long key)
     }
 
     // locking the reader lock
-    pthread_rwlock_rdlock(&registration_table_lock);
+    prof_rwlock_rdlock(&registration_table_lock);
     int i = 0;
     client_bundle_t *c = NULL;
 
@@ -37,7 +43,7 @@ client_bundle_t *registration_lookup(unsigned long key)
             break;
         }
     }
-    pthread_rwlock_unlock(&registration_table_lock);
+    prof_rwlock_rdunlock(&registration_table_lock);
     return c;
 }
 
@@ -50,12 +56,12 @@ int registration_insert(client_bundle_t *cl)
     }
 
     // locking the writer lock
-    pthread_rwlock_wrlock(&registration_table_lock);
+    prof_rwlock_wrlock(&registration_table_lock);
 
-    if (nb_registered_clients >= MAX_CLIENT)
+    if (nb_registered_clients >= settings.max_clients)
     {
         fprintf(stderr, "ERROR: MAX NUMBER OF CLIENTS REACHED\n");
-        pthread_rwlock_unlock(&registration_table_lock);
+        prof_rwlock_wrunlock(&registration_table_lock);
         return -1;
     }
 
@@ -69,7 +75,7 @@ int registration_insert(client_bundle_t *cl)
             // Replace old client entry
             fprintf(stderr, "Warning: Replacing existing client entry for id %ld\n", cl->key);
             registration_table[i] = cl;
-            pthread_rwlock_unlock(&registration_table_lock);
+            prof_rwlock_wrunlock(&registration_table_lock);
             return 0;
         }
     }
@@ -77,7 +83,7 @@ int registration_insert(client_bundle_t *cl)
     // Insert new client
     registration_table[nb_registered_clients++] = cl;
 
-    pthread_rwlock_unlock(&registration_table_lock);
+    prof_rwlock_wrunlock(&registration_table_lock);
     return 0;
 }
 
@@ -90,7 +96,7 @@ client_bundle_t *registration_remove(unsigned long key)
     }
 
     // locking another writer lock
-    pthread_rwlock_wrlock(&registration_table_lock);
+    prof_rwlock_wrlock(&registration_table_lock);
 
     int i = 0;
 
@@ -105,7 +111,7 @@ client_bundle_t *registration_remove(unsigned long key)
     if (i == nb_registered_clients)
     {
         fprintf(stderr, "Error -- no client found\n");
-        pthread_rwlock_unlock(&registration_table_lock);
+        prof_rwlock_wrunlock(&registration_table_lock);
         return NULL;
     }
 
@@ -116,12 +122,12 @@ client_bundle_t *registration_remove(unsigned long key)
     registration_table[i] = registration_table[nb_registered_clients];
     registration_table[nb_registered_clients] = NULL; // clear dangling pointer
 
-    pthread_rwlock_unlock(&registration_table_lock);
+    prof_rwlock_wrunlock(&registration_table_lock);
     return cl;
 }
 
 // maybe don't need? on shutdown or termination  but the whole prograùm will be over so ?
 void registration_lock_destroy(void)
 {
-    pthread_rwlock_destroy(&registration_table_lock);
+    prof_rwlock_destroy(&registration_table_lock);
 }
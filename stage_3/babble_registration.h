@@ -4,7 +4,7 @@
 #include "babble_types.h"
 
 /* array storing a pointer to each registered client */
-extern client_bundle_t *registration_table[MAX_CLIENT];
+extern client_bundle_t **registration_table;
 
 /* number of registered clients */
 extern int nb_registered_clients;
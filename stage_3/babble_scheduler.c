@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "babble_scheduler.h"
+#include "babble_config.h"
+#include "fastrand.h"
+#include "babble_placement.h"
+#include "babble_latency.h"
+#include "babble_stats.h"
+#include "babble_hot_clients.h"
+#include "babble_memory.h"
+#include "babble_lock_prof.h"
+#include "babble_delay.h"
+
+/* a worker and its run queue (FIFO list of ready mailboxes) */
+typedef struct worker{
+    prof_mutex_t lock;
+    struct mailbox_node *first, *last;
+    unsigned long executed;     /* commands executed */
+    unsigned long stolen;       /* mailboxes stolen from other workers */
+    int kicked;                 /* see scheduler_kick() */
+    int id;
+    pthread_t tid;
+} __attribute__((aligned(CACHE_LINE_SIZE))) worker_t;
+
+/* run queues link mailboxes through this node, allocated along with
+ * the mailbox */
+typedef struct mailbox_node{
+    client_mailbox_t mailbox;
+    struct mailbox_node *next;
+} mailbox_node_t;
+
+static worker_t *workers;
+static int nb_workers;
+static int batch_size;
+static void (*execute_batch)(command_t **cmds, int nb);
+
+/* idle workers sleep until a mailbox is ready */
+static unsigned int nb_ready;
+static unsigned int nb_idle;
+static lock_prof_t run_queue_prof = LOCK_PROF_INITIALIZER("run queue");
+static lock_prof_t idle_prof = LOCK_PROF_INITIALIZER("idle workers");
+static prof_mutex_t idle_lock = PROF_MUTEX_INITIALIZER(&idle_prof);
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static spin_wait_t idle_spin;
+
+static mailbox_node_t *node_of(client_mailbox_t *mailbox)
+{
+    return (mailbox_node_t *)mailbox;
+}
+
+static void mailbox_put(client_mailbox_t *mailbox)
+{
+    if (__atomic_sub_fetch(&mailbox->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        command_buffer_destroy(&mailbox->buffer);
+        mem_free(MEM_COMMANDS, node_of(mailbox));
+    }
+}
+
+static void run_queue_push(worker_t *w, client_mailbox_t *mailbox)
+{
+    mailbox_node_t *node = node_of(mailbox);
+    node->next = NULL;
+
+    prof_mutex_lock(&w->lock);
+    if (w->last == NULL)
+    {
+        w->first = node;
+    }
+    else
+    {
+        w->last->next = node;
+    }
+    w->last = node;
+    prof_mutex_unlock(&w->lock);
+
+    __atomic_add_fetch(&nb_ready, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&nb_idle, __ATOMIC_SEQ_CST))
+    {
+        prof_mutex_lock(&idle_lock);
+        pthread_cond_signal(&idle_cond);
+        prof_mutex_unlock(&idle_lock);
+    }
+}
+
+static client_mailbox_t *run_queue_pop(worker_t *w)
+{
+    mailbox_node_t *node;
+
+    /* avoid taking the lock of empty queues when stealing */
+    if (__atomic_load_n(&w->first, __ATOMIC_RELAXED) == NULL)
+    {
+        return NULL;
+    }
+
+    prof_mutex_lock(&w->lock);
+    node = w->first;
+    if (node != NULL)
+    {
+        w->first = node->next;
+        if (w->first == NULL)
+        {
+            w->last = NULL;
+        }
+    }
+    prof_mutex_unlock(&w->lock);
+
+    if (node == NULL)
+    {
+        return NULL;
+    }
+
+    __atomic_sub_fetch(&nb_ready, 1, __ATOMIC_SEQ_CST);
+    return &node->mailbox;
+}
+
+static int mailboxes_ready(void *arg)
+{
+    worker_t *w = arg;
+    return __atomic_load_n(&nb_ready, __ATOMIC_SEQ_CST) != 0 ||
+           __atomic_load_n(&w->kicked, __ATOMIC_SEQ_CST);
+}
+
+void scheduler_kick(int id)
+{
+    __atomic_store_n(&workers[id].kicked, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&nb_idle, __ATOMIC_SEQ_CST))
+    {
+        /* the idle workers share the condition: wake them all so
+         * that w is among them */
+        prof_mutex_lock(&idle_lock);
+        pthread_cond_broadcast(&idle_cond);
+        prof_mutex_unlock(&idle_lock);
+    }
+}
+
+/* get a ready mailbox, from our own queue first, then from the other
+ * workers; sleeps if there is none. Returns NULL when there is none
+ * and the worker was kicked */
+static client_mailbox_t *worker_next_mailbox(worker_t *w)
+{
+    client_mailbox_t *mailbox;
+
+    while (1)
+    {
+        if ((mailbox = run_queue_pop(w)) != NULL)
+        {
+            return mailbox;
+        }
+
+        for (int i = 1; i < nb_workers; i++)
+        {
+            if ((mailbox = run_queue_pop(&workers[(w->id + i) % nb_workers])) != NULL)
+            {
+                w->stolen++;
+                return mailbox;
+            }
+        }
+
+        if (__atomic_load_n(&w->kicked, __ATOMIC_RELAXED) &&
+            __atomic_exchange_n(&w->kicked, 0, __ATOMIC_ACQUIRE))
+        {
+            return NULL;
+        }
+
+        if (spin_wait(&idle_spin, mailboxes_ready, w))
+        {
+            continue;
+        }
+
+        prof_mutex_lock(&idle_lock);
+        __atomic_add_fetch(&nb_idle, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&nb_ready, __ATOMIC_SEQ_CST) == 0 &&
+               !__atomic_load_n(&w->kicked, __ATOMIC_SEQ_CST))
+        {
+            prof_cond_wait(&idle_cond, &idle_lock);
+        }
+        __atomic_sub_fetch(&nb_idle, 1, __ATOMIC_SEQ_CST);
+        prof_mutex_unlock(&idle_lock);
+    }
+}
+
+/* execute at most MAILBOX_QUANTUM commands of the mailbox */
+static void worker_run_mailbox(worker_t *w, client_mailbox_t *mailbox)
+{
+    command_t *cmds[BABBLE_BATCH_MAX];
+    int nb;
+
+    for (int n = 0; n < MAILBOX_QUANTUM; n += nb)
+    {
+        int max = MAILBOX_QUANTUM - n < batch_size ? MAILBOX_QUANTUM - n : batch_size;
+
+        if ((nb = command_buffer_try_acquire_batch(&mailbox->buffer, cmds, max)) == 0)
+        {
+            /* empty: give the mailbox back to its producer, unless a
+             * command was committed meanwhile. Once scheduled is
+             * cleared, another worker may run the mailbox up to
+             * UNREGISTER: hold a reference while we still look at it */
+            __atomic_add_fetch(&mailbox->refcount, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&mailbox->scheduled, 0, __ATOMIC_SEQ_CST);
+            if (command_buffer_ready(&mailbox->buffer))
+            {
+                mailbox_notify(mailbox);
+            }
+            mailbox_put(mailbox);
+            return;
+        }
+
+        /* UNREGISTER is always the last command of a mailbox */
+        int last = (cmds[nb - 1]->cid == UNREGISTER);
+
+        execute_batch(cmds, nb);
+        command_buffer_release_batch(&mailbox->buffer, cmds, nb);
+        w->executed += nb;
+
+        if (last)
+        {
+            mailbox_put(mailbox);
+            return;
+        }
+    }
+
+    /* quantum exhausted, let the other clients run */
+    run_queue_push(w, mailbox);
+}
+
+static void *worker_thread_routine(void *arg)
+{
+    worker_t *w = arg;
+    fastRandomSetSeed(latency_seed(w->id));
+    placement_pin(PLACE_EXECUTOR, w->id);
+    stats_thread_register();
+    hot_clients_thread_register();
+    delay_home_register(w->id);
+
+    while (1)
+    {
+        client_mailbox_t *mailbox = worker_next_mailbox(w);
+
+        if (mailbox != NULL)
+        {
+            worker_run_mailbox(w, mailbox);
+        }
+        /* the delayed commands of the clients of this worker whose
+         * delay is over */
+        delay_resume();
+    }
+
+    return NULL;
+}
+
+void scheduler_init(int nb, int batch, void (*execute)(command_t **cmds, int nb))
+{
+    nb_workers = nb;
+    batch_size = batch;
+    execute_batch = execute;
+    spin_wait_init(&idle_spin);
+
+    if (posix_memalign((void **)&workers, CACHE_LINE_SIZE, nb * sizeof(worker_t)))
+    {
+        perror("scheduler init");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < nb; i++)
+    {
+        workers[i].id = i;
+        workers[i].first = NULL;
+        workers[i].last = NULL;
+        workers[i].executed = 0;
+        workers[i].stolen = 0;
+        workers[i].kicked = 0;
+        prof_mutex_init(&workers[i].lock, &run_queue_prof);
+    }
+
+    for (int i = 0; i < nb; i++)
+    {
+        if (pthread_create(&workers[i].tid, NULL, worker_thread_routine, &workers[i]) != 0)
+        {
+            fprintf(stderr, "Error -- unable to create worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+client_mailbox_t *mailbox_create(unsigned long key)
+{
+    mailbox_node_t *node;
+
+    if ((node = mem_memalign(MEM_COMMANDS, CACHE_LINE_SIZE, sizeof(mailbox_node_t))) == NULL)
+    {
+        perror("mailbox");
+        exit(EXIT_FAILURE);
+    }
+
+    command_buffer_init(&node->mailbox.buffer, BABBLE_MAILBOX_SIZE);
+    node->mailbox.key = key;
+    node->mailbox.scheduled = 0;
+    node->mailbox.refcount = 2;
+    node->next = NULL;
+
+    return &node->mailbox;
+}
+
+void mailbox_notify(client_mailbox_t *mailbox)
+{
+    int expected = 0;
+
+    if (__atomic_compare_exchange_n(&mailbox->scheduled, &expected, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    {
+        run_queue_push(&workers[mailbox->key % nb_workers], mailbox);
+    }
+}
+
+void mailbox_close(client_mailbox_t *mailbox)
+{
+    mailbox_put(mailbox);
+}
+
+void scheduler_stats_display(FILE *stream)
+{
+    if (workers == NULL)
+    {
+        return;
+    }
+
+    fprintf(stream, "### scheduler stats: %d workers\n", nb_workers);
+    for (int i = 0; i < nb_workers; i++)
+    {
+        fprintf(stream, "    worker %-3d %10lu commands %8lu steals\n", i, workers[i].executed, workers[i].stolen);
+    }
+    spin_wait_display(&idle_spin, "idle workers", stream);
+}
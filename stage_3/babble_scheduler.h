@@ -0,0 +1,51 @@
+#ifndef __BABBLE_SCHEDULER_H__
+#define __BABBLE_SCHEDULER_H__
+
+#include <stdio.h>
+
+#include "babble_types.h"
+#include "babble_command_buffer.h"
+
+/**** Work-stealing executor pool ****/
+
+/* each client gets a mailbox, ie a small command buffer of its own.
+ * A mailbox holding commands is "ready" and sits in the run queue of
+ * one worker; a single worker at a time drains a mailbox, so the
+ * commands of a client are executed in order. Mailboxes are pushed on
+ * the queue of their home worker, and idle workers steal ready
+ * mailboxes from the queues of the others. */
+
+/* max nb of commands executed from a mailbox before it is put back
+ * in the run queue, to be fair with other clients */
+#define MAILBOX_QUANTUM 32
+
+typedef struct client_mailbox{
+    command_buffer_t buffer;   /* commands of the client */
+    unsigned long key;         /* key of the client */
+    int scheduled;             /* set while in a run queue or being
+                                * drained by a worker */
+    int refcount;              /* producer + executor side */
+} client_mailbox_t;
+
+/* start nb_workers threads running execute() on batches of at most
+ * batch_size commands of a mailbox */
+void scheduler_init(int nb_workers, int batch_size, void (*execute)(command_t **cmds, int nb));
+
+/* mailbox of a new client, owned by its communication thread */
+client_mailbox_t *mailbox_create(unsigned long key);
+
+/* to be called after each commit or cancel on mailbox->buffer */
+void mailbox_notify(client_mailbox_t *mailbox);
+
+/* to be called by the communication thread once it is done with the
+ * mailbox (after committing UNREGISTER) */
+void mailbox_close(client_mailbox_t *mailbox);
+
+/* make the worker id go through its loop even without ready
+ * mailboxes, to do some work of its own */
+void scheduler_kick(int id);
+
+/* display the nb of commands executed and steals of each worker */
+void scheduler_stats_display(FILE *stream);
+
+#endif
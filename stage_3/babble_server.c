@@ -10,6 +10,8 @@
 #include <time.h>
 #include <assert.h>
 #include <pthread.h>
+#include <signal.h>
+#include <getopt.h>
 
 #include "babble_server.h"
 #include "babble_config.h"
@@ -18,15 +20,50 @@
 #include "babble_communication.h"
 #include "babble_server_answer.h"
 #include "fastrand.h"
+#include "babble_pool.h"
+#include "babble_command_buffer.h"
+#include "babble_command_lanes.h"
+#include "babble_scheduler.h"
+#include "babble_placement.h"
+#include "babble_settings.h"
+#include "babble_delay.h"
+#include "babble_latency.h"
+#include "babble_stats.h"
+#include "babble_trace.h"
+#include "babble_log.h"
+#include "babble_lock_prof.h"
+#include "babble_hot_clients.h"
+#include "babble_memory.h"
 
-int select_buffer_index(unsigned long key);
-/* to activate random delays in the processing of messages */
-int random_delay_activated;
+/* to compute the placement of the threads from the topology */
+int placement_auto_activated;
+
+/* some command has a delay profile */
+static int delays_active;
+
+/* nb of commands run on the communication threads / queued for the
+ * executors, per command id */
+static unsigned long nb_inline[NB_COMMAND_IDS];
+static unsigned long nb_queued[NB_COMMAND_IDS];
+
+/* flow control: commands refused because the queue of the client was
+ * full, streamed commands beyond the credit window of the client, and
+ * grants sent */
+static unsigned long nb_busy_full;
+static unsigned long nb_busy_window;
+static unsigned long nb_grants;
 
 /* helper function to display help */
 static void display_help(char *exec)
 {
-    printf("Usage: %s -p port_number -r [activate_random_delays]\n", exec);
+    printf("Usage: %s -p port_number -r [activate_random_delays] -w [activate_work_stealing] -b batch_size -l [strict|weighted] -i [activate_inline_reads]\n", exec);
+    printf("\t model: -m|--model sharded|pool|single|sequential (-w is the same as -m pool)\n");
+    printf("\t config: -f config_file -o name=value (can be repeated)\n");
+    printf("\t delays: -D command=profile, same as -o delay_command=profile (can be repeated)\n");
+    printf("\t hot clients: -o hot_clients=N reports the N clients with the highest cost (-o hot_metric=commands|fanout|bytes|cpu)\n");
+    printf("\t traces: -o trace_sample=N traces one command in N, written on SIGUSR2 or by \"STATS trace\" (-o trace_file=path)\n");
+    printf("\t placement: -a [automatic] -A acceptor_cpus -E executor_cpus -C connection_cpus (lists such as 0-3,8)\n");
+    settings_help(stdout);
 }
 
 /* function to parse commands */
@@ -34,7 +71,7 @@ static int parse_command(char *str, command_t *cmd)
 {
     char *name = NULL;
     str_clean(str);                               // clean the input string
-    printf("Received command string: %s\n", str); // parsing test
+    log_debug("Received command string: %s", str);
 
     cmd->cid = str_to_command(str, &cmd->answer_expected);
 
@@ -44,8 +81,8 @@ static int parse_command(char *str, command_t *cmd)
         if (str_to_payload(str, cmd->msg, BABBLE_ID_SIZE))
         {
             name = get_name_from_key(cmd->key);
-            fprintf(stderr, "Error from [%s]-- invalid LOGIN -> %s\n", name, str);
-            free(name);
+            log_error("Error from [%s]-- invalid LOGIN -> %s", name, str);
+            pool_free(POOL_NAME, name);
             return -1;
         }
         break;
@@ -53,8 +90,8 @@ static int parse_command(char *str, command_t *cmd)
         if (str_to_payload(str, cmd->msg, BABBLE_PUBLICATION_SIZE))
         {
             name = get_name_from_key(cmd->key);
-            fprintf(stderr, "Warning from [%s]-- invalid PUBLISH -> %s\n", name, str);
-            free(name);
+            log_warn("Warning from [%s]-- invalid PUBLISH -> %s", name, str);
+            pool_free(POOL_NAME, name);
             return -1;
         }
         break;
@@ -62,8 +99,8 @@ static int parse_command(char *str, command_t *cmd)
         if (str_to_payload(str, cmd->msg, BABBLE_ID_SIZE))
         {
             name = get_name_from_key(cmd->key);
-            fprintf(stderr, "Warning from [%s]-- invalid FOLLOW -> %s\n", name, str);
-            free(name);
+            log_warn("Warning from [%s]-- invalid FOLLOW -> %s", name, str);
+            pool_free(POOL_NAME, name);
             return -1;
         }
         break;
@@ -72,10 +109,21 @@ static int parse_command(char *str, command_t *cmd)
     case RDV:
         cmd->msg[0] = '\0';
         break;
+    case STATS:
+        /* "STATS trace" also writes the traces */
+        cmd->msg[0] = '\0';
+        if (str_has_payload(str) && str_to_payload(str, cmd->msg, BABBLE_ID_SIZE))
+        {
+            name = get_name_from_key(cmd->key);
+            log_warn("Warning from [%s]-- invalid STATS -> %s", name, str);
+            pool_free(POOL_NAME, name);
+            return -1;
+        }
+        break;
     default:
         name = get_name_from_key(cmd->key);
-        fprintf(stderr, "Error from [%s]-- invalid client command -> %s\n", name, str);
-        free(name);
+        log_error("Error from [%s]-- invalid client command -> %s", name, str);
+        pool_free(POOL_NAME, name);
         return -1;
     }
     return 0;
@@ -91,15 +139,12 @@ static int process_command(command_t *cmd, answer_t **answer)
         res = run_login_command(cmd, answer);
         break;
     case PUBLISH:
-        random_delay(random_delay_activated);
         res = run_publish_command(cmd, answer);
         break;
     case FOLLOW:
-        random_delay(random_delay_activated);
         res = run_follow_command(cmd, answer);
         break;
     case TIMELINE:
-        random_delay(random_delay_activated);
         res = run_timeline_command(cmd, answer);
         break;
     case FOLLOW_COUNT:
@@ -108,145 +153,723 @@ static int process_command(command_t *cmd, answer_t **answer)
     case RDV:
         res = run_rdv_command(cmd, answer);
         break;
+    case STATS:
+        res = run_stats_command(cmd, answer);
+        break;
     case UNREGISTER:
         res = unregisted_client(cmd);
         *answer = NULL;
         break;
     default:
-        fprintf(stderr, "Error -- Unknown command id\n");
+        log_error("Error -- Unknown command id");
         return -1;
     }
     if (res)
     {
-        fprintf(stderr, "Error -- Failed to run command ");
-        display_command(cmd, stderr);
+        log_error("Error -- Failed to run command %s { %s }", command_name(cmd->cid), cmd->msg);
     }
     return res;
 }
 
-/* data structures for multiple buffers */
-typedef struct
+command_lanes_t *buffers;
+pthread_t *comm_threads;
+pthread_t *executor_threads;
+
+/* executors are done initializing their buffers */
+pthread_barrier_t executors_ready;
+
+/* initialize the buffers of an executor -- done by the executor
+ * itself, so that they are allocated on its node */
+void buffers_init(int index)
 {
-    command_t buffer[MAX_COMMANDS];
-    int buffer_in;
-    int buffer_out;
-    int buffer_count;
-    pthread_mutex_t mutex;
-    pthread_cond_t not_empty;
-    pthread_cond_t not_full;
-} command_buffer_t;
-
-command_buffer_t buffers[BABBLE_PRODCONS_NB];
-pthread_t comm_threads[MAX_CLIENT];
-pthread_t executor_threads[BABBLE_PRODCONS_NB];
-
-/* initialize the buffers */
-void buffers_init(void)
+    command_lanes_init(&buffers[index], BABBLE_PRIORITY_LANE_SIZE, settings.buffer_size, settings.lane_policy);
+}
+
+/* commands of a given client always go to the same buffer so that
+ * they are executed in order */
+int select_buffer_index(unsigned long key)
+{
+    return key % settings.nb_executors;
+}
+
+/* get the command id of a raw command string without parsing it, -1
+ * if it is not well formed */
+static int peek_command_id(char *str)
 {
-    for (int i = 0; i < BABBLE_PRODCONS_NB; i++)
+    if (str[0] == 'S' && str[1] == ' ')
     {
-        buffers[i].buffer_in = 0;
-        buffers[i].buffer_out = 0;
-        buffers[i].buffer_count = 0;
-        pthread_mutex_init(&buffers[i].mutex, NULL);
-        pthread_cond_init(&buffers[i].not_empty, NULL);
-        pthread_cond_init(&buffers[i].not_full, NULL);
+        str += 2;
     }
+    if (str[0] < '0' || str[0] > '9' || (str[1] != ' ' && str[1] != '\0' && str[1] != '\r' && str[1] != '\n'))
+    {
+        return -1;
+    }
+    return str[0] - '0';
 }
 
+/* streamed commands do not expect an answer, they are paced by the
+ * credits of the client */
+static int is_streamed_command(char *str)
+{
+    return str[0] == 'S' && str[1] == ' ';
+}
+
+/* latency-sensitive commands go to the priority lane */
+static int is_priority_command(int cid)
+{
+    return cid == TIMELINE || cid == FOLLOW_COUNT || cid == RDV || cid == STATS;
+}
+
+/* commands that only read state that is atomically readable: the
+ * count of followers of the client (a single word, stored atomically
+ * by the executors, the array itself is not read), the histograms, or
+ * nothing at all. STATS is always run inline, the others only with
+ * inline reads */
+static int is_inline_command(int cid)
+{
+    return cid == STATS || (settings.inline_reads && (cid == FOLLOW_COUNT || cid == RDV));
+}
+
+/* run a read-only command on the communication thread and answer it
+ * -- only when no command of the client is pending, so that it does
+ * not overtake them and its answer is not sent concurrently with
+ * theirs */
+static void run_inline_command(char *str, unsigned long key, unsigned int trace_id)
+{
+    command_t *cmd = new_command(key);
+    answer_t *answer = NULL;
+    unsigned long start = stats_now(), end;
+
+    if (parse_command(str, cmd) == -1)
+    {
+        notify_parse_error(cmd, str, &answer);
+    }
+    else if (process_command(cmd, &answer) == -1)
+    {
+        log_error("Error processing command");
+    }
+    pool_count_command();
+    end = stats_now();
+    stats_record(cmd->cid, STATS_EXEC, end - start);
+    trace_record(trace_id, TRACE_EXEC, cmd->cid, key, start, end);
+    hot_clients_record(key, 1, 0, 0, end - start);
+
+    if (answer)
+    {
+        send_answer_to_client(answer);
+        free_answer(answer);
+        start = stats_now();
+        stats_record(cmd->cid, STATS_SEND, start - end);
+        trace_record(trace_id, TRACE_SEND, cmd->cid, key, end, start);
+    }
+    free_command(cmd);
+}
+
+/* receive a command, start tells when the thread started waiting for
+ * it (if tracing) -- buf is to be freed with mem_free() */
+static int recv_command(int sock, char **buf, unsigned long *start)
+{
+    int size;
+
+    *start = trace_active() ? stats_now() : 0;
+    if ((size = network_recv(sock, (void **)buf)) > 0)
+    {
+        mem_adopt(MEM_IO_BUFFERS, *buf);
+    }
+
+    return size;
+}
+
+/* a command was received: draw if it is traced, and record its
+ * reception */
+static unsigned int trace_received(int cid, unsigned long key, unsigned long start)
+{
+    unsigned int trace_id;
+
+    if (start == 0 || cid < 0 || cid >= NB_COMMAND_IDS || (trace_id = trace_sample()) == 0)
+    {
+        return 0;
+    }
+    trace_record(trace_id, TRACE_RECV, cid, key, start, stats_now());
+
+    return trace_id;
+}
+
+static void sequential_client_loop(int sock, unsigned long key, lane_counts_t *counts);
+
 void *communication_thread_routine(void *arg)
 {
     int newsockfd = *(int *)arg;
     char *recv_buff = NULL;
     command_t *cmd;
+    answer_t *answer = NULL;
     int recv_size;
+    unsigned long client_key;
+    command_buffer_t *buffer;
+    client_mailbox_t *mailbox = NULL;
+    command_lanes_t *lanes = NULL;
+    lane_counts_t *counts = NULL;
+    lane_id_t lane = LANE_NORMAL;
+    unsigned long recv_start;
+    unsigned int trace_id;
+
+    free(arg);
 
-    while ((recv_size = network_recv(newsockfd, (void **)&recv_buff)) > 0)
+    /* the first message must be a LOGIN */
+    if ((recv_size = network_recv(newsockfd, (void **)&recv_buff)) <= 0)
     {
-        cmd = new_command(hash(recv_buff));
-        if (parse_command(recv_buff, cmd) == -1)
+        /* an empty frame is not a command either */
+        log_error("Error -- recv from client");
+        free(recv_buff);
+        close(newsockfd);
+        pthread_exit(NULL);
+    }
+    pool_count_heap_alloc();
+
+    cmd = new_command(0);
+    if (parse_command(recv_buff, cmd) == -1 || cmd->cid != LOGIN)
+    {
+        log_error("Error -- in LOGIN message");
+        close(newsockfd);
+        free(recv_buff);
+        free_command(cmd);
+        pthread_exit(NULL);
+    }
+    free(recv_buff);
+
+    cmd->sock = newsockfd;
+    if (process_command(cmd, &answer) == -1)
+    {
+        close(newsockfd);
+        free_command(cmd);
+        pthread_exit(NULL);
+    }
+    send_answer_to_client(answer);
+    free_answer(answer);
+
+    client_key = cmd->key;
+    free_command(cmd);
+
+    /* count the pending commands of the client (to keep them in order
+     * across lanes, and to know when read-only commands can run here) */
+    counts = mem_calloc(MEM_COMMANDS, 1, sizeof(lane_counts_t));
+
+    /* run next to the executor of the client */
+    if (settings.model == MODEL_SEQUENTIAL)
+    {
+        placement_pin(PLACE_CONNECTION, 0);
+        sequential_client_loop(newsockfd, client_key, counts);
+        pthread_exit(NULL);
+    }
+    placement_pin(PLACE_CONNECTION, settings.model == MODEL_POOL ? client_key % settings.nb_workers : select_buffer_index(client_key));
+
+    if (settings.model == MODEL_POOL)
+    {
+        mailbox = mailbox_create(client_key);
+        buffer = &mailbox->buffer;
+    }
+    else
+    {
+        lanes = &buffers[select_buffer_index(client_key)];
+    }
+
+    while ((recv_size = recv_command(newsockfd, &recv_buff, &recv_start)) > 0)
+    {
+        pool_count_heap_alloc();
+
+        int cid = peek_command_id(recv_buff);
+        int streamed = is_streamed_command(recv_buff);
+        trace_id = trace_received(cid, client_key, recv_start);
+        if (is_inline_command(cid) && !latency_active(cid) && command_lanes_idle(counts))
         {
+            run_inline_command(recv_buff, client_key, trace_id);
+            __atomic_fetch_add(&nb_inline[cid], 1, __ATOMIC_RELAXED);
+            mem_free(MEM_IO_BUFFERS, recv_buff);
+            continue;
+        }
+
+        /* the client streams beyond its window: drop the command */
+        if (streamed && settings.credit_window &&
+            __atomic_load_n(&counts->in_flight, __ATOMIC_RELAXED) >= (unsigned int)settings.credit_window)
+        {
+            notify_busy(client_key, 0);
+            __atomic_fetch_add(&nb_busy_window, 1, __ATOMIC_RELAXED);
+            mem_free(MEM_IO_BUFFERS, recv_buff);
+            continue;
+        }
 
-            answer_t *answer = NULL;
+        lane = command_lanes_select(counts, lanes && is_priority_command(cid));
+        if (lanes)
+        {
+            buffer = &lanes->lanes[lane];
+        }
+
+        /* the command is parsed directly in its slot of the buffer --
+         * if the queue is full, the client is told the server is busy
+         * rather than left waiting */
+        if ((cmd = command_buffer_try_reserve(buffer)) == NULL)
+        {
+            command_lanes_unselect(counts, lane);
+            notify_busy(client_key, !streamed);
+            __atomic_fetch_add(&nb_busy_full, 1, __ATOMIC_RELAXED);
+            mem_free(MEM_IO_BUFFERS, recv_buff);
+            continue;
+        }
+        cmd->key = client_key;
+        cmd->counts = counts;
+        cmd->lane = lane;
+        cmd->trace_id = trace_id;
+        if (parse_command(recv_buff, cmd) == -1)
+        {
+            answer = NULL;
             notify_parse_error(cmd, recv_buff, &answer);
+            if (streamed && settings.credit_window)
+            {
+                /* give its credit back */
+                send_credit_grant(client_key, 1, 0);
+            }
+            if (lanes)
+            {
+                command_lanes_cancel(lanes, lane, cmd);
+            }
+            else
+            {
+                /* it will never reach the executor */
+                command_lanes_done(cmd);
+                command_buffer_cancel(buffer, cmd);
+            }
             if (answer)
             {
                 send_answer_to_client(answer);
                 free_answer(answer);
             }
-            free(recv_buff);
-            free(cmd);
-            continue;
         }
+        else
+        {
+            __atomic_fetch_add(&nb_queued[cmd->cid], 1, __ATOMIC_RELAXED);
+            if (!cmd->answer_expected && settings.credit_window)
+            {
+                /* before the commit: the executor gives it back */
+                __atomic_fetch_add(&counts->in_flight, 1, __ATOMIC_RELAXED);
+            }
+            cmd->queued_ns = stats_now();
+            if (lanes)
+            {
+                command_lanes_commit(lanes, lane, cmd);
+            }
+            else
+            {
+                command_buffer_commit(buffer, cmd);
+            }
+        }
+        if (mailbox)
+        {
+            mailbox_notify(mailbox);
+        }
+
+        mem_free(MEM_IO_BUFFERS, recv_buff);
+    }
+
+    /* the client is unregistered (and its socket closed) by the
+     * executor, after all its pending commands */
+    lane = command_lanes_select(counts, 0);
+    if (lanes)
+    {
+        buffer = &lanes->lanes[lane];
+    }
+    cmd = command_buffer_reserve(buffer);
+    cmd->key = client_key;
+    cmd->counts = counts;
+    cmd->lane = lane;
+    cmd->cid = UNREGISTER;
+    cmd->queued_ns = stats_now();
+    cmd->trace_id = 0;
+    if (lanes)
+    {
+        command_lanes_commit(lanes, lane, cmd);
+    }
+    else
+    {
+        command_buffer_commit(buffer, cmd);
+    }
+    if (mailbox)
+    {
+        mailbox_notify(mailbox);
+        mailbox_close(mailbox);
+    }
+
+    pthread_exit(NULL);
+}
+
+/* send the answers of a batch, grouped by destination client, and
+ * free them -- answers[i] is the answer to cmds[i] */
+static void send_batch_answers(command_t **cmds, answer_t **answers, int nb)
+{
+    answer_t *group[BABBLE_BATCH_MAX];
+    command_t *group_cmds[BABBLE_BATCH_MAX];
+    int nb_group;
+    unsigned long start, end, elapsed;
 
-        int buffer_index = select_buffer_index(cmd->key);
-        command_buffer_t *buffer = &buffers[buffer_index];
+    for (int i = 0; i < nb; i++)
+    {
+        if (answers[i] == NULL)
+        {
+            continue;
+        }
 
-        pthread_mutex_lock(&buffer->mutex);
-        while (buffer->buffer_count == MAX_COMMANDS)
+        /* collect the following answers to the same client, in order */
+        nb_group = 0;
+        for (int j = i; j < nb; j++)
         {
-            pthread_cond_wait(&buffer->not_full, &buffer->mutex);
+            if (answers[j] != NULL && answers[j]->key == answers[i]->key)
+            {
+                group_cmds[nb_group] = cmds[j];
+                group[nb_group++] = answers[j];
+                if (j != i)
+                {
+                    answers[j] = NULL;
+                }
+            }
         }
+        answers[i] = NULL;
 
-        buffer->buffer[buffer->buffer_in] = *cmd;
-        buffer->buffer_in = (buffer->buffer_in + 1) % MAX_COMMANDS;
-        buffer->buffer_count++;
+        /* the answers of a group go in a single write, that is
+         * shared among them */
+        start = stats_now();
+        send_answers_to_client(group, nb_group);
+        end = stats_now();
+        elapsed = (end - start) / nb_group;
+        for (int j = 0; j < nb_group; j++)
+        {
+            stats_record(group_cmds[j]->cid, STATS_SEND, elapsed);
+            trace_record(group_cmds[j]->trace_id, TRACE_SEND, group_cmds[j]->cid, group_cmds[j]->key, start, end);
+            free_answer(group[j]);
+        }
+    }
+}
 
-        pthread_cond_signal(&buffer->not_empty);
-        pthread_mutex_unlock(&buffer->mutex);
+/* a streamed command of the client was executed: give the credits
+ * back by half windows, to keep the grants rare while the client
+ * always has credits left */
+static void flow_control_executed(command_t *cmd)
+{
+    lane_counts_t *counts = cmd->counts;
+    unsigned int threshold = settings.credit_window / 2 ? settings.credit_window / 2 : 1;
 
-        free(recv_buff);
-        free(cmd);
+    if (++counts->to_grant < threshold)
+    {
+        return;
     }
 
-    close(newsockfd);
-    free(arg);
-    pthread_exit(NULL);
+    __atomic_fetch_sub(&counts->in_flight, counts->to_grant, __ATOMIC_RELAXED);
+    send_credit_grant(cmd->key, counts->to_grant, 0);
+    __atomic_fetch_add(&nb_grants, 1, __ATOMIC_RELAXED);
+    counts->to_grant = 0;
 }
 
-void *executor_thread_routine(void *arg)
+/* process a batch of commands taken from a buffer and send the
+ * answers. Consecutive PUBLISH of a client share a single pass over
+ * its followers. With simulated delays, commands may be parked and
+ * completed later by complete_delayed_command() */
+static void execute_batch(command_t **cmds, int nb)
 {
-    int thread_id = *(int *)arg;
-    command_buffer_t *buffer = &buffers[thread_id];
-    fastRandomSetSeed(time(NULL) + thread_id * 100);
-    command_t *cmd;
-    answer_t *answer;
+    answer_t *answers[BABBLE_BATCH_MAX];
+    char parked[BABBLE_BATCH_MAX] = {0};
+    int i = 0, j = 0;
+    unsigned long now = stats_now(), start, elapsed;
 
-    while (1)
+    for (i = 0; i < nb; i++)
+    {
+        stats_record(cmds[i]->cid, STATS_QUEUE, now - cmds[i]->queued_ns);
+        trace_record(cmds[i]->trace_id, TRACE_QUEUE, cmds[i]->cid, cmds[i]->key, cmds[i]->queued_ns, now);
+    }
+
+    i = 0;
+    while (i < nb)
+    {
+        if (delays_active)
+        {
+            /* its answer may be sent between two later batches: the
+             * answers produced so far go first */
+            send_batch_answers(cmds, answers, i);
+            now = stats_now();
+            cmds[i]->started_ns = now;
+            if (delay_command(cmds[i]))
+            {
+                answers[i] = NULL;
+                parked[i++] = 1;
+                continue;
+            }
+        }
+
+        if (cmds[i]->cid == UNREGISTER)
+        {
+            /* the socket is closed by UNREGISTER: flush the answers
+             * produced so far first */
+            send_batch_answers(cmds, answers, i);
+            now = stats_now();
+        }
+
+        start = now;
+        if (cmds[i]->cid == PUBLISH)
+        {
+            /* with delays, each PUBLISH has its own */
+            j = i + 1;
+            while (!delays_active && j < nb && cmds[j]->cid == PUBLISH && cmds[j]->key == cmds[i]->key)
+            {
+                j++;
+            }
+
+            if (run_publish_batch(&cmds[i], j - i, &answers[i]))
+            {
+                log_error("Error processing command");
+            }
+        }
+        else
+        {
+            j = i + 1;
+            answers[i] = NULL;
+            if (process_command(cmds[i], &answers[i]) == -1)
+            {
+                log_error("Error processing command");
+            }
+        }
+
+        /* the commands of a group share its execution time */
+        now = stats_now();
+        elapsed = (now - start) / (j - i);
+        for (; i < j; i++)
+        {
+            stats_record(cmds[i]->cid, STATS_EXEC, elapsed);
+            trace_record(cmds[i]->trace_id, TRACE_EXEC, cmds[i]->cid, cmds[i]->key, start, now);
+            hot_clients_record(cmds[i]->key, 1, 0, 0, elapsed);
+            pool_count_command();
+        }
+    }
+
+    send_batch_answers(cmds, answers, nb);
+
+    /* only once the answers are sent: a client without pending
+     * commands may get answers from its communication thread */
+    for (i = 0; i < nb; i++)
     {
-        pthread_mutex_lock(&buffer->mutex);
-        while (buffer->buffer_count == 0)
+        if (parked[i])
+        {
+            continue;
+        }
+        if (settings.credit_window && !cmds[i]->answer_expected && cmds[i]->cid != UNREGISTER)
         {
-            pthread_cond_wait(&buffer->not_empty, &buffer->mutex);
+            flow_control_executed(cmds[i]);
         }
+        command_lanes_done(cmds[i]);
+    }
+}
 
-        cmd = &buffer->buffer[buffer->buffer_out];
-        buffer->buffer_out = (buffer->buffer_out + 1) % MAX_COMMANDS;
-        buffer->buffer_count--;
+/* make the executor (or worker) home run delay_resume() */
+static void wake_home(int home)
+{
+    if (settings.model == MODEL_POOL)
+    {
+        scheduler_kick(home);
+    }
+    else
+    {
+        command_lanes_kick(&buffers[home]);
+    }
+}
+
+/* run a command parked by delay_command() once its delay is over --
+ * called by the executor (or worker) that parked it, from
+ * delay_resume() */
+static void complete_delayed_command(command_t *cmd)
+{
+    answer_t *answer = NULL;
+    unsigned long start = stats_now(), end;
+
+    if (process_command(cmd, &answer) == -1)
+    {
+        log_error("Error processing command");
+    }
+    pool_count_command();
 
-        pthread_cond_signal(&buffer->not_full);
-        pthread_mutex_unlock(&buffer->mutex);
+    /* its execution includes its delay, and the wait behind the
+     * commands of the client parked before it (but not its cost) */
+    end = stats_now();
+    stats_record(cmd->cid, STATS_EXEC, end - cmd->started_ns);
+    trace_record(cmd->trace_id, TRACE_EXEC, cmd->cid, cmd->key, cmd->started_ns, end);
+    hot_clients_record(cmd->key, 1, 0, 0, end - start);
 
-        if (process_command(cmd, &answer) == -1)
+    if (answer)
+    {
+        unsigned long sent;
+
+        send_answer_to_client(answer);
+        free_answer(answer);
+        sent = stats_now();
+        stats_record(cmd->cid, STATS_SEND, sent - end);
+        trace_record(cmd->trace_id, TRACE_SEND, cmd->cid, cmd->key, end, sent);
+    }
+
+    if (settings.credit_window && !cmd->answer_expected && cmd->cid != UNREGISTER)
+    {
+        flow_control_executed(cmd);
+    }
+    command_lanes_done(cmd);
+}
+
+/* the lock of the sequential model, held while a command runs */
+static lock_prof_t sequential_prof = LOCK_PROF_INITIALIZER("sequential");
+static prof_mutex_t sequential_lock = PROF_MUTEX_INITIALIZER(&sequential_prof);
+
+/* run a command in the sequential model, with its delay if any (the
+ * whole server waits for it) -- the queue time is the wait for the
+ * lock */
+static void run_sequential_command(command_t *cmd)
+{
+    answer_t *answer = NULL;
+    unsigned long start = stats_now(), run_start, end;
+
+    stats_record(cmd->cid, STATS_QUEUE, start - cmd->queued_ns);
+    trace_record(cmd->trace_id, TRACE_QUEUE, cmd->cid, cmd->key, cmd->queued_ns, start);
+    if (latency_active(cmd->cid))
+    {
+        usleep(latency_draw(cmd->cid));
+    }
+
+    run_start = stats_now();
+    if (process_command(cmd, &answer) == -1)
+    {
+        log_error("Error processing command");
+    }
+    pool_count_command();
+    end = stats_now();
+    stats_record(cmd->cid, STATS_EXEC, end - start);
+    trace_record(cmd->trace_id, TRACE_EXEC, cmd->cid, cmd->key, start, end);
+    hot_clients_record(cmd->key, 1, 0, 0, end - run_start);
+
+    if (answer)
+    {
+        send_answer_to_client(answer);
+        free_answer(answer);
+        start = stats_now();
+        stats_record(cmd->cid, STATS_SEND, start - end);
+        trace_record(cmd->trace_id, TRACE_SEND, cmd->cid, cmd->key, end, start);
+    }
+
+    if (settings.credit_window && !cmd->answer_expected && cmd->cid != UNREGISTER)
+    {
+        __atomic_fetch_add(&cmd->counts->in_flight, 1, __ATOMIC_RELAXED);
+        flow_control_executed(cmd);
+    }
+}
+
+/* sequential model: the communication thread runs the commands of
+ * its client, including the final UNREGISTER */
+static void sequential_client_loop(int sock, unsigned long key, lane_counts_t *counts)
+{
+    char *recv_buff = NULL;
+    answer_t *answer;
+    command_t *cmd;
+    int streamed;
+    unsigned long recv_start;
+
+    fastRandomSetSeed(latency_seed(key));
+
+    while (recv_command(sock, &recv_buff, &recv_start) > 0)
+    {
+        pool_count_heap_alloc();
+
+        streamed = is_streamed_command(recv_buff);
+        cmd = new_command(key);
+        cmd->counts = counts;
+        cmd->trace_id = trace_received(peek_command_id(recv_buff), key, recv_start);
+        cmd->queued_ns = stats_now();
+
+        prof_mutex_lock(&sequential_lock);
+        if (parse_command(recv_buff, cmd) == -1)
+        {
+            answer = NULL;
+            notify_parse_error(cmd, recv_buff, &answer);
+            if (streamed && settings.credit_window)
+            {
+                send_credit_grant(key, 1, 0);
+            }
+            if (answer)
+            {
+                send_answer_to_client(answer);
+                free_answer(answer);
+            }
+        }
+        else
         {
-            fprintf(stderr, "Error processing command\n");
+            __atomic_fetch_add(&nb_inline[cmd->cid], 1, __ATOMIC_RELAXED);
+            run_sequential_command(cmd);
         }
+        prof_mutex_unlock(&sequential_lock);
+
+        free_command(cmd);
+        mem_free(MEM_IO_BUFFERS, recv_buff);
+    }
+
+    cmd = new_command(key);
+    cmd->counts = counts;
+    cmd->cid = UNREGISTER;
+    cmd->queued_ns = stats_now();
+    cmd->trace_id = 0;
+    prof_mutex_lock(&sequential_lock);
+    run_sequential_command(cmd);
+    prof_mutex_unlock(&sequential_lock);
+    free_command(cmd);
+    mem_free(MEM_COMMANDS, counts);
+}
 
-        if (answer != NULL)
+void *executor_thread_routine(void *arg)
+{
+    int thread_id = *(int *)arg;
+    command_lanes_t *lanes = &buffers[thread_id];
+    fastRandomSetSeed(latency_seed(thread_id));
+    command_t *cmds[BABBLE_BATCH_MAX];
+    lane_id_t lane;
+    int nb;
+
+    placement_pin(PLACE_EXECUTOR, thread_id);
+    buffers_init(thread_id);
+    stats_thread_register();
+    hot_clients_thread_register();
+    delay_home_register(thread_id);
+    pthread_barrier_wait(&executors_ready);
+
+    while (1)
+    {
+        /* the commands are processed in place, their slots are
+         * released once we are done with them */
+        nb = command_lanes_acquire_batch(lanes, cmds, settings.batch_size, &lane);
+        if (nb)
         {
-            send_answer_to_client(answer);
-            free_answer(answer);
+            execute_batch(cmds, nb);
+            command_buffer_release_batch(&lanes->lanes[lane], cmds, nb);
         }
+        /* the delayed commands of our clients whose delay is over */
+        delay_resume();
     }
 
     free(arg);
     pthread_exit(NULL);
 }
 
-/* initialize executor threads */
+/* initialize executor threads, and wait for their buffers to be
+ * ready */
 void executor_threads_init(void)
 {
-    for (int i = 0; i < BABBLE_PRODCONS_NB; i++)
+    if (posix_memalign((void **)&buffers, CACHE_LINE_SIZE, settings.nb_executors * sizeof(command_lanes_t)))
+    {
+        perror("buffers");
+        exit(EXIT_FAILURE);
+    }
+    executor_threads = malloc(settings.nb_executors * sizeof(pthread_t));
+    pthread_barrier_init(&executors_ready, NULL, settings.nb_executors + 1);
+
+    for (int i = 0; i < settings.nb_executors; i++)
     {
         int *arg = malloc(sizeof(int));
         *arg = i;
@@ -256,34 +879,153 @@ void executor_threads_init(void)
             exit(EXIT_FAILURE);
         }
     }
+
+    pthread_barrier_wait(&executors_ready);
+}
+
+/* displays the server stats each time SIGUSR1 is received, and dumps
+ * the traces on SIGUSR2 */
+static void *stats_thread_routine(void *arg)
+{
+    sigset_t *set = arg;
+    int sig;
+
+    while (sigwait(set, &sig) == 0)
+    {
+        if (sig == SIGUSR2)
+        {
+            trace_dump_file();
+            continue;
+        }
+        pool_stats_display(stdout);
+        fprintf(stdout, "### commands run inline / queued\n");
+        for (int i = PUBLISH; i < UNREGISTER; i++)
+        {
+            fprintf(stdout, "    %-12s %10lu inline %10lu queued\n", command_name(i),
+                    __atomic_load_n(&nb_inline[i], __ATOMIC_RELAXED),
+                    __atomic_load_n(&nb_queued[i], __ATOMIC_RELAXED));
+        }
+        fprintf(stdout, "### flow control (window %d): %lu busy (queue full), %lu busy (window exceeded), %lu grants\n",
+                settings.credit_window,
+                __atomic_load_n(&nb_busy_full, __ATOMIC_RELAXED),
+                __atomic_load_n(&nb_busy_window, __ATOMIC_RELAXED),
+                __atomic_load_n(&nb_grants, __ATOMIC_RELAXED));
+        if (delays_active && settings.model != MODEL_SEQUENTIAL)
+        {
+            delay_stats_display(stdout);
+        }
+        stats_display(stdout);
+        hot_clients_display(stdout);
+        mem_stats_display(stdout);
+        log_stats_display(stdout);
+        if (settings.lock_profiling)
+        {
+            lock_prof_display(stdout);
+        }
+        if (settings.model == MODEL_POOL)
+        {
+            scheduler_stats_display(stdout);
+        }
+        else if (settings.model != MODEL_SEQUENTIAL)
+        {
+            for (int i = 0; i < settings.nb_executors; i++)
+            {
+                fprintf(stdout, "### lanes of executor %d (%s policy)\n", i,
+                        settings.lane_policy == LANES_STRICT ? "strict" : "weighted");
+                command_lanes_stats_display(&buffers[i], stdout);
+            }
+        }
+        fflush(stdout);
+    }
+
+    return NULL;
 }
 
 /* main function */
 int main(int argc, char *argv[])
 {
     int sockfd;
-    int portno = BABBLE_PORT;
     int opt;
     int nb_args = 1;
+    char *config_file = NULL;
+    int err = 0;
+    static struct option long_options[] = {
+        {"model", required_argument, NULL, 'm'},
+        {NULL, 0, NULL, 0}};
 
-    while ((opt = getopt(argc, argv, "+hp:r")) != -1)
+    while ((opt = getopt_long(argc, argv, "+hp:rwm:b:l:iaA:E:C:f:o:D:", long_options, NULL)) != -1)
     {
         switch (opt)
         {
         case 'p':
-            portno = atoi(optarg);
+            err = settings_override("port", optarg);
             nb_args += 2;
             break;
         case 'r':
-            random_delay_activated = 1;
+            err = settings_override("random_delay", "on");
+            nb_args += 1;
+            break;
+        case 'w':
+            err = settings_override("model", "pool");
+            nb_args += 1;
+            break;
+        case 'm':
+            err = settings_override("model", optarg);
+            /* --model=name is a single argument */
+            nb_args += optarg == argv[optind - 1] ? 2 : 1;
+            break;
+        case 'b':
+            err = settings_override("batch_size", optarg);
+            nb_args += 2;
+            break;
+        case 'l':
+            err = settings_override("lane_policy", optarg);
+            nb_args += 2;
+            break;
+        case 'i':
+            err = settings_override("inline_reads", "on");
             nb_args += 1;
             break;
+        case 'f':
+            config_file = optarg;
+            nb_args += 2;
+            break;
+        case 'o':
+            err = settings_override_str(optarg);
+            nb_args += 2;
+            break;
+        case 'D':
+        {
+            char name[BABBLE_BUFFER_SIZE];
+            snprintf(name, sizeof(name), "delay_%s", optarg);
+            err = settings_override_str(name);
+            nb_args += 2;
+            break;
+        }
+        case 'a':
+            placement_auto_activated = 1;
+            nb_args += 1;
+            break;
+        case 'A':
+        case 'E':
+        case 'C':
+            if (placement_set_cpus(opt == 'A' ? PLACE_ACCEPTOR : (opt == 'E' ? PLACE_EXECUTOR : PLACE_CONNECTION), optarg))
+            {
+                fprintf(stderr, "invalid cpu list %s\n", optarg);
+                return -1;
+            }
+            nb_args += 2;
+            break;
         case 'h':
         case '?':
         default:
             display_help(argv[0]);
             return -1;
         }
+        if (err)
+        {
+            return -1;
+        }
     }
 
     if (nb_args != argc)
@@ -292,17 +1034,78 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    if (settings_load(config_file))
+    {
+        return -1;
+    }
+    settings_display(stdout);
+
+    latency_init();
+    delays_active = latency_active(-1);
+    if (delays_active)
+    {
+        latency_display(stdout);
+    }
+
+    /* in the sequential model, the communication threads are placed
+     * as if there was a single executor */
+    int nb_executors = settings.model == MODEL_POOL ? settings.nb_workers : (settings.model == MODEL_SEQUENTIAL ? 1 : settings.nb_executors);
+
+    trace_init(settings.trace_sample);
+    lock_prof_enable(settings.lock_profiling);
+    hot_clients_init(settings.hot_clients, settings.hot_metric);
+
+    /* SIGUSR1 and SIGUSR2 are handled by a dedicated thread: block
+     * them before creating the other threads */
+    static sigset_t stats_set;
+    pthread_t stats_thread;
+    sigemptyset(&stats_set);
+    sigaddset(&stats_set, SIGUSR1);
+    sigaddset(&stats_set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &stats_set, NULL);
+    fflush(stdout);
+    log_init(settings.log_level);
+    mem_report_start(settings.mem_report, stdout);
+    pthread_create(&stats_thread, NULL, stats_thread_routine, &stats_set);
+
+    /* credit grants may be written to clients that just disconnected:
+     * the write fails instead of killing the server */
+    signal(SIGPIPE, SIG_IGN);
+
     server_data_init();
-    buffers_init();
-    executor_threads_init();
 
-    if ((sockfd = server_connection_init(portno)) == -1)
+    if (delays_active && settings.model != MODEL_SEQUENTIAL)
+    {
+        delay_init(nb_executors, complete_delayed_command, wake_home);
+    }
+
+    if (placement_auto_activated)
+    {
+        placement_auto(nb_executors);
+    }
+    placement_display(stdout, nb_executors);
+
+    if (settings.model == MODEL_POOL)
+    {
+        scheduler_init(settings.nb_workers, settings.batch_size, execute_batch);
+    }
+    else if (settings.model != MODEL_SEQUENTIAL)
+    {
+        executor_threads_init();
+    }
+
+    if ((sockfd = server_connection_init(settings.port)) == -1)
     {
+        log_flush();
         return -1;
     }
 
-    printf("Babble server bound to port %d\n", portno);
+    log_info("Babble server bound to port %d", settings.port);
+
+    /* once the other threads are created, they do not inherit it */
+    placement_pin(PLACE_ACCEPTOR, 0);
 
+    comm_threads = malloc(settings.max_clients * sizeof(pthread_t));
     int client_index = 0;
     while (1)
     {
@@ -310,19 +1113,20 @@ int main(int argc, char *argv[])
         *newsockfd = server_connection_accept(sockfd);
         if (*newsockfd < 0)
         {
-            fprintf(stderr, "Error -- server accept\n");
+            log_error("Error -- server accept");
             continue;
         }
 
         if (pthread_create(&comm_threads[client_index], NULL, communication_thread_routine, newsockfd) != 0)
         {
-            fprintf(stderr, "Error -- unable to create communication thread\n");
+            log_error("Error -- unable to create communication thread");
             close(*newsockfd);
             continue;
         }
-        client_index = (client_index + 1) % MAX_CLIENT;
+        client_index = (client_index + 1) % settings.max_clients;
     }
 
     close(sockfd);
+    log_flush();
     return 0;
 }
@@ -6,6 +6,22 @@
 #include "babble_types.h"
 #include "babble_server_answer.h"
 
+/* concurrency models of the server (the model setting):
+ *  - sharded:    executors with their own buffers, the commands of a
+ *                client always go to the same one (stage 3)
+ *  - pool:       work-stealing pool of workers draining per-client
+ *                mailboxes
+ *  - single:     a single executor and buffer (stage 1)
+ *  - sequential: no executor, the communication threads run the
+ *                commands themselves, one at a time (stage 0) */
+typedef enum{
+    MODEL_SHARDED = 0,
+    MODEL_POOL,
+    MODEL_SINGLE,
+    MODEL_SEQUENTIAL,
+    NB_MODELS
+} server_model_t;
+
 /* server starting date */
 extern time_t server_start;
 
@@ -16,14 +32,21 @@ int server_connection_accept(int sock);
 
 /* new object */
 command_t *new_command(unsigned long key);
+void free_command(command_t *cmd);
 
 /* operations */
 int run_login_command(command_t *cmd, answer_t **answer);
 int run_publish_command(command_t *cmd, answer_t **answer);
+int run_publish_batch(command_t **cmds, int nb, answer_t **answers);
 int run_follow_command(command_t *cmd, answer_t **answer);
 int run_timeline_command(command_t *cmd, answer_t **answer);
 int run_fcount_command(command_t *cmd, answer_t **answer);
 int run_rdv_command(command_t *cmd, answer_t **answer);
+int run_stats_command(command_t *cmd, answer_t **answer);
+
+/* write the traces to the trace_file setting, returns the nb of spans
+ * written, -1 on error */
+long trace_dump_file(void);
 
 int unregisted_client(command_t *cmd);
 
@@ -33,10 +56,23 @@ void display_command(command_t *cmd, FILE *stream);
 /* error management */
 int notify_parse_error(command_t *cmd, char *input, answer_t **answer);
 
+/* flow control: give credits back to a streaming client (busy tells
+ * that they come from a dropped command) */
+int send_credit_grant(unsigned long key, unsigned int credits, int busy);
+
+/* a command could not be queued because the server is overloaded:
+ * the client gets a BUSY answer, or its credit back with the BUSY flag
+ * for a streamed command */
+int notify_busy(unsigned long key, int answer_expected);
+
 /* high level comm function */
 int write_to_client(unsigned long key, int size, void *buf);
 
-/* get client name from client key */
+/* same as write_to_client() without the size header */
+int write_raw_to_client(unsigned long key, int size, void *buf);
+
+/* get client name from client key -- the name must be released
+ * with pool_free(POOL_NAME, name) */
 char *get_name_from_key(unsigned long key);
 
 #define MAX_COMMANDS 1000
@@ -5,14 +5,63 @@
 
 #include "babble_server_answer.h"
 #include "babble_server.h"
+#include "babble_pool.h"
+#include "babble_memory.h"
+
+/* offset of nb_items in data (after its size header) */
+#define ANSWER_NB_ITEMS_OFFSET sizeof(unsigned long)
+
+/* make room for size more bytes in the answer */
+static void answer_reserve(answer_t *answer, size_t size)
+{
+    if(answer->size + size <= answer->capacity){
+        return;
+    }
+
+    size_t new_capacity = answer->capacity * 2;
+    while(new_capacity < answer->size + size){
+        new_capacity *= 2;
+    }
+
+    if(answer->data == answer->inline_buf){
+        answer->data = mem_alloc(MEM_ANSWERS, new_capacity);
+        memcpy(answer->data, answer->inline_buf, answer->size);
+    }
+    else{
+        answer->data = mem_realloc(MEM_ANSWERS, answer->data, new_capacity);
+    }
+    pool_count_heap_alloc();
+
+    if(answer->data == NULL){
+        perror("answer buffer");
+        abort();
+    }
+    answer->capacity = new_capacity;
+}
+
+/* append a frame (size header + payload) to the answer */
+static void answer_append_frame(answer_t *answer, unsigned long size, void *buf)
+{
+    answer_reserve(answer, sizeof(unsigned long) + size);
+
+    memcpy(answer->data + answer->size, &size, sizeof(unsigned long));
+    memcpy(answer->data + answer->size + sizeof(unsigned long), buf, size);
+    answer->size += sizeof(unsigned long) + size;
+}
 
 answer_t* alloc_answer(unsigned long key)
 {
-    answer_t *a = (answer_t*) malloc(sizeof(answer_t));
+    answer_t *a = (answer_t*) pool_alloc(POOL_ANSWER);
 
     a->key = key;
     a->nb_items = 0;
-    a->first = NULL;
+    a->data = a->inline_buf;
+    a->size = 0;
+    a->capacity = ANSWER_INLINE_SIZE;
+
+    /* the first frame is the number of msgs, it is updated each time
+     * a msg is added */
+    answer_append_frame(a, sizeof(unsigned int), &a->nb_items);
 
     return a;
 }
@@ -24,57 +73,45 @@ void free_answer(answer_t *answer)
         return ;
     }
 
-    int count = 0;
-    answer_msg_t *iter = answer->first, *next=NULL;
-
-    
-    while(iter != NULL){
-        next = iter->next;
-        free(iter->buf);
-        free(iter);
-        iter = next;
-        count++;
+    if(answer->data != answer->inline_buf){
+        mem_free(MEM_ANSWERS, answer->data);
     }
 
-    assert(count == answer->nb_items);
-
-    free(answer);
+    pool_free(POOL_ANSWER, answer);
 }
 
 void add_msg_to_answer(answer_t *answer, size_t buf_size, void *buf)
 {
-    answer_msg_t *iter=NULL;
-    
-    /* the new msg */
-    answer_msg_t *new_msg = malloc(sizeof(answer_msg_t));
-    new_msg->buf = malloc(buf_size);
-    new_msg->size = buf_size;
-    new_msg->next = NULL;
+    answer_append_frame(answer, buf_size, buf);
 
-    memcpy(new_msg->buf, buf, buf_size);
+    answer->nb_items++;
+    memcpy(answer->data + ANSWER_NB_ITEMS_OFFSET, &answer->nb_items, sizeof(unsigned int));
+}
 
-    /* case of first msg */
-    if(answer->first == NULL){
-        answer->first = new_msg;
-    }
-    else{
-        /* get to the last in the list */
-        iter = answer->first;
-        
-        while(iter != NULL){
-            if(iter->next == NULL){
-                break;
-            }
-            iter=iter->next;
-        }
 
-        /* add the new msg to the answer */
-        iter->next = new_msg;
+int send_answers_to_client(answer_t **answers, int nb)
+{
+    answer_t *first = NULL;
+    int i = 0;
+
+    /* the answers are appended to the first one so that a single
+     * write is needed */
+    for(i=0; i<nb; i++){
+        if(answers[i] == NULL){
+            continue;
+        }
+        if(first == NULL){
+            first = answers[i];
+            continue;
+        }
+        assert(answers[i]->key == first->key);
+        answer_reserve(first, answers[i]->size);
+        memcpy(first->data + first->size, answers[i]->data, answers[i]->size);
+        first->size += answers[i]->size;
     }
-    
-    answer->nb_items++;    
-}
 
+    return send_answer_to_client(first);
+}
 
 int send_answer_to_client(answer_t * answer)
 {
@@ -83,23 +120,11 @@ int send_answer_to_client(answer_t * answer)
         return 0;
     }
     
-    /* we send a first message with the size of the answer */
-    if(write_to_client(answer->key, sizeof(unsigned int), &answer->nb_items)){
-        fprintf(stderr,"Error -- could not send message size to client %lu\n", answer->key);
+    /* header and msgs are sent at once */
+    if(write_raw_to_client(answer->key, answer->size, answer->data)){
+        fprintf(stderr,"Error -- could not send answer to client %lu\n", answer->key);
         return -1;
     }
 
-    /* we iterate over the messages and send them on by one */
-    answer_msg_t *iter = answer->first;
-    
-    while(iter != NULL ){
-        if(write_to_client(answer->key, iter->size, iter->buf)){
-
-            fprintf(stderr,"Error -- could not send a msg to client %lu\n", answer->key);
-            return -1;
-        }
-        iter = iter->next;
-    }
-
     return 0;
 }
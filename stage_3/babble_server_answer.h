@@ -1,22 +1,27 @@
 #ifndef __BABBLE_SERVER_ANSWER_H__
 #define __BABBLE_SERVER_ANSWER_H__
 
+#include <stddef.h>
 
-/* an answer msg */
-typedef struct answer_msg{
-    void *buf; /* the data to send */
-    size_t size; /* the size of buf in bytes */
-    struct answer_msg *next; /* Since a request can require multiple msgs
-                          * in the answer (eg, answer to a timeline
-                          * msg), we add the possibility to chain
-                          * answers in a list */
-} answer_msg_t;
-
-/* a answer to one client command; it can include a list of answer_msg */
+#include "babble_config.h"
+
+/* size of the buffer embedded in each answer: enough for a header and
+ * a couple of msgs, bigger answers (eg, timelines) grow on the heap */
+#define ANSWER_INLINE_SIZE (2 * (BABBLE_BUFFER_SIZE + sizeof(unsigned long)) + 2 * sizeof(unsigned long))
+
+/* a answer to one client command; it can include several msgs (eg,
+ * answer to a timeline msg). The answer is built directly in wire
+ * format, as if each piece had been sent with network_send():
+ *     [sizeof(unsigned int)][nb_items]
+ *     [size of msg 1][msg 1] ... [size of msg n][msg n]
+ * so that it can be sent to the client with a single write */
 typedef struct answer{
     unsigned long key; /* key of the target client */
     unsigned int nb_items; /* nb of msgs in the answer */
-    answer_msg_t *first; /* first msg in the answer */
+    char *data; /* the wire-ready bytes */
+    size_t size; /* nb of bytes used in data */
+    size_t capacity; /* nb of bytes allocated for data */
+    char inline_buf[ANSWER_INLINE_SIZE]; /* initial storage of data */
 } answer_t;
 
 answer_t* alloc_answer(unsigned long key);
@@ -27,4 +32,8 @@ void add_msg_to_answer(answer_t *answer, size_t buf_size, void *buf);
  * to send the data to the client */
 int send_answer_to_client(answer_t * answer);
 
+/* send several answers to the same client at once -- NULL entries are
+ * skipped, answers[] are modified but still have to be freed */
+int send_answers_to_client(answer_t **answers, int nb);
+
 #endif /* __BABBLE_SERVER_ANSWER_H__ */
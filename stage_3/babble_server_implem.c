@@ -7,6 +7,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 
 #include "babble_server.h"
@@ -15,15 +16,20 @@
 #include "babble_communication.h"
 #include "babble_registration.h"
 #include "babble_timeline.h"
-
-// Declare external variables from babble_server.c
-extern pthread_mutex_t buffer_mutex;
-extern command_t command_buffer[MAX_COMMANDS];
-extern int buffer_out;
-extern int buffer_count;
+#include "babble_pool.h"
+#include "babble_settings.h"
+#include "babble_stats.h"
+#include "babble_log.h"
+#include "babble_hot_clients.h"
+#include "babble_memory.h"
+#include "babble_trace.h"
 
 time_t server_start;
 
+/* the write mutexes of all clients share one profile */
+static lock_prof_t write_prof = LOCK_PROF_INITIALIZER("client write");
+static lock_prof_t followers_prof = LOCK_PROF_INITIALIZER("followers");
+
 /* freeing client_bundle_t struct */
 static void free_client_data(client_bundle_t *client)
 {
@@ -44,21 +50,19 @@ static void free_client_data(client_bundle_t *client)
 static void generate_cmd_error(command_t *cmd, answer_t **answer)
 {
     answer_t *the_answer = NULL;
-    char *msg_buffer = NULL;
+    char msg_buffer[BABBLE_BUFFER_SIZE];
 
     /* lookup client */
     client_bundle_t *client = registration_lookup(cmd->key);
 
     if (client == NULL)
     {
-        fprintf(stderr, "Error -- no client found\n");
+        log_error("Error -- no client found");
         return;
     }
 
     the_answer = alloc_answer(client->key);
 
-    msg_buffer = malloc(BABBLE_BUFFER_SIZE);
-
     if (cmd->cid == LOGIN || cmd->cid == PUBLISH || cmd->cid == FOLLOW)
     {
         snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: ERROR -> %d { %s } \n", client->client_name, time(NULL) - server_start, cmd->cid, cmd->msg);
@@ -69,7 +73,6 @@ static void generate_cmd_error(command_t *cmd, answer_t **answer)
     }
 
     add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, msg_buffer);
-    free(msg_buffer);
 
     *answer = the_answer;
 }
@@ -97,6 +100,9 @@ void display_command(command_t *cmd, FILE *stream)
     case RDV:
         fprintf(stream, "RDV\n");
         break;
+    case STATS:
+        fprintf(stream, "STATS\n");
+        break;
     default:
         fprintf(stream, "Error -- Unknown command id\n");
         return;
@@ -121,13 +127,13 @@ int server_connection_init(int port)
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0)
     {
-        perror("ERROR opening socket");
+        log_error("ERROR opening socket: %m");
         return -1;
     }
 
     if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (void *)&reuse_opt, sizeof(reuse_opt)) < 0 && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (void *)&reuse_opt, sizeof(reuse_opt)) < 0)
     {
-        perror("setsockopt failed\n");
+        log_error("setsockopt failed: %m");
         close(sockfd);
         return -1;
     }
@@ -139,14 +145,14 @@ int server_connection_init(int port)
 
     if (bind(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
     {
-        perror("ERROR on binding");
+        log_error("ERROR on binding: %m");
         close(sockfd);
         return -1;
     }
 
-    if (listen(sockfd, BABBLE_BACKLOG))
+    if (listen(sockfd, settings.backlog))
     {
-        perror("ERROR on listen");
+        log_error("ERROR on listen: %m");
         close(sockfd);
         return -1;
     }
@@ -166,28 +172,42 @@ int server_connection_accept(int sock)
 
     if (new_sock < 0)
     {
-        perror("ERROR on accept");
+        log_error("ERROR on accept: %m");
         close(sock);
         return -1;
     }
 
+    /* credit grants are small frames the client may be waiting for:
+     * they must not be held back until the previous one is acked */
+    int one = 1;
+    if (setsockopt(new_sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+    {
+        log_error("setsockopt TCP_NODELAY: %m");
+    }
+
     return new_sock;
 }
 
 /* create a new command for client corresponding to key */
 command_t *new_command(unsigned long key)
 {
-    command_t *cmd = malloc(sizeof(command_t));
+    command_t *cmd = pool_alloc(POOL_COMMAND);
     cmd->key = key;
     cmd->answer_expected = 0;
 
     return cmd;
 }
 
+/* give back a command allocated with new_command() */
+void free_command(command_t *cmd)
+{
+    pool_free(POOL_COMMAND, cmd);
+}
+
 int run_login_command(command_t *cmd, answer_t **answer)
 {
     answer_t *the_answer = NULL;
-    char *msg_buffer = NULL;
+    char msg_buffer[BABBLE_BUFFER_SIZE];
 
     struct timespec tt;
     clock_gettime(CLOCK_REALTIME, &tt);
@@ -195,7 +215,10 @@ int run_login_command(command_t *cmd, answer_t **answer)
     /* compute hash of the new client id */
     cmd->key = hash(cmd->msg);
 
-    client_bundle_t *client_data = malloc(sizeof(client_bundle_t));
+    client_bundle_t *client_data = mem_alloc(MEM_REGISTRY, sizeof(client_bundle_t));
+    client_data->followers = mem_alloc(MEM_FOLLOW_GRAPH, settings.max_clients * sizeof(client_bundle_t *));
+    prof_mutex_init(&client_data->write_mutex, &write_prof);
+    prof_mutex_init(&client_data->followers_mutex, &followers_prof);
 
     strncpy(client_data->client_name, cmd->msg, BABBLE_ID_SIZE);
     client_data->sock = cmd->sock;
@@ -206,29 +229,34 @@ int run_login_command(command_t *cmd, answer_t **answer)
     /* we follow ourself */
     client_data->followers[0] = client_data;
     client_data->nb_followers = 1;
+    client_data->nb_active_followers = 1;
+    client_data->following = NULL;
+    client_data->nb_following = 0;
+    client_data->following_size = 0;
 
     if (registration_insert(client_data))
     {
         timeline_free(client_data->timeline);
-        free(client_data);
+        prof_mutex_destroy(&client_data->write_mutex);
+        prof_mutex_destroy(&client_data->followers_mutex);
+        mem_free(MEM_FOLLOW_GRAPH, client_data->followers);
+        mem_free(MEM_REGISTRY, client_data);
         generate_cmd_error(cmd, answer);
         return -1;
     }
 
     client_data->disconnected = 0;
 
-    printf("### New client %s (key = %lu)\n", client_data->client_name, client_data->key);
+    log_info("### New client %s (key = %lu)", client_data->client_name, client_data->key);
 
     /* answer to client */
     assert(cmd->answer_expected);
 
     the_answer = alloc_answer(client_data->key);
-    msg_buffer = malloc(BABBLE_BUFFER_SIZE);
 
-    snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: registered with key %lu\n", client_data->client_name, tt.tv_sec - server_start, client_data->key);
+    snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: registered with key %lu, credits %d\n", client_data->client_name, tt.tv_sec - server_start, client_data->key, settings.credit_window);
 
     add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, msg_buffer);
-    free(msg_buffer);
 
     *answer = the_answer;
 
@@ -237,27 +265,50 @@ int run_login_command(command_t *cmd, answer_t **answer)
 
 int run_publish_command(command_t *cmd, answer_t **answer)
 {
-    time_t date = 0;
-    client_bundle_t *client = registration_lookup(cmd->key);
-    int i = 0;
+    return run_publish_batch(&cmd, 1, answer);
+}
 
-    answer_t *the_answer = NULL;
-    char *msg_buffer = NULL;
+/* all commands are PUBLISH from the same client: the followers are
+ * looked up once and each of them gets all the msgs in a row */
+int run_publish_batch(command_t **cmds, int nb, answer_t **answers)
+{
+    /* the date of each msg is the one of its last insertion, as when
+     * it is published alone, so that the answers do not depend on the
+     * batching */
+    time_t dates[BABBLE_BATCH_MAX] = {0};
+    client_bundle_t *client = registration_lookup(cmds[0]->key);
+    int i = 0, k = 0;
+    unsigned long fanout = 0;
+
+    char msg_buffer[BABBLE_BUFFER_SIZE];
+
+    assert(nb <= BABBLE_BATCH_MAX);
 
     int client_disconnected = 0;
 
     if (client == NULL)
     {
-        fprintf(stderr, "Error -- no client found\n");
-        generate_cmd_error(cmd, answer);
+        log_error("Error -- no client found");
+        for (k = 0; k < nb; k++)
+        {
+            answers[k] = NULL;
+            generate_cmd_error(cmds[k], &answers[k]);
+        }
         return -1;
     }
 
+    /* FOLLOW of other clients may run at the same time on other
+     * executors */
+    prof_mutex_lock(&client->followers_mutex);
     for (i = 0; i < client->nb_followers; i++)
     {
-        if (!client->followers[i]->disconnected)
+        if (!__atomic_load_n(&client->followers[i]->disconnected, __ATOMIC_ACQUIRE))
         {
-            date = timeline_insert(client->followers[i]->timeline, client, cmd->msg);
+            for (k = 0; k < nb; k++)
+            {
+                dates[k] = timeline_insert(client->followers[i]->timeline, client, cmds[k]->msg);
+            }
+            fanout += nb;
         }
         else
         {
@@ -270,10 +321,10 @@ int run_publish_command(command_t *cmd, answer_t **answer)
     {
         for (i = 0; i < client->nb_followers; i++)
         {
-            if (client->followers[i]->disconnected)
+            if (__atomic_load_n(&client->followers[i]->disconnected, __ATOMIC_ACQUIRE))
             {
                 /* remove the client from the set of followers */
-                printf("### Client %s removed disconnected client %s from its list of followers\n", client->client_name, client->followers[i]->client_name);
+                log_info("### Client %s removed disconnected client %s from its list of followers", client->client_name, client->followers[i]->client_name);
                 client->followers[i] = client->followers[client->nb_followers - 1];
                 client->nb_followers--;
                 /* decrease the index to go through the follower we moved
@@ -282,21 +333,24 @@ int run_publish_command(command_t *cmd, answer_t **answer)
             }
         }
     }
+    prof_mutex_unlock(&client->followers_mutex);
 
-    // printf("### Client %s published { %s } at date %ld\n", client->client_name, cmd->msg, date);
+    hot_clients_record(client->key, 0, fanout, 0, 0);
 
-    if (cmd->answer_expected)
+    for (k = 0; k < nb; k++)
     {
-        the_answer = alloc_answer(client->key);
-        msg_buffer = malloc(BABBLE_BUFFER_SIZE);
+        answers[k] = NULL;
+        log_debug("### Client %s published { %s } at date %ld", client->client_name, cmds[k]->msg, dates[k]);
 
-        snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: { %s }\n", client->client_name, date, cmd->msg);
+        if (cmds[k]->answer_expected)
+        {
+            answers[k] = alloc_answer(client->key);
 
-        add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, msg_buffer);
-        free(msg_buffer);
-    }
+            snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: { %s }\n", client->client_name, dates[k], cmds[k]->msg);
 
-    *answer = the_answer;
+            add_msg_to_answer(answers[k], BABBLE_BUFFER_SIZE, msg_buffer);
+        }
+    }
 
     return 0;
 }
@@ -304,13 +358,13 @@ int run_publish_command(command_t *cmd, answer_t **answer)
 int run_follow_command(command_t *cmd, answer_t **answer)
 {
     answer_t *the_answer = NULL;
-    char *msg_buffer = NULL;
+    char msg_buffer[BABBLE_BUFFER_SIZE];
 
     client_bundle_t *client = registration_lookup(cmd->key);
 
     if (client == NULL)
     {
-        fprintf(stderr, "Error -- no client found\n");
+        log_error("Error -- no client found");
         generate_cmd_error(cmd, answer);
         return -1;
     }
@@ -327,8 +381,10 @@ int run_follow_command(command_t *cmd, answer_t **answer)
         return 0;
     }
 
-    /* if client is not already followed, add it */
-    int i = 0;
+    /* if client is not already followed, add it -- the executor of
+     * f_client may be publishing meanwhile */
+    int i = 0, added = 0;
+    prof_mutex_lock(&f_client->followers_mutex);
     for (i = 0; i < f_client->nb_followers; i++)
     {
         if (f_client->followers[i]->key == client->key)
@@ -341,10 +397,25 @@ int run_follow_command(command_t *cmd, answer_t **answer)
     {
         f_client->followers[i] = client;
         f_client->nb_followers++;
+        __atomic_add_fetch(&f_client->nb_active_followers, 1, __ATOMIC_RELAXED);
+        added = 1;
+    }
+    prof_mutex_unlock(&f_client->followers_mutex);
+
+    if (added)
+    {
+        /* remembered to leave the count of f_client at UNREGISTER */
+        if (client->nb_following == client->following_size)
+        {
+            client->following_size = client->following_size ? 2 * client->following_size : 4;
+            client->following = mem_realloc(MEM_FOLLOW_GRAPH, client->following,
+                                            client->following_size * sizeof(client_bundle_t *));
+        }
+        client->following[client->nb_following++] = f_client;
     }
     else
     {
-        printf("Warning: %s already follows %s\n", client->client_name, f_client->client_name);
+        log_warn("Warning: %s already follows %s", client->client_name, f_client->client_name);
     }
 
     /* generate answer to client */
@@ -353,13 +424,9 @@ int run_follow_command(command_t *cmd, answer_t **answer)
 
         the_answer = alloc_answer(client->key);
 
-        msg_buffer = malloc(BABBLE_BUFFER_SIZE);
-
         snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: follow %s\n", client->client_name, time(NULL) - server_start, f_client->client_name);
 
         add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, msg_buffer);
-
-        free(msg_buffer);
     }
 
     *answer = the_answer;
@@ -374,7 +441,7 @@ int run_timeline_command(command_t *cmd, answer_t **answer)
 
     if (client == NULL)
     {
-        fprintf(stderr, "Error -- no client found\n");
+        log_error("Error -- no client found");
         generate_cmd_error(cmd, answer);
         return -1;
     }
@@ -387,29 +454,30 @@ int run_timeline_command(command_t *cmd, answer_t **answer)
 int run_fcount_command(command_t *cmd, answer_t **answer)
 {
     answer_t *the_answer = NULL;
-    char *msg_buffer = NULL;
+    char msg_buffer[BABBLE_BUFFER_SIZE];
 
     /* lookup client */
     client_bundle_t *client = registration_lookup(cmd->key);
 
     if (client == NULL)
     {
-        fprintf(stderr, "Error -- no client found\n");
+        log_error("Error -- no client found");
         generate_cmd_error(cmd, answer);
         return -1;
     }
 
+    /* may run inline, while other executors add followers: the count
+     * is the only thing read. The followers that disconnected are not
+     * counted, even before the next PUBLISH removes them */
+    unsigned int nb_followers = __atomic_load_n(&client->nb_active_followers, __ATOMIC_RELAXED);
+
     /* generate answer to client */
     the_answer = alloc_answer(client->key);
 
-    msg_buffer = malloc(BABBLE_BUFFER_SIZE);
-
-    snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: has %d followers\n", client->client_name, time(NULL) - server_start, client->nb_followers);
+    snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: has %u followers\n", client->client_name, time(NULL) - server_start, nb_followers);
 
     add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, msg_buffer);
 
-    free(msg_buffer);
-
     *answer = the_answer;
 
     return 0;
@@ -418,14 +486,14 @@ int run_fcount_command(command_t *cmd, answer_t **answer)
 int run_rdv_command(command_t *cmd, answer_t **answer)
 {
     answer_t *the_answer = NULL;
-    char *msg_buffer = NULL;
+    char msg_buffer[BABBLE_BUFFER_SIZE];
 
     /* lookup client */
     client_bundle_t *client = registration_lookup(cmd->key);
 
     if (client == NULL)
     {
-        fprintf(stderr, "Error -- no client found\n");
+        log_error("Error -- no client found");
         generate_cmd_error(cmd, answer);
         return -1;
     }
@@ -433,13 +501,110 @@ int run_rdv_command(command_t *cmd, answer_t **answer)
     /* generate answer to client */
     the_answer = alloc_answer(client->key);
 
-    msg_buffer = malloc(BABBLE_BUFFER_SIZE);
-
     snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: rdv_ack\n", client->client_name, time(NULL) - server_start);
 
     add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, msg_buffer);
 
-    free(msg_buffer);
+    *answer = the_answer;
+
+    return 0;
+}
+
+/* the dumps on SIGUSR2 and by STATS would write the same file */
+static pthread_mutex_t trace_file_lock = PTHREAD_MUTEX_INITIALIZER;
+
+long trace_dump_file(void)
+{
+    const char *path = settings.trace_file ? settings.trace_file : BABBLE_TRACE_FILE;
+    long nb;
+
+    pthread_mutex_lock(&trace_file_lock);
+    nb = trace_dump(path);
+    pthread_mutex_unlock(&trace_file_lock);
+
+    if (nb < 0)
+    {
+        log_error("Error -- unable to write the traces to %s", path);
+        return -1;
+    }
+    log_info("### %ld trace spans written to %s", nb, path);
+
+    return nb;
+}
+
+int run_stats_command(command_t *cmd, answer_t **answer)
+{
+    answer_t *the_answer = NULL;
+    char msg_buffer[BABBLE_BUFFER_SIZE];
+
+    /* lookup client */
+    client_bundle_t *client = registration_lookup(cmd->key);
+
+    if (client == NULL)
+    {
+        log_error("Error -- no client found");
+        generate_cmd_error(cmd, answer);
+        return -1;
+    }
+
+    if (cmd->msg[0] != '\0' && strcmp(cmd->msg, "trace"))
+    {
+        log_warn("Warning from [%s]-- unknown STATS option %s", client->client_name, cmd->msg);
+        generate_cmd_error(cmd, answer);
+        return -1;
+    }
+
+    /* generate answer to client: one msg per command and phase that
+     * has been measured */
+    the_answer = alloc_answer(client->key);
+
+    /* STATS trace: first a msg telling where the traces went */
+    if (cmd->msg[0] != '\0')
+    {
+        long nb = trace_active() ? trace_dump_file() : -1;
+
+        if (nb >= 0)
+        {
+            snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: %ld trace spans written to %s\n", client->client_name,
+                     time(NULL) - server_start, nb, settings.trace_file ? settings.trace_file : BABBLE_TRACE_FILE);
+        }
+        else
+        {
+            snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: no traces written (%s)\n", client->client_name,
+                     time(NULL) - server_start, trace_active() ? "see the server log" : "tracing disabled");
+        }
+        add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, msg_buffer);
+    }
+
+    for (int cid = LOGIN; cid < NB_COMMAND_IDS; cid++)
+    {
+        for (int phase = STATS_QUEUE; phase < NB_STATS_PHASES; phase++)
+        {
+            if (stats_summary(cid, phase, msg_buffer, BABBLE_BUFFER_SIZE))
+            {
+                add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, msg_buffer);
+            }
+        }
+    }
+
+    /* then one msg per hot client */
+    if (settings.hot_clients)
+    {
+        hot_client_t top[settings.hot_clients];
+        int nb = hot_clients_top(top, settings.hot_clients);
+
+        for (int i = 0; i < nb; i++)
+        {
+            hot_clients_summary(i, &top[i], msg_buffer, BABBLE_BUFFER_SIZE);
+            add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, msg_buffer);
+        }
+    }
+
+    if (the_answer->nb_items == 0)
+    {
+        snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: no stats yet\n", client->client_name, time(NULL) - server_start);
+        add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, msg_buffer);
+    }
 
     *answer = the_answer;
 
@@ -455,21 +620,22 @@ int unregisted_client(command_t *cmd)
 
     if (client != NULL)
     {
-        printf("### Unregister client %s (key = %lu)\n", client->client_name, client->key);
+        log_info("### Unregister client %s (key = %lu)", client->client_name, client->key);
         close(client->sock);
-        client->disconnected = 1;
 
-        /* Mark commands for this client as invalid */
-        pthread_mutex_lock(&buffer_mutex);
-        for (int i = 0; i < buffer_count; i++)
+        /* the clients it follows stop counting it at once, it is
+         * removed from their followers by their next PUBLISH */
+        if (!__atomic_exchange_n(&client->disconnected, 1, __ATOMIC_ACQ_REL))
         {
-            int index = (buffer_out + i) % MAX_COMMANDS;
-            if (command_buffer[index].key == client->key)
+            for (unsigned int i = 0; i < client->nb_following; i++)
             {
-                command_buffer[index].cid = -1; // Mark as invalid
+                __atomic_sub_fetch(&client->following[i]->nb_active_followers, 1, __ATOMIC_RELAXED);
             }
         }
-        pthread_mutex_unlock(&buffer_mutex);
+        mem_free(MEM_FOLLOW_GRAPH, client->following);
+        client->following = NULL;
+        client->nb_following = 0;
+        client->following_size = 0;
 
         free_client_data(client);
     }
@@ -481,14 +647,14 @@ int unregisted_client(command_t *cmd)
 int notify_parse_error(command_t *cmd, char *input, answer_t **answer)
 {
     answer_t *the_answer = NULL;
-    char *msg_buffer = NULL;
+    char msg_buffer[BABBLE_BUFFER_SIZE];
 
     /* lookup client */
     client_bundle_t *client = registration_lookup(cmd->key);
 
     if (client == NULL)
     {
-        fprintf(stderr, "Error -- no client found\n");
+        log_error("Error -- no client found");
         return -1;
     }
 
@@ -496,13 +662,9 @@ int notify_parse_error(command_t *cmd, char *input, answer_t **answer)
     {
         the_answer = alloc_answer(client->key);
 
-        msg_buffer = malloc(BABBLE_BUFFER_SIZE);
-
         snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: ERROR -> %s\n", client->client_name, time(NULL) - server_start, input);
 
         add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, msg_buffer);
-
-        free(msg_buffer);
     }
 
     *answer = the_answer;
@@ -510,6 +672,48 @@ int notify_parse_error(command_t *cmd, char *input, answer_t **answer)
     return 0;
 }
 
+int send_credit_grant(unsigned long key, unsigned int credits, int busy)
+{
+    /* a header frame not followed by any message */
+    char frame[sizeof(unsigned long) + sizeof(unsigned int)];
+    unsigned long size = sizeof(unsigned int);
+    unsigned int value = BABBLE_CREDIT_GRANT | (busy ? BABBLE_CREDIT_BUSY : 0) | (credits & BABBLE_CREDIT_MASK);
+
+    memcpy(frame, &size, sizeof(unsigned long));
+    memcpy(frame + sizeof(unsigned long), &value, sizeof(unsigned int));
+
+    return write_raw_to_client(key, sizeof(frame), frame);
+}
+
+int notify_busy(unsigned long key, int answer_expected)
+{
+    answer_t *the_answer;
+    char msg_buffer[BABBLE_BUFFER_SIZE];
+    int res;
+
+    if (!answer_expected)
+    {
+        return send_credit_grant(key, 1, 1);
+    }
+
+    client_bundle_t *client = registration_lookup(key);
+
+    if (client == NULL)
+    {
+        log_error("Error -- no client found");
+        return -1;
+    }
+
+    the_answer = alloc_answer(key);
+    snprintf(msg_buffer, BABBLE_BUFFER_SIZE, "%s[%ld]: BUSY\n", client->client_name, time(NULL) - server_start);
+    add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, msg_buffer);
+
+    res = send_answer_to_client(the_answer);
+    free_answer(the_answer);
+
+    return res;
+}
+
 /* send buf to client identified by key */
 int write_to_client(unsigned long key, int size, void *buf)
 {
@@ -517,24 +721,52 @@ int write_to_client(unsigned long key, int size, void *buf)
 
     if (client == NULL)
     {
-        fprintf(stderr, "Error -- writing to non existing client %lu\n", key);
+        log_error("Error -- writing to non existing client %lu", key);
         return -1;
     }
 
+    prof_mutex_lock(&client->write_mutex);
     int write_size = network_send(client->sock, size, buf);
+    prof_mutex_unlock(&client->write_mutex);
+
+    if (write_size < 0)
+    {
+        log_error("writing to socket: %m");
+        return -1;
+    }
+    hot_clients_record(key, 0, 0, write_size, 0);
+
+    return 0;
+}
+
+/* send buf, already formatted, to client identified by key */
+int write_raw_to_client(unsigned long key, int size, void *buf)
+{
+    client_bundle_t *client = registration_lookup(key);
+
+    if (client == NULL)
+    {
+        log_error("Error -- writing to non existing client %lu", key);
+        return -1;
+    }
+
+    prof_mutex_lock(&client->write_mutex);
+    int write_size = network_send_raw(client->sock, size, buf);
+    prof_mutex_unlock(&client->write_mutex);
 
     if (write_size < 0)
     {
-        perror("writing to socket");
+        log_error("writing to socket: %m");
         return -1;
     }
+    hot_clients_record(key, 0, 0, write_size, 0);
 
     return 0;
 }
 
 char *get_name_from_key(unsigned long key)
 {
-    char *name = (char *)malloc(BABBLE_ID_SIZE);
+    char *name = (char *)pool_alloc(POOL_NAME);
     memset(name, 0, BABBLE_ID_SIZE);
 
     client_bundle_t *client = registration_lookup(key);
@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "babble_settings.h"
+#include "babble_config.h"
+#include "babble_server.h"
+#include "babble_latency.h"
+#include "babble_log.h"
+#include "babble_hot_clients.h"
+
+babble_settings_t settings;
+
+typedef struct setting{
+    const char *name;
+    int *value;
+    int def;                /* default value */
+    int min, max;
+    const char **names;     /* names of the values, NULL for numbers */
+    const char *help;
+    const char *origin;     /* where the value comes from */
+    const char **str;       /* string settings: value, instead of
+                             * value/def/min/max/names */
+    int (*check)(const char *str);  /* validation of the string */
+} setting_t;
+
+static const char *lane_policy_names[] = {"strict", "weighted", NULL};
+static const char *bool_names[] = {"off", "on", NULL};
+static const char *model_names[] = {"sharded", "pool", "single", "sequential", NULL};
+static const char *log_level_names[] = {"error", "warn", "info", "debug", NULL};
+static const char *hot_metric_names[] = {"commands", "fanout", "bytes", "cpu", NULL};
+
+static int path_check(const char *str)
+{
+    return *str == '\0';
+}
+
+static setting_t settings_table[] = {
+    {"port", &settings.port, BABBLE_PORT, 1, 65535, NULL, "port of the server"},
+    {"executors", &settings.nb_executors, BABBLE_PRODCONS_NB, 0, 1024, NULL, "executors with their own buffers (0: half the cores)"},
+    {"workers", &settings.nb_workers, BABBLE_EXECUTOR_THREADS, 0, 1024, NULL, "workers of the work-stealing pool (0: half the cores)"},
+    {"buffer_size", &settings.buffer_size, MAX_COMMANDS, 1, 1 << 20, NULL, "commands in the buffer of an executor"},
+    {"timeline_max", &settings.timeline_max, BABBLE_TIMELINE_MAX, 1, 1 << 16, NULL, "publications kept per timeline"},
+    {"max_clients", &settings.max_clients, MAX_CLIENT, 1, 1 << 20, NULL, "max nb of registered clients"},
+    {"backlog", &settings.backlog, BABBLE_BACKLOG, 1, 65535, NULL, "backlog of the listening socket"},
+    {"batch_size", &settings.batch_size, BABBLE_BATCH_SIZE, 1, BABBLE_BATCH_MAX, NULL, "commands executed per buffer acquisition"},
+    {"lane_policy", &settings.lane_policy, 0, 0, 1, lane_policy_names, "scheduling of the priority lanes"},
+    {"random_delay", &settings.random_delay, 0, 0, 1, bool_names, "random delays in the processing of commands"},
+    {"model", &settings.model, MODEL_SHARDED, 0, NB_MODELS - 1, model_names, "concurrency model of the server"},
+    {"inline_reads", &settings.inline_reads, 0, 0, 1, bool_names, "read-only commands run by the communication threads"},
+    {"credit_window", &settings.credit_window, BABBLE_CREDIT_WINDOW, 0, BABBLE_CREDIT_MASK, NULL, "streamed commands in flight per client (0: no flow control)"},
+    {"delay_seed", &settings.delay_seed, BABBLE_DELAY_SEED, 0, 1 << 30, NULL, "seed of the delays (0: from the clock)"},
+    {"log_level", &settings.log_level, LOG_INFO, 0, NB_LOG_LEVELS - 1, log_level_names, "messages logged (debug logs every command)"},
+    {"trace_sample", &settings.trace_sample, BABBLE_TRACE_SAMPLE, 0, 1 << 30, NULL, "one command in trace_sample is traced (0: no tracing)"},
+    {"trace_file", NULL, 0, 0, 0, NULL, "file the traces are written to on SIGUSR2 and by STATS trace (" BABBLE_TRACE_FILE " if not set)", NULL, &settings.trace_file, path_check},
+    {"lock_profiling", &settings.lock_profiling, 0, 0, 1, bool_names, "contention profiling of the locks (SIGUSR1 report)"},
+    {"hot_clients", &settings.hot_clients, BABBLE_HOT_CLIENTS, 0, 256, NULL, "clients with the highest cost reported (0: no accounting)"},
+    {"hot_metric", &settings.hot_metric, HOT_CPU, 0, NB_HOT_METRICS - 1, hot_metric_names, "cost the hot clients are ranked by"},
+    {"mem_report", &settings.mem_report, BABBLE_MEM_REPORT, 0, 86400, NULL, "period of the memory report in seconds (0: on SIGUSR1 only)"},
+    {"delay_publish", NULL, 0, 0, 0, NULL, "delay profile of PUBLISH", NULL, &settings.delay_publish, latency_spec_check},
+    {"delay_follow", NULL, 0, 0, 0, NULL, "delay profile of FOLLOW", NULL, &settings.delay_follow, latency_spec_check},
+    {"delay_timeline", NULL, 0, 0, 0, NULL, "delay profile of TIMELINE", NULL, &settings.delay_timeline, latency_spec_check},
+    {"delay_follow_count", NULL, 0, 0, 0, NULL, "delay profile of FOLLOW_COUNT", NULL, &settings.delay_follow_count, latency_spec_check},
+    {"delay_rdv", NULL, 0, 0, 0, NULL, "delay profile of RDV", NULL, &settings.delay_rdv, latency_spec_check},
+};
+
+#define NB_SETTINGS (int)(sizeof(settings_table) / sizeof(setting_t))
+
+/* command line settings, applied after the config file */
+typedef struct override{
+    setting_t *setting;
+    char *value;
+    struct override *next;
+} override_t;
+
+static override_t *overrides, *last_override;
+
+static int nb_cores;
+
+static setting_t *setting_lookup(const char *name)
+{
+    for (int i = 0; i < NB_SETTINGS; i++)
+    {
+        if (!strcmp(settings_table[i].name, name))
+        {
+            return &settings_table[i];
+        }
+    }
+    return NULL;
+}
+
+static int setting_set(setting_t *s, const char *value, const char *origin)
+{
+    char *end;
+    long v;
+
+    if (s->str)
+    {
+        if (s->check(value))
+        {
+            fprintf(stderr, "Error -- invalid value %s for %s\n", value, s->name);
+            return -1;
+        }
+        *s->str = strdup(value);
+        s->origin = origin;
+        return 0;
+    }
+
+    if (s->names)
+    {
+        for (v = 0; s->names[v] != NULL; v++)
+        {
+            if (!strcmp(s->names[v], value))
+            {
+                break;
+            }
+        }
+        if (s->names[v] == NULL)
+        {
+            v = strtol(value, &end, 10);
+            if (end == value || *end != '\0')
+            {
+                fprintf(stderr, "Error -- invalid value %s for %s\n", value, s->name);
+                return -1;
+            }
+        }
+    }
+    else
+    {
+        v = strtol(value, &end, 10);
+        if (end == value || *end != '\0')
+        {
+            fprintf(stderr, "Error -- invalid value %s for %s\n", value, s->name);
+            return -1;
+        }
+    }
+
+    if (v < s->min || v > s->max)
+    {
+        fprintf(stderr, "Error -- %s must be between %d and %d\n", s->name, s->min, s->max);
+        return -1;
+    }
+
+    *s->value = v;
+    s->origin = origin;
+    return 0;
+}
+
+int settings_override(const char *name, const char *value)
+{
+    setting_t *s = setting_lookup(name);
+    override_t *o;
+
+    if (s == NULL)
+    {
+        fprintf(stderr, "Error -- unknown setting %s\n", name);
+        return -1;
+    }
+
+    o = malloc(sizeof(override_t));
+    o->setting = s;
+    o->value = strdup(value);
+    o->next = NULL;
+    if (last_override)
+    {
+        last_override->next = o;
+    }
+    else
+    {
+        overrides = o;
+    }
+    last_override = o;
+
+    return 0;
+}
+
+int settings_override_str(const char *str)
+{
+    char name[BABBLE_BUFFER_SIZE];
+    const char *eq = strchr(str, '=');
+
+    if (eq == NULL || eq - str >= BABBLE_BUFFER_SIZE)
+    {
+        fprintf(stderr, "Error -- expected name=value, got %s\n", str);
+        return -1;
+    }
+    memcpy(name, str, eq - str);
+    name[eq - str] = '\0';
+
+    return settings_override(name, eq + 1);
+}
+
+/* remove the spaces at both ends */
+static char *str_trim(char *str)
+{
+    char *end;
+
+    while (isspace((unsigned char)*str))
+    {
+        str++;
+    }
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1]))
+    {
+        end--;
+    }
+    *end = '\0';
+
+    return str;
+}
+
+static int settings_read_file(const char *path)
+{
+    char line[BABBLE_BUFFER_SIZE];
+    int line_nb = 0;
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        char *comment = strchr(line, '#'), *eq, *name;
+        setting_t *s;
+
+        line_nb++;
+        if (comment)
+        {
+            *comment = '\0';
+        }
+        if (*str_trim(line) == '\0')
+        {
+            continue;
+        }
+
+        if ((eq = strchr(line, '=')) == NULL)
+        {
+            fprintf(stderr, "Error -- %s:%d: expected name = value\n", path, line_nb);
+            fclose(f);
+            return -1;
+        }
+        *eq = '\0';
+        name = str_trim(line);
+
+        if ((s = setting_lookup(name)) == NULL)
+        {
+            fprintf(stderr, "Error -- %s:%d: unknown setting %s\n", path, line_nb, name);
+            fclose(f);
+            return -1;
+        }
+        if (setting_set(s, str_trim(eq + 1), path))
+        {
+            fprintf(stderr, "Error -- in %s:%d\n", path, line_nb);
+            fclose(f);
+            return -1;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+int settings_load(const char *config_file)
+{
+    for (int i = 0; i < NB_SETTINGS; i++)
+    {
+        if (settings_table[i].str)
+        {
+            *settings_table[i].str = NULL;
+        }
+        else
+        {
+            *settings_table[i].value = settings_table[i].def;
+        }
+        settings_table[i].origin = "default";
+    }
+
+    if (config_file && settings_read_file(config_file))
+    {
+        return -1;
+    }
+
+    for (override_t *o = overrides; o != NULL; o = o->next)
+    {
+        if (setting_set(o->setting, o->value, "command line"))
+        {
+            return -1;
+        }
+    }
+
+    /* derived from the nb of cores: leave the other half to the
+     * communication threads */
+    nb_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (settings.nb_executors == 0)
+    {
+        settings.nb_executors = nb_cores / 2 > 0 ? nb_cores / 2 : 1;
+        setting_lookup("executors")->origin = "cores";
+    }
+    if (settings.nb_workers == 0)
+    {
+        settings.nb_workers = nb_cores / 2 > 0 ? nb_cores / 2 : 1;
+        setting_lookup("workers")->origin = "cores";
+    }
+    if (settings.model == MODEL_SINGLE)
+    {
+        settings.nb_executors = 1;
+        setting_lookup("executors")->origin = "model";
+    }
+
+    return 0;
+}
+
+void settings_display(FILE *stream)
+{
+    fprintf(stream, "### babble server configuration (%d cores)\n", nb_cores);
+    for (int i = 0; i < NB_SETTINGS; i++)
+    {
+        setting_t *s = &settings_table[i];
+
+        if (s->str)
+        {
+            fprintf(stream, "    %-18s %10s   (%s)\n", s->name, *s->str ? *s->str : "-", s->origin);
+        }
+        else if (s->names)
+        {
+            fprintf(stream, "    %-18s %10s   (%s)\n", s->name, s->names[*s->value], s->origin);
+        }
+        else
+        {
+            fprintf(stream, "    %-18s %10d   (%s)\n", s->name, *s->value, s->origin);
+        }
+    }
+}
+
+void settings_help(FILE *stream)
+{
+    fprintf(stream, "\t settings (-o name=value, or name = value in the config file):\n");
+    for (int i = 0; i < NB_SETTINGS; i++)
+    {
+        setting_t *s = &settings_table[i];
+
+        if (s->str)
+        {
+            fprintf(stream, "\t   %-18s %s (none by default)\n", s->name, s->help);
+        }
+        else if (s->names)
+        {
+            fprintf(stream, "\t   %-18s %s (%s", s->name, s->help, s->names[0]);
+            for (int v = 1; s->names[v] != NULL; v++)
+            {
+                fprintf(stream, "|%s", s->names[v]);
+            }
+            fprintf(stream, ", default %s)\n", s->names[s->def]);
+        }
+        else
+        {
+            fprintf(stream, "\t   %-18s %s (default %d)\n", s->name, s->help, s->def);
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef __BABBLE_SETTINGS_H__
+#define __BABBLE_SETTINGS_H__
+
+#include <stdio.h>
+
+/**** Runtime configuration of the server ****/
+
+/* the settings start from the defaults of babble_config.h, then are
+ * read from a config file (-f), then from the command line (-o
+ * name=value, or the short options of the server), in this order.
+ * The config file has one "name = value" per line, '#' starts a
+ * comment. Settings left to 0 in babble_config.h (nb of executors and
+ * workers) are derived from the number of cores, the single model
+ * has one executor. Most settings are
+ * numbers (or names of values), the delay profiles are strings checked
+ * when they are set. */
+
+typedef struct babble_settings{
+    int port;
+    int nb_executors;   /* executors with their own buffers */
+    int nb_workers;     /* workers of the work-stealing pool */
+    int buffer_size;    /* slots of the normal lane of an executor */
+    int timeline_max;   /* publications kept per timeline */
+    int max_clients;
+    int backlog;        /* of the listening socket */
+    int batch_size;     /* commands executed per buffer acquisition */
+    int lane_policy;    /* lane_policy_t */
+    int random_delay;
+    int model;          /* server_model_t */
+    int inline_reads;
+    int credit_window;  /* streamed commands in flight per client, 0
+                         * for no flow control */
+    int delay_seed;     /* of the delays, 0 to take it from the clock */
+    int log_level;      /* log_level_t */
+    int trace_sample;   /* one command in trace_sample is traced, 0
+                         * for no tracing */
+    const char *trace_file;     /* NULL for BABBLE_TRACE_FILE */
+    int lock_profiling; /* contention of the locks in the SIGUSR1 report */
+    int hot_clients;    /* clients with the highest cost reported, 0
+                         * for no accounting */
+    int hot_metric;     /* hot_metric_t: cost they are ranked by */
+    int mem_report;     /* period of the memory report, in seconds, 0
+                         * for SIGUSR1 only */
+    /* delay profiles of the commands (see babble_latency.h), NULL if
+     * not set */
+    const char *delay_publish;
+    const char *delay_follow;
+    const char *delay_timeline;
+    const char *delay_follow_count;
+    const char *delay_rdv;
+} babble_settings_t;
+
+extern babble_settings_t settings;
+
+/* record a setting given on the command line, applied by
+ * settings_load() -- returns -1 if the setting does not exist */
+int settings_override(const char *name, const char *value);
+
+/* same with "name=value" */
+int settings_override_str(const char *str);
+
+/* compute the settings from the defaults, the config file (may be
+ * NULL) and the overrides -- returns -1 if a value is invalid */
+int settings_load(const char *config_file);
+
+/* startup banner with all the settings and where they come from */
+void settings_display(FILE *stream);
+
+/* list the settings, for the help of the server */
+void settings_help(FILE *stream);
+
+#endif
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "babble_spin.h"
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* 0 if spinning is pointless (single cpu), read once */
+static int spin_enabled = -1;
+
+void spin_wait_init(spin_wait_t *sw)
+{
+    if (spin_enabled == -1)
+    {
+        spin_enabled = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+    }
+
+    sw->budget = spin_enabled ? SPIN_BUDGET_MIN : 0;
+    sw->nb_spin = 0;
+    sw->nb_park = 0;
+}
+
+int spin_wait(spin_wait_t *sw, int (*ready)(void *arg), void *arg)
+{
+    /* the budget is shared by the waiters of the site: updates may be
+     * lost, which only makes learning a bit slower */
+    unsigned int budget = __atomic_load_n(&sw->budget, __ATOMIC_RELAXED);
+    unsigned int spins;
+
+    for (spins = 0; spins < budget; spins++)
+    {
+        if (ready(arg))
+        {
+            /* move towards twice what was needed */
+            int target = 2 * spins;
+            if (target < SPIN_BUDGET_MIN)
+            {
+                target = SPIN_BUDGET_MIN;
+            }
+            if (target > SPIN_BUDGET_MAX)
+            {
+                target = SPIN_BUDGET_MAX;
+            }
+            budget += (target - (int)budget) / 4;
+            __atomic_store_n(&sw->budget, budget, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&sw->nb_spin, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+        cpu_relax();
+    }
+
+    /* spinning did not help this time */
+    if (budget > SPIN_BUDGET_MIN)
+    {
+        budget -= budget / 8;
+        __atomic_store_n(&sw->budget, budget > SPIN_BUDGET_MIN ? budget : SPIN_BUDGET_MIN, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&sw->nb_park, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void spin_wait_display(spin_wait_t *sw, const char *name, FILE *stream)
+{
+    unsigned long nb_spin = __atomic_load_n(&sw->nb_spin, __ATOMIC_RELAXED);
+    unsigned long nb_park = __atomic_load_n(&sw->nb_park, __ATOMIC_RELAXED);
+
+    fprintf(stream, "    %-18s %10lu spun %10lu parked (%.1f%% spun), budget %u\n", name, nb_spin, nb_park,
+            nb_spin + nb_park ? 100.0 * nb_spin / (nb_spin + nb_park) : 0.0,
+            __atomic_load_n(&sw->budget, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,35 @@
+#ifndef __BABBLE_SPIN_H__
+#define __BABBLE_SPIN_H__
+
+#include <stdio.h>
+
+/**** Adaptive spin-then-park waiting ****/
+
+/* before parking on a futex or a condition variable, a waiter spins
+ * for a while (with a pause instruction) in case what it waits for
+ * happens within microseconds, which saves the sleep/wake round trip.
+ * The number of spins (budget) is learned per wait site: it moves
+ * towards twice the spins the successful waits needed, and shrinks
+ * when spinning did not help. On a single cpu the waker cannot run
+ * while we spin, so the budget is 0. */
+
+#define SPIN_BUDGET_MIN 16
+#define SPIN_BUDGET_MAX 4096
+
+typedef struct spin_wait{
+    unsigned int budget;    /* current nb of spins before parking */
+    unsigned long nb_spin;  /* waits that ended while spinning */
+    unsigned long nb_park;  /* waits that had to park */
+} spin_wait_t;
+
+void spin_wait_init(spin_wait_t *sw);
+
+/* spin until ready(arg) returns non-zero or the budget is exhausted.
+ * Returns 1 if ready (the caller does not need to park), 0 if the
+ * caller has to park */
+int spin_wait(spin_wait_t *sw, int (*ready)(void *arg), void *arg);
+
+/* display the counters of a wait site */
+void spin_wait_display(spin_wait_t *sw, const char *name, FILE *stream);
+
+#endif
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "babble_stats.h"
+#include "babble_utils.h"
+
+static const char *phase_names[NB_STATS_PHASES] = {"queue", "exec", "send"};
+
+typedef struct stats_set{
+    histogram_t hists[NB_COMMAND_IDS][NB_STATS_PHASES];
+    struct stats_set *next;
+} stats_set_t;
+
+/* the sets of the registered threads (never freed), and the shared
+ * one */
+static stats_set_t *sets;
+static pthread_mutex_t sets_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_set_t shared_set;
+
+static __thread stats_set_t *local_set;
+
+unsigned long stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void stats_thread_register(void)
+{
+    stats_set_t *set;
+
+    if (local_set != NULL)
+    {
+        return;
+    }
+
+    /* calloc: the histograms of the commands a thread never runs are
+     * not touched */
+    if ((set = calloc(1, sizeof(stats_set_t))) == NULL)
+    {
+        perror("stats");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&sets_lock);
+    set->next = sets;
+    sets = set;
+    pthread_mutex_unlock(&sets_lock);
+
+    local_set = set;
+}
+
+void stats_record(int cid, stats_phase_t phase, unsigned long ns)
+{
+    if (local_set != NULL)
+    {
+        hist_record(&local_set->hists[cid][phase], ns);
+    }
+    else
+    {
+        hist_record_atomic(&shared_set.hists[cid][phase], ns);
+    }
+}
+
+void stats_merge(int cid, stats_phase_t phase, histogram_t *out)
+{
+    hist_init(out);
+    hist_merge(out, &shared_set.hists[cid][phase]);
+
+    pthread_mutex_lock(&sets_lock);
+    for (stats_set_t *set = sets; set != NULL; set = set->next)
+    {
+        hist_merge(out, &set->hists[cid][phase]);
+    }
+    pthread_mutex_unlock(&sets_lock);
+}
+
+unsigned long stats_summary(int cid, stats_phase_t phase, char *buf, size_t size)
+{
+    histogram_t *h = malloc(sizeof(histogram_t));
+    unsigned long total;
+
+    stats_merge(cid, phase, h);
+    total = h->total;
+    if (total)
+    {
+        snprintf(buf, size, "%-12s %-5s %10lu cmds  p50 %9.1f  p99 %9.1f  p999 %9.1f  max %9.1f us\n",
+                 command_name(cid), phase_names[phase], total,
+                 hist_percentile(h, 0.5) / 1000.0,
+                 hist_percentile(h, 0.99) / 1000.0,
+                 hist_percentile(h, 0.999) / 1000.0,
+                 h->max / 1000.0);
+    }
+    free(h);
+
+    return total;
+}
+
+void stats_display(FILE *stream)
+{
+    char line[BABBLE_BUFFER_SIZE];
+
+    fprintf(stream, "### command latencies\n");
+    for (int cid = LOGIN; cid < NB_COMMAND_IDS; cid++)
+    {
+        for (int phase = STATS_QUEUE; phase < NB_STATS_PHASES; phase++)
+        {
+            if (stats_summary(cid, phase, line, sizeof(line)))
+            {
+                fprintf(stream, "    %s", line);
+            }
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef __BABBLE_STATS_H__
+#define __BABBLE_STATS_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "babble_types.h"
+#include "babble_histogram.h"
+
+/**** Latency of the commands, per command id ****/
+
+/* three phases are measured for each command:
+ *  - queue: from its commit in a buffer to the start of its batch
+ *  - exec:  running it (including its simulated delay, if any)
+ *  - send:  writing its answer to the client
+ * The executors and workers record into their own histograms
+ * (registered with stats_thread_register()), without synchronization;
+ * the other threads share a set recorded with atomic operations. The
+ * histograms are merged when they are read. */
+
+typedef enum{
+    STATS_QUEUE = 0,
+    STATS_EXEC,
+    STATS_SEND,
+    NB_STATS_PHASES
+} stats_phase_t;
+
+/* monotonic clock, in nano-seconds */
+unsigned long stats_now(void);
+
+/* give the calling thread its own histograms */
+void stats_thread_register(void);
+
+void stats_record(int cid, stats_phase_t phase, unsigned long ns);
+
+/* merge the histograms of all threads for a command and a phase */
+void stats_merge(int cid, stats_phase_t phase, histogram_t *out);
+
+/* one line of summary (count, p50, p99, p999, max in micro-seconds),
+ * returns the nb of values, 0 if nothing was recorded */
+unsigned long stats_summary(int cid, stats_phase_t phase, char *buf, size_t size);
+
+/* display the summary of every command and phase */
+void stats_display(FILE *stream);
+
+#endif
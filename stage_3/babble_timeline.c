@@ -6,10 +6,16 @@
 #include "babble_timeline.h"
 #include "babble_server.h"
 #include "babble_communication.h"
+#include "babble_settings.h"
+#include "babble_memory.h"
+
+static lock_prof_t timeline_prof = LOCK_PROF_INITIALIZER("timelines");
 
 timeline_t* timeline_create(unsigned long client_key)
 {
-    timeline_t* tm= malloc(sizeof(timeline_t));
+    timeline_t* tm= mem_alloc(MEM_TIMELINES, sizeof(timeline_t) + settings.timeline_max * sizeof(publication_t));
+    prof_mutex_init(&tm->lock, &timeline_prof);
+    tm->size = settings.timeline_max;
     tm->youngest = 0;
     tm->count_recent_adds = 0;
     tm->key = client_key;
@@ -19,17 +25,20 @@ timeline_t* timeline_create(unsigned long client_key)
 
 void timeline_free(timeline_t *timeline)
 {
-    free(timeline);
+    prof_mutex_destroy(&timeline->lock);
+    mem_free(MEM_TIMELINES, timeline);
 }
 
 
 time_t timeline_insert(timeline_t *tm, client_bundle_t *publisher, char *msg)
 {
     struct timespec tt;
-    
-    publication_t *pub= &tm->circular_buffer[tm->youngest];
+    time_t date;
     
     clock_gettime(CLOCK_REALTIME, &tt);
+
+    prof_mutex_lock(&tm->lock);
+    publication_t *pub= &tm->circular_buffer[tm->youngest];
     
     memset(pub->msg, 0, BABBLE_PUBLICATION_SIZE);    
     strncpy(pub->msg, msg, BABBLE_PUBLICATION_SIZE);
@@ -38,11 +47,13 @@ time_t timeline_insert(timeline_t *tm, client_bundle_t *publisher, char *msg)
     snprintf(pub->msg, BABBLE_BUFFER_SIZE,"    %s[%ld]: %s\n", publisher->client_name, pub->date, msg);
     
     /* shifting the index */
-    tm->youngest = (tm->youngest + 1) % BABBLE_TIMELINE_MAX;
+    tm->youngest = (tm->youngest + 1) % tm->size;
 
     tm->count_recent_adds++;
+    date = pub->date;
+    prof_mutex_unlock(&tm->lock);
 
-    return pub->date;
+    return date;
 }
 
 void timeline_generate_summary(timeline_t *tm, answer_t **answer)
@@ -51,31 +62,34 @@ void timeline_generate_summary(timeline_t *tm, answer_t **answer)
     unsigned int index_first=0;
 
     the_answer = alloc_answer(tm->key);
+
+    prof_mutex_lock(&tm->lock);
     
     /* the first msg of the answer is the number of publications since
      * the last call to timeline */    
     add_msg_to_answer(the_answer, sizeof(unsigned int), &tm->count_recent_adds);
 
     /* compute the index of the first msg to add to the timeline */
-    if(tm->count_recent_adds >= BABBLE_TIMELINE_MAX){
+    if(tm->count_recent_adds >= tm->size){
         index_first = tm->youngest;
         
         /* deal with the corner case where the buffer is full */
         add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, &tm->circular_buffer[index_first]);
-        index_first = (index_first + 1) % BABBLE_TIMELINE_MAX;
+        index_first = (index_first + 1) % tm->size;
     }
     else{
-        index_first = (BABBLE_TIMELINE_MAX + tm->youngest - tm->count_recent_adds) % BABBLE_TIMELINE_MAX;
+        index_first = (tm->size + tm->youngest - tm->count_recent_adds) % tm->size;
     }
     
     /* add all new msgs in the timeline */
     while(index_first != tm->youngest ){
         add_msg_to_answer(the_answer, BABBLE_BUFFER_SIZE, &tm->circular_buffer[index_first]);
 
-        index_first = (index_first + 1) % BABBLE_TIMELINE_MAX;
+        index_first = (index_first + 1) % tm->size;
     }
 
     tm->count_recent_adds = 0;
+    prof_mutex_unlock(&tm->lock);
     
     *answer = the_answer;
 }
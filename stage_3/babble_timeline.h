@@ -7,6 +7,7 @@
 #include "babble_config.h"
 #include "babble_server_answer.h"
 #include "babble_types.h"
+#include "babble_lock_prof.h"
 
 /* a publication */
 typedef struct publication{
@@ -16,13 +17,18 @@ typedef struct publication{
 
 
 /* the timeline */
-/* it is implemented as a circular buffer of fixed size */
+/* it is implemented as a circular buffer of fixed size
+ * (settings.timeline_max). The publishers of the followed clients
+ * insert into it from their executors, while the executor of the
+ * client reads it: its lock protects all the fields below */
 typedef struct timeline{
-    publication_t circular_buffer[BABBLE_TIMELINE_MAX];
+    prof_mutex_t lock;
     unsigned int youngest; /* index of the most recent message */
     unsigned int count_recent_adds; /* count the numbers of inserts
                                      * since the last summary */
     unsigned long key; /* key of associated client */
+    unsigned int size; /* nb of publications in the buffer */
+    publication_t circular_buffer[];
 }timeline_t;
 
 /* instanciate a new timeline */
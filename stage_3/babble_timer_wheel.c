@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "babble_timer_wheel.h"
+
+/* nb of ticks covered by a slot of the level */
+#define LEVEL_SHIFT(level) (WHEEL_BITS * (level))
+
+void timer_wheel_init(timer_wheel_t *wheel, unsigned long now)
+{
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+    wheel->now = now;
+    wheel->nb_timers = 0;
+    wheel->nb_cascaded = 0;
+}
+
+static void slot_append(timer_slot_t *slot, wheel_timer_t *timer)
+{
+    timer->next = NULL;
+    if (slot->last == NULL)
+    {
+        slot->first = timer;
+    }
+    else
+    {
+        slot->last->next = timer;
+    }
+    slot->last = timer;
+}
+
+/* put the timer in the slot matching its distance from now */
+static void wheel_insert(timer_wheel_t *wheel, wheel_timer_t *timer)
+{
+    unsigned long delta = timer->expires - wheel->now;
+    int level = 0;
+
+    while (level < WHEEL_LEVELS - 1 && delta >= (1UL << LEVEL_SHIFT(level + 1)))
+    {
+        level++;
+    }
+
+    slot_append(&wheel->slots[level][(timer->expires >> LEVEL_SHIFT(level)) & WHEEL_MASK], timer);
+}
+
+void timer_wheel_add(timer_wheel_t *wheel, wheel_timer_t *timer, unsigned long expires)
+{
+    unsigned long max = (1UL << LEVEL_SHIFT(WHEEL_LEVELS)) - 1;
+
+    if (expires < wheel->now)
+    {
+        expires = wheel->now;
+    }
+    if (expires - wheel->now > max)
+    {
+        expires = wheel->now + max;
+    }
+
+    timer->expires = expires;
+    wheel_insert(wheel, timer);
+    wheel->nb_timers++;
+}
+
+/* move the timers of the current slot of the level to the levels
+ * below, keeping their order */
+static void wheel_cascade(timer_wheel_t *wheel, int level)
+{
+    timer_slot_t *slot = &wheel->slots[level][(wheel->now >> LEVEL_SHIFT(level)) & WHEEL_MASK];
+    wheel_timer_t *timer = slot->first, *next;
+
+    slot->first = slot->last = NULL;
+    for (; timer != NULL; timer = next)
+    {
+        next = timer->next;
+        wheel_insert(wheel, timer);
+        wheel->nb_cascaded++;
+    }
+}
+
+wheel_timer_t *timer_wheel_advance(timer_wheel_t *wheel, unsigned long now)
+{
+    timer_slot_t expired = {NULL, NULL};
+
+    while (wheel->now <= now)
+    {
+        if (wheel->nb_timers == 0)
+        {
+            /* nothing to cascade or expire on the way */
+            wheel->now = now + 1;
+            break;
+        }
+
+        if ((wheel->now & WHEEL_MASK) == 0)
+        {
+            /* entering a new slot of the upper levels: cascade the
+             * highest one first, its timers may land in the current
+             * slots of the lower ones */
+            int level = 1;
+            while (level < WHEEL_LEVELS - 1 && ((wheel->now >> LEVEL_SHIFT(level)) & WHEEL_MASK) == 0)
+            {
+                level++;
+            }
+            for (; level > 0; level--)
+            {
+                wheel_cascade(wheel, level);
+            }
+        }
+
+        timer_slot_t *slot = &wheel->slots[0][wheel->now & WHEEL_MASK];
+        if (slot->first != NULL)
+        {
+            for (wheel_timer_t *t = slot->first; t != NULL; t = t->next)
+            {
+                wheel->nb_timers--;
+            }
+            if (expired.last == NULL)
+            {
+                expired.first = slot->first;
+            }
+            else
+            {
+                expired.last->next = slot->first;
+            }
+            expired.last = slot->last;
+            slot->first = slot->last = NULL;
+        }
+
+        wheel->now++;
+    }
+
+    return expired.first;
+}
+
+unsigned long timer_wheel_next_tick(timer_wheel_t *wheel)
+{
+    if (wheel->nb_timers == 0)
+    {
+        return 0;
+    }
+
+    /* first busy slot of level 0 before it wraps around */
+    for (unsigned long tick = wheel->now; ; tick++)
+    {
+        if (wheel->slots[0][tick & WHEEL_MASK].first != NULL)
+        {
+            return tick;
+        }
+        if (((tick + 1) & WHEEL_MASK) == 0)
+        {
+            /* the upper levels are cascaded at the next tick */
+            return tick + 1;
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef __BABBLE_TIMER_WHEEL_H__
+#define __BABBLE_TIMER_WHEEL_H__
+
+/**** Hierarchical timer wheel ****/
+
+/* time is counted in ticks. Level 0 has one slot per tick for the
+ * next WHEEL_SIZE ticks, each higher level has slots WHEEL_SIZE times
+ * coarser. A timer is added in O(1) to the level matching its
+ * distance, and moved down one level (cascaded) when the level below
+ * wraps around, until it reaches level 0 and expires. Timers of a
+ * slot expire in the order they were added.
+ *
+ * The wheel is not thread-safe: it is owned by one thread, or
+ * protected by the lock of its user. */
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+/* to be embedded in the object to wake up */
+typedef struct wheel_timer{
+    struct wheel_timer *next;
+    unsigned long expires;      /* tick */
+} wheel_timer_t;
+
+typedef struct timer_slot{
+    wheel_timer_t *first, *last;
+} timer_slot_t;
+
+typedef struct timer_wheel{
+    timer_slot_t slots[WHEEL_LEVELS][WHEEL_SIZE];
+    unsigned long now;          /* next tick to expire */
+    unsigned long nb_timers;
+    unsigned long nb_cascaded;  /* timers moved down a level */
+} timer_wheel_t;
+
+void timer_wheel_init(timer_wheel_t *wheel, unsigned long now);
+
+/* expires is a tick: timers in the past expire at the next advance,
+ * timers too far away are clamped to the range of the wheel */
+void timer_wheel_add(timer_wheel_t *wheel, wheel_timer_t *timer, unsigned long expires);
+
+/* expire the timers up to tick now (included), returned as a list
+ * linked through next, in expiration order -- NULL if none */
+wheel_timer_t *timer_wheel_advance(timer_wheel_t *wheel, unsigned long now);
+
+/* tick at which timer_wheel_advance() should be called next (a timer
+ * may expire, or a level has to be cascaded), 0 if the wheel is
+ * empty */
+unsigned long timer_wheel_next_tick(timer_wheel_t *wheel);
+
+#endif
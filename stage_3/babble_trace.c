@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "babble_trace.h"
+#include "babble_utils.h"
+
+static const char *stage_names[NB_TRACE_STAGES] = {"recv", "queue", "exec", "send"};
+
+typedef struct trace_ring{
+    trace_span_t spans[TRACE_RING_SIZE];
+    unsigned long head;     /* nb of spans recorded */
+    int tid;
+    int in_use;             /* by a running thread */
+    struct trace_ring *next;
+} trace_ring_t;
+
+/* the rings of the threads that exited are reused by new threads
+ * (the communication threads come and go with the clients), their
+ * spans are kept until then */
+static trace_ring_t *rings;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+
+static __thread trace_ring_t *local_ring;
+static __thread unsigned long nb_seen;
+
+static int sample_rate;
+static unsigned int last_id;
+
+/* called when a thread exits */
+static void trace_ring_release(void *arg)
+{
+    trace_ring_t *ring = arg;
+
+    __atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+}
+
+void trace_init(int sample)
+{
+    sample_rate = sample;
+    pthread_key_create(&ring_key, trace_ring_release);
+}
+
+int trace_active(void)
+{
+    return sample_rate != 0;
+}
+
+unsigned int trace_sample(void)
+{
+    unsigned int id;
+
+    if (sample_rate == 0 || ++nb_seen % sample_rate != 0)
+    {
+        return 0;
+    }
+
+    while ((id = __atomic_add_fetch(&last_id, 1, __ATOMIC_RELAXED)) == 0)
+    {
+    }
+    return id;
+}
+
+/* ring of the calling thread */
+static trace_ring_t *trace_ring_get(void)
+{
+    trace_ring_t *ring;
+
+    pthread_mutex_lock(&rings_lock);
+    for (ring = rings; ring != NULL; ring = ring->next)
+    {
+        if (!__atomic_load_n(&ring->in_use, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+    }
+    if (ring == NULL)
+    {
+        if ((ring = malloc(sizeof(trace_ring_t))) == NULL)
+        {
+            perror("trace");
+            exit(EXIT_FAILURE);
+        }
+        ring->next = rings;
+        rings = ring;
+    }
+    /* under the lock: not being dumped */
+    ring->head = 0;
+    ring->tid = syscall(SYS_gettid);
+    ring->in_use = 1;
+    pthread_mutex_unlock(&rings_lock);
+
+    pthread_setspecific(ring_key, ring);
+    local_ring = ring;
+
+    return ring;
+}
+
+void trace_record(unsigned int id, trace_stage_t stage, int cid, unsigned long key,
+                  unsigned long start, unsigned long end)
+{
+    trace_ring_t *ring = local_ring;
+    trace_span_t *span;
+
+    if (id == 0)
+    {
+        return;
+    }
+    if (ring == NULL)
+    {
+        ring = trace_ring_get();
+    }
+
+    span = &ring->spans[ring->head % TRACE_RING_SIZE];
+    span->start = start;
+    span->end = end;
+    span->key = key;
+    span->id = id;
+    span->stage = stage;
+    span->cid = cid;
+
+    /* publish it to trace_dump() */
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* copy the spans of a ring that cannot have been overwritten while
+ * they were copied, returns their nb */
+static int trace_ring_copy(trace_ring_t *ring, trace_span_t *out)
+{
+    unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    unsigned long first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    unsigned long after;
+    int n = 0;
+
+    for (unsigned long i = first; i < head; i++)
+    {
+        out[i - first] = ring->spans[i % TRACE_RING_SIZE];
+    }
+
+    /* the span being written goes where span head - size was */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    for (unsigned long i = first; i < head; i++)
+    {
+        if (i + TRACE_RING_SIZE > after)
+        {
+            out[n++] = out[i - first];
+        }
+    }
+
+    return n;
+}
+
+long trace_dump(const char *path)
+{
+    trace_span_t *spans = malloc(TRACE_RING_SIZE * sizeof(trace_span_t));
+    FILE *f = fopen(path, "w");
+    int pid = getpid();
+    long total = 0;
+    int n;
+
+    if (f == NULL || spans == NULL)
+    {
+        perror(path);
+        free(spans);
+        if (f)
+        {
+            fclose(f);
+        }
+        return -1;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    pthread_mutex_lock(&rings_lock);
+    for (trace_ring_t *ring = rings; ring != NULL; ring = ring->next)
+    {
+        n = trace_ring_copy(ring, spans);
+        for (int i = 0; i < n; i++)
+        {
+            fprintf(f, "%s{\"name\":\"%s %s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                       "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"id\":%u,\"key\":%lu}}\n",
+                    total ? "," : "", stage_names[spans[i].stage], command_name(spans[i].cid),
+                    stage_names[spans[i].stage], pid, ring->tid,
+                    spans[i].start / 1000.0, (spans[i].end - spans[i].start) / 1000.0,
+                    spans[i].id, spans[i].key);
+            total++;
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+    fprintf(f, "]}\n");
+
+    free(spans);
+    if (fclose(f))
+    {
+        perror(path);
+        return -1;
+    }
+
+    return total;
+}
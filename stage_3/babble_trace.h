@@ -0,0 +1,53 @@
+#ifndef __BABBLE_TRACE_H__
+#define __BABBLE_TRACE_H__
+
+/**** Sampled traces of the commands ****/
+
+/* one command in N (per thread receiving the commands) gets a trace
+ * id. Each stage it goes through is recorded as a span by the thread
+ * running it, in a ring of spans of its own: recording is a few
+ * stores, without synchronization, and the oldest spans are
+ * overwritten. The rings are dumped in the Chrome trace format (to be
+ * opened with chrome://tracing or Perfetto), one track per thread; the
+ * spans of a command share its trace id. */
+
+typedef enum{
+    TRACE_RECV = 0,     /* network_recv() of the command, including
+                         * the wait for the client */
+    TRACE_QUEUE,        /* from its commit in a buffer to the start of
+                         * its batch */
+    TRACE_EXEC,
+    TRACE_SEND,
+    NB_TRACE_STAGES
+} trace_stage_t;
+
+/* spans kept per thread */
+#define TRACE_RING_SIZE 1024
+
+typedef struct trace_span{
+    unsigned long start;    /* monotonic clock, in nano-seconds */
+    unsigned long end;
+    unsigned long key;      /* of the client */
+    unsigned int id;        /* trace id of the command */
+    unsigned char stage;    /* trace_stage_t */
+    unsigned char cid;
+} trace_span_t;
+
+/* trace one command in sample, 0 disables tracing */
+void trace_init(int sample);
+
+/* tells if tracing is enabled */
+int trace_active(void);
+
+/* trace id of a new command, 0 if it is not sampled */
+unsigned int trace_sample(void);
+
+/* record a span of a command, nothing if its trace id is 0 */
+void trace_record(unsigned int id, trace_stage_t stage, int cid, unsigned long key,
+                  unsigned long start, unsigned long end);
+
+/* write the spans of all the threads to path -- returns the nb of
+ * spans written, -1 on error */
+long trace_dump(const char *path);
+
+#endif
@@ -2,11 +2,15 @@
 #define __BABBLE_TYPES_H__
 
 #include <time.h>
+#include <pthread.h>
 
 #include "babble_config.h"
+#include "babble_lock_prof.h"
 
 /* forward declaration, defined in babble_timeline.h */
 struct timeline;
+/* forward declaration, defined in babble_command_lanes.h */
+struct lane_counts;
 
 typedef enum{
     LOGIN =0,
@@ -15,7 +19,9 @@ typedef enum{
     TIMELINE,
     FOLLOW_COUNT,
     RDV,
-    UNREGISTER
+    UNREGISTER,
+    STATS,
+    NB_COMMAND_IDS
 } command_id;
 
 typedef struct command{
@@ -25,6 +31,12 @@ typedef struct command{
     unsigned long key;
     char msg[BABBLE_PUBLICATION_SIZE];
     int answer_expected;   /* answer sent only if set */
+    struct lane_counts *counts; /* pending commands of the client per
+                                 * lane (priority lanes only) */
+    int lane;              /* lane the command was queued in */
+    unsigned long queued_ns;   /* committed in its buffer */
+    unsigned long started_ns;  /* taken by an executor */
+    unsigned int trace_id;     /* 0 if the command is not traced */
 } command_t;
 
 typedef struct client_bundle{
@@ -33,10 +45,25 @@ typedef struct client_bundle{
                                           * client */
     int sock;              /* socket to communicate with this client */
     struct timeline *timeline;   /* timeline of the client */
-    struct client_bundle *followers[MAX_CLIENT];  /* key of the followers */
+    struct client_bundle **followers;  /* the followers (at most
+                                        * settings.max_clients) */
     unsigned int nb_followers;
+    prof_mutex_t followers_mutex;  /* the followers are added by the
+                                    * executors of the followers, and
+                                    * walked and compacted by the one
+                                    * of the client */
+    unsigned int nb_active_followers;  /* the followers not
+                                        * disconnected (atomic) */
+    struct client_bundle **following;  /* the clients followed, used
+                                        * by the commands of the client
+                                        * only */
+    unsigned int nb_following;
+    unsigned int following_size;
     unsigned int disconnected; /* set to 1 when client has
-                                * disconnected */
+                                * disconnected (atomic) */
+    prof_mutex_t write_mutex;    /* answers, credit grants and BUSY
+                                  * notifications come from several
+                                  * threads */
 
 } client_bundle_t;
 
@@ -8,7 +8,6 @@
 #include <unistd.h>
 
 #include "babble_registration.h"
-#include "fastrand.h"
 
 
 /* Warning: delimiter can't be changed for now */
@@ -113,13 +112,14 @@ int str_to_command(char* str, int* ack_req)
         }
         
         
-        if( res < LOGIN || res > RDV){
+        /* UNREGISTER is internal to the server */
+        if( res < LOGIN || res > STATS || res == UNREGISTER){
             //fprintf(stderr,"Error -- invalid request -> %s\n", str);
             free_split_array(items, nb_items);
             return -1;
         }
 
-        if(res == LOGIN || res == TIMELINE || res == FOLLOW_COUNT || res == RDV){
+        if(res == LOGIN || res == TIMELINE || res == FOLLOW_COUNT || res == RDV || res == STATS){
             if(*ack_req == 0){
                 //fprintf(stderr,"Error -- invalid request -> %s\n", str);
                 free_split_array(items, nb_items);
@@ -173,11 +173,46 @@ int str_to_command(char* str, int* ack_req)
         return RDV;
     }
 
+    if(!strcmp(items[cid_index], "STATS")){
+        free_split_array(items, nb_items);
+        if(*ack_req == 0){
+            return -1;
+        }
+        return STATS;
+    }
+
     free_split_array(items, nb_items);
     
     return -1;
 }
 
+const char *command_name(int cid)
+{
+    static const char *names[NB_COMMAND_IDS] = {
+        "LOGIN", "PUBLISH", "FOLLOW", "TIMELINE", "FOLLOW_COUNT", "RDV", "UNREGISTER", "STATS"};
+
+    if(cid < LOGIN || cid >= NB_COMMAND_IDS){
+        return "UNKNOWN";
+    }
+    return names[cid];
+}
+
+int str_has_payload(char* input)
+{
+    int nb_items=0;
+    char **items=split_string(input, &nb_items);
+
+    int p_index=1;
+
+    if(strlen(items[0]) == 1 && items[0][0] == 'S'){
+        p_index=2;
+    }
+
+    free_split_array(items, nb_items);
+
+    return nb_items > p_index;
+}
+
 int str_to_payload(char* input, char* output, int size)
 {
     int nb_items=0;
@@ -238,6 +273,22 @@ unsigned long parse_login_ack(char* ack_msg)
     return key;
 }
 
+int parse_login_credits(char* ack_msg)
+{
+    char* part=strstr(ack_msg, "credits");
+    int credits=-1;
+
+    if(part==NULL){
+        return -1;
+    }
+
+    if(sscanf(part,"credits %d\n", &credits) != 1 || credits == 0){
+        return -1;
+    }
+
+    return credits;
+}
+
 
 int parse_fcount_ack(char* ack)
 {
@@ -255,10 +306,3 @@ int parse_fcount_ack(char* ack)
 
 
 
-void random_delay(int activated)
-{
-    if(activated){
-        usleep(fastRandom32() % MAX_DELAY);
-    }
-}
-
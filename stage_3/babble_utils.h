@@ -10,16 +10,24 @@ void str_clean(char* str);
 /* convert input string to babble command id */
 int str_to_command(char* str, int* ack_req);
 
+/* name of a command id */
+const char *command_name(int cid);
+
 /* copy payload of input into output (copy at most size characters) */
 int str_to_payload(char* input, char* output, int size);
 
+/* tells if input has a payload (for the commands where it is
+ * optional) */
+int str_has_payload(char* input);
+
 /* extract key from login ack */
 unsigned long parse_login_ack(char* ack_msg);
 
+/* extract the credit window from login ack, -1 if the server does no
+ * flow control */
+int parse_login_credits(char* ack_msg);
+
 /* extract nb of followers from follow_count msg */
 int parse_fcount_ack(char* ack);
 
-/* generates a delay of random duration */
-void random_delay(int activated);
-
 #endif
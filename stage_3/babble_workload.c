@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "babble_workload.h"
+#include "babble_types.h"
+#include "fastrand.h"
+
+/* commands of the mix, in the order of the spec */
+static const int mix_commands[WORKLOAD_MIX_SIZE] = {PUBLISH, FOLLOW, TIMELINE, FOLLOW_COUNT};
+
+int workload_mix_parse(const char *spec, workload_mix_t *mix)
+{
+    const char *p = spec;
+    char *end;
+
+    mix->total = 0;
+    for (int i = 0; i < WORKLOAD_MIX_SIZE; i++)
+    {
+        long w = strtol(p, &end, 10);
+
+        if (end == p || w < 0 || (*end != ':' && *end != '\0') ||
+            (*end == '\0' && i != WORKLOAD_MIX_SIZE - 1) || (*end == ':' && i == WORKLOAD_MIX_SIZE - 1))
+        {
+            return -1;
+        }
+        mix->weights[i] = w;
+        mix->total += w;
+        p = end + 1;
+    }
+
+    return mix->total ? 0 : -1;
+}
+
+int workload_mix_draw(workload_mix_t *mix)
+{
+    unsigned int r = fastRandom32() % mix->total;
+
+    for (int i = 0; i < WORKLOAD_MIX_SIZE; i++)
+    {
+        if (r < mix->weights[i])
+        {
+            return mix_commands[i];
+        }
+        r -= mix->weights[i];
+    }
+
+    return PUBLISH;
+}
+
+int zipf_init(zipf_t *zipf, int n, double s)
+{
+    double sum = 0;
+
+    if (n <= 0 || s < 0 || (zipf->cdf = malloc(n * sizeof(double))) == NULL)
+    {
+        return -1;
+    }
+    zipf->n = n;
+    zipf->s = s;
+
+    for (int k = 0; k < n; k++)
+    {
+        sum += 1 / pow(k + 1, s);
+        zipf->cdf[k] = sum;
+    }
+    for (int k = 0; k < n; k++)
+    {
+        zipf->cdf[k] /= sum;
+    }
+
+    return 0;
+}
+
+void zipf_destroy(zipf_t *zipf)
+{
+    free(zipf->cdf);
+    zipf->cdf = NULL;
+}
+
+/* first item whose cumulated probability reaches a uniform value */
+int zipf_draw(zipf_t *zipf)
+{
+    double u = (fastRandom32() + 0.5) / 4294967296.0;
+    int lo = 0, hi = zipf->n - 1;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (zipf->cdf[mid] < u)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+double zipf_probability(zipf_t *zipf, int k)
+{
+    return k == 0 ? zipf->cdf[0] : zipf->cdf[k] - zipf->cdf[k - 1];
+}
@@ -0,0 +1,39 @@
+#ifndef __BABBLE_WORKLOAD_H__
+#define __BABBLE_WORKLOAD_H__
+
+/**** Synthetic workloads for the test clients ****/
+
+/* a mix gives the share of each command issued by the clients, as
+ * PUBLISH:FOLLOW:TIMELINE:FOLLOW_COUNT weights (eg, 80:5:10:5) */
+#define WORKLOAD_MIX_SIZE 4
+
+typedef struct workload_mix{
+    unsigned int weights[WORKLOAD_MIX_SIZE];
+    unsigned int total;
+} workload_mix_t;
+
+/* returns -1 if the spec is not valid */
+int workload_mix_parse(const char *spec, workload_mix_t *mix);
+
+/* draw the id of the next command (PUBLISH, FOLLOW, TIMELINE or
+ * FOLLOW_COUNT) */
+int workload_mix_draw(workload_mix_t *mix);
+
+/* power-law popularity over n items (the clients, rank 0 being the
+ * most popular): item k is drawn with a probability proportional to
+ * 1/(k+1)^s, s = 0 being uniform */
+typedef struct zipf{
+    int n;
+    double s;
+    double *cdf;
+} zipf_t;
+
+int zipf_init(zipf_t *zipf, int n, double s);
+void zipf_destroy(zipf_t *zipf);
+
+int zipf_draw(zipf_t *zipf);
+
+/* probability of item k */
+double zipf_probability(zipf_t *zipf, int k);
+
+#endif
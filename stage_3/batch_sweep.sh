@@ -0,0 +1,44 @@
+#!/bin/bash
+# Throughput/latency sweep over the executor batch size (-b option of
+# the server): for each batch size, start a server, run
+# performance_test against it and print one line of results.
+#
+# usage: ./batch_sweep.sh [-w] [-s] [-n nb_clients] [-d duration] [batch sizes...]
+#   -w  run the server with the work-stealing executor pool
+#   -s  run performance_test in streaming mode
+
+PORT=5757
+NB_CLIENTS=8
+DURATION=2
+SERVER_OPTS=""
+TEST_OPTS=""
+
+while getopts "wsn:d:" opt; do
+    case $opt in
+        w) SERVER_OPTS="$SERVER_OPTS -w" ;;
+        s) TEST_OPTS="$TEST_OPTS -s" ;;
+        n) NB_CLIENTS=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        *) exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+SIZES=${@:-1 2 4 8 16 32 64}
+
+printf "%6s %14s %10s %10s %10s\n" batch "msg/s" "mean(us)" "p50(us)" "p99(us)"
+for b in $SIZES; do
+    ./babble_server.run -p $PORT -b $b $SERVER_OPTS > /dev/null 2>&1 &
+    SERVER=$!
+    sleep 0.5
+
+    OUT=$(./performance_test.run -p $PORT -n $NB_CLIENTS -d $DURATION $TEST_OPTS)
+    TPUT=$(echo "$OUT" | sed -n 's/.*throughput: \([0-9.]*\).*/\1/p')
+    LAT=$(echo "$OUT" | sed -n 's/.*mean \([0-9.]*\) us, p50 \([0-9.]*\) us, p99 \([0-9.]*\) us.*/\1 \2 \3/p')
+
+    printf "%6s %14s %10s %10s %10s\n" $b $TPUT ${LAT:--- -- --}
+
+    kill $SERVER
+    wait $SERVER 2>/dev/null
+    PORT=$((PORT + 1))
+done
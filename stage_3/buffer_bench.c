@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "babble_types.h"
+#include "babble_command_buffer.h"
+
+/* Contention benchmark for the command buffers: nb_producers threads
+ * push commands in a single buffer drained by one consumer thread, as
+ * communication threads and an executor do in the server. Build the
+ * mutex version with -DBABBLE_MUTEX_BUFFERS (buffer_bench_mutex.run)
+ * to compare both implementations. */
+
+int nb_producers = 64;
+long nb_ops = 100000;   /* per producer */
+
+command_buffer_t *buffer;
+
+static void display_help(char *exec)
+{
+    printf("Usage: %s -n nb_producers -k nb_cmds_per_producer\n", exec);
+}
+
+static void *producer_thread(void *arg)
+{
+    unsigned long key = (unsigned long)arg;
+
+    for (long i = 0; i < nb_ops; i++)
+    {
+        command_t *cmd = command_buffer_reserve(buffer);
+        cmd->key = key;
+        cmd->cid = PUBLISH;
+        snprintf(cmd->msg, BABBLE_PUBLICATION_SIZE, "ping_%ld", i);
+        command_buffer_commit(buffer, cmd);
+    }
+
+    return NULL;
+}
+
+static void *consumer_thread(void *arg)
+{
+    long total = (long)nb_producers * nb_ops;
+    long *last = calloc(nb_producers, sizeof(long));
+
+    for (long i = 0; i < total; i++)
+    {
+        command_t *cmd = command_buffer_acquire(buffer);
+
+        /* commands of a producer must come out in order */
+        long n = atol(cmd->msg + strlen("ping_"));
+        if (n != last[cmd->key])
+        {
+            fprintf(stderr, "*** Test Failed ***\n");
+            fprintf(stderr, "producer %lu: got cmd %ld, expected %ld\n", cmd->key, n, last[cmd->key]);
+            exit(-1);
+        }
+        last[cmd->key]++;
+
+        command_buffer_release(buffer, cmd);
+    }
+
+    free(last);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int nb_args = 1;
+    struct timespec t0, t1;
+
+    while ((opt = getopt(argc, argv, "+hn:k:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            nb_producers = atoi(optarg);
+            nb_args += 2;
+            break;
+        case 'k':
+            nb_ops = atol(optarg);
+            nb_args += 2;
+            break;
+        case 'h':
+        case '?':
+        default:
+            display_help(argv[0]);
+            return -1;
+        }
+    }
+
+    if (nb_args != argc)
+    {
+        display_help(argv[0]);
+        return -1;
+    }
+
+    if (posix_memalign((void **)&buffer, CACHE_LINE_SIZE, sizeof(command_buffer_t)))
+    {
+        perror("posix_memalign");
+        return -1;
+    }
+    command_buffer_init(buffer, MAX_COMMANDS);
+
+#ifdef BABBLE_MUTEX_BUFFERS
+    printf("mutex buffer: ");
+#else
+    printf("lock-free buffer: ");
+#endif
+    printf("%d producers x %ld cmds, 1 consumer\n", nb_producers, nb_ops);
+
+    pthread_t consumer;
+    pthread_t *producers = malloc(sizeof(pthread_t) * nb_producers);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    pthread_create(&consumer, NULL, consumer_thread, NULL);
+    for (long i = 0; i < nb_producers; i++)
+    {
+        if (pthread_create(&producers[i], NULL, producer_thread, (void *)i) != 0)
+        {
+            fprintf(stderr, "Error -- unable to create producer thread\n");
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < nb_producers; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    pthread_join(consumer, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double t = (double)(t1.tv_sec - t0.tv_sec) + ((double)(t1.tv_nsec - t0.tv_nsec) / 1000000000L);
+    printf("\n throughput: %.2lf cmds/s (%.1lf ns/cmd)\n", (double)nb_producers * nb_ops / t, t * 1e9 / ((double)nb_producers * nb_ops));
+#ifndef BABBLE_MUTEX_BUFFERS
+    spin_wait_display(&buffer->consumer_spin, "consumer", stdout);
+    spin_wait_display(&buffer->producer_spin, "producers", stdout);
+#endif
+
+    free(producers);
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,714 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "babble_types.h"
+#include "babble_config.h"
+#include "babble_communication.h"
+#include "babble_utils.h"
+#include "babble_workload.h"
+#include "babble_distribution.h"
+#include "babble_histogram.h"
+#include "babble_timer_wheel.h"
+#include "fastrand.h"
+
+/* Event-driven load generator: each simulated user is a non-blocking
+ * socket and a small state machine, a thread drives thousands of them
+ * with epoll. Users connect at a given rate, login, follow a few
+ * others, then issue the commands of the mix separated by think
+ * times. Timers (connections, think times) are kept on a timer wheel
+ * per thread.
+ *
+ * The server runs a thread per connection: raise its max_clients
+ * setting, and the limit on open files of both processes. Beyond ~28k
+ * connections to a single server port, the source addresses have to
+ * vary (-a 127.0.0.1,127.0.0.2,... on loopback). */
+
+/* tick of the timer wheels, in micro-seconds */
+#define GEN_TICK 1000
+
+#define GEN_MAX_EVENTS 256
+
+typedef enum{
+    USER_NEW = 0,       /* waiting for its connection time */
+    USER_CONNECTING,
+    USER_LOGIN,         /* waiting for the login ack */
+    USER_FOLLOWING,     /* building the follow graph */
+    USER_THINKING,      /* waiting to send its next request */
+    USER_WAITING,       /* waiting for an answer */
+    USER_CLOSED
+} user_state_t;
+
+typedef struct user{
+    wheel_timer_t timer;    /* first: the expired timers are users */
+    int id;
+    int fd;
+    user_state_t state;
+    int follows_left;
+    int cid;                /* command waiting for its answer */
+    long items_left;        /* items of the answer not received yet, -1
+                             * while its header is expected */
+    int error;              /* the answer reported an error */
+    unsigned long sent_ns;
+    frame_reader_t reader;
+    char out[sizeof(unsigned long) + BABBLE_BUFFER_SIZE];
+    int out_len;
+    int out_sent;
+} user_t;
+
+typedef struct gen_thread{
+    int index;
+    pthread_t tid;
+    int epfd;
+    timer_wheel_t wheel;
+    user_t *users;
+    int nb_users;
+    histogram_t latency[NB_COMMAND_IDS];
+    unsigned long nb_connected;
+    unsigned long nb_requests;
+    unsigned long nb_errors;
+    unsigned long nb_busy;
+    unsigned long nb_failed;    /* users whose connection failed */
+} gen_thread_t;
+
+char hostname[BABBLE_BUFFER_SIZE]="127.0.0.1";
+int portno = BABBLE_PORT;
+
+int nb_users = 1000;
+int nb_threads = 1;
+int duration = 10;
+double connect_rate = 1000;     /* new connections per second */
+int nb_follows = 0;
+char *prefix = "user";
+
+workload_mix_t mix = {{1, 0, 0, 0}, 1};
+latency_profile_t think_time = {LATENCY_EXP, 1000000, 0, 0};
+double zipf_exponent = 0;
+zipf_t popularity;
+
+struct sockaddr_in server_addr;
+struct in_addr *local_addrs;
+int nb_local_addrs;
+
+/* set once all users are connected, the stats are only collected
+ * while measuring */
+volatile int measuring = 0;
+volatile int keep_on_going = 1;
+
+gen_thread_t *threads;
+
+
+static void display_help(char *exec)
+{
+    printf("Usage: %s -m hostname -p port_number -n nb_users -T nb_threads -d duration -r connect_rate\n", exec);
+    printf("\t -M mix -F nb_follows -z zipf_exponent -t think_time -a local_addrs -P name_prefix\n");
+    printf("\t -r: new connections per second during the ramp up (default 1000)\n");
+    printf("\t -d: duration of the measure, once all users are connected\n");
+    printf("\t -M: PUBLISH:FOLLOW:TIMELINE:FOLLOW_COUNT weights (default PUBLISH only)\n");
+    printf("\t -t: think time of each user (default exp:1000000, see babble_distribution.h)\n");
+    printf("\t -a: comma separated list of source addresses, used in turn\n");
+    printf("\t -P: prefix of the user names, to run several generators\n");
+}
+
+
+static unsigned long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static unsigned long now_tick(void)
+{
+    return now_ns() / (GEN_TICK * 1000);
+}
+
+
+static void user_close(gen_thread_t *t, user_t *u, int failed)
+{
+    if(u->fd >= 0){
+        epoll_ctl(t->epfd, EPOLL_CTL_DEL, u->fd, NULL);
+        close(u->fd);
+        u->fd = -1;
+    }
+    frame_reader_free(&u->reader);
+    if(failed){
+        t->nb_failed++;
+    }
+    if(u->state >= USER_FOLLOWING && u->state != USER_CLOSED){
+        t->nb_connected--;
+    }
+    u->state = USER_CLOSED;
+}
+
+static void user_watch(gen_thread_t *t, user_t *u, unsigned int events)
+{
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = u;
+    epoll_ctl(t->epfd, EPOLL_CTL_MOD, u->fd, &ev);
+}
+
+/* write what is left of the output frame, watching EPOLLOUT while it
+ * is not fully sent */
+static int user_flush(gen_thread_t *t, user_t *u)
+{
+    while(u->out_sent < u->out_len){
+        int w = write(u->fd, u->out + u->out_sent, u->out_len - u->out_sent);
+
+        if(w < 0){
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                user_watch(t, u, EPOLLIN | EPOLLOUT);
+                return 0;
+            }
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        u->out_sent += w;
+        if(u->out_sent == u->out_len && w != u->out_len){
+            /* it was partial: EPOLLOUT was on */
+            user_watch(t, u, EPOLLIN);
+        }
+    }
+    return 0;
+}
+
+/* send a command string, its answer is expected */
+static int user_send(gen_thread_t *t, user_t *u, char *str)
+{
+    u->out_len = network_frame_encode(u->out, sizeof(u->out), strlen(str) + 1, str);
+    u->out_sent = 0;
+    u->items_left = -1;
+    u->error = 0;
+    u->sent_ns = now_ns();
+
+    return user_flush(t, u);
+}
+
+static void user_schedule(gen_thread_t *t, user_t *u, unsigned long delay_us)
+{
+    timer_wheel_add(&t->wheel, &u->timer, now_tick() + (delay_us + GEN_TICK - 1) / GEN_TICK);
+}
+
+static void user_think(gen_thread_t *t, user_t *u)
+{
+    u->state = USER_THINKING;
+    user_schedule(t, u, (unsigned long)latency_profile_draw(&think_time));
+}
+
+/* a user drawn by popularity, other than u */
+static int draw_other_user(user_t *u)
+{
+    int k = zipf_draw(&popularity);
+    return k != u->id ? k : (k + 1) % nb_users;
+}
+
+static int user_follow(gen_thread_t *t, user_t *u)
+{
+    char buf[BABBLE_BUFFER_SIZE];
+
+    snprintf(buf, BABBLE_BUFFER_SIZE, "%d %s_%d\n", FOLLOW, prefix, draw_other_user(u));
+    u->cid = FOLLOW;
+    return user_send(t, u, buf);
+}
+
+static int user_request(gen_thread_t *t, user_t *u)
+{
+    char buf[BABBLE_BUFFER_SIZE];
+
+    u->cid = workload_mix_draw(&mix);
+    switch(u->cid){
+    case PUBLISH:
+        snprintf(buf, BABBLE_BUFFER_SIZE, "%d msg_%d\n", PUBLISH, u->id);
+        break;
+    case FOLLOW:
+        snprintf(buf, BABBLE_BUFFER_SIZE, "%d %s_%d\n", FOLLOW, prefix, draw_other_user(u));
+        break;
+    default:
+        snprintf(buf, BABBLE_BUFFER_SIZE, "%d\n", u->cid);
+        break;
+    }
+
+    u->state = USER_WAITING;
+    if(measuring){
+        t->nb_requests++;
+    }
+    return user_send(t, u, buf);
+}
+
+static void user_connect(gen_thread_t *t, user_t *u)
+{
+    struct epoll_event ev;
+    int one = 1;
+
+    u->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(u->fd < 0){
+        perror("socket");
+        user_close(t, u, 1);
+        return;
+    }
+    setsockopt(u->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if(nb_local_addrs){
+        struct sockaddr_in local;
+
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr = local_addrs[u->id % nb_local_addrs];
+        if(bind(u->fd, (struct sockaddr*) &local, sizeof(local)) < 0){
+            perror("bind");
+            user_close(t, u, 1);
+            return;
+        }
+    }
+
+    if(connect(u->fd, (struct sockaddr*) &server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS){
+        perror("connect");
+        user_close(t, u, 1);
+        return;
+    }
+
+    frame_reader_init(&u->reader);
+    u->state = USER_CONNECTING;
+    ev.events = EPOLLOUT;
+    ev.data.ptr = u;
+    epoll_ctl(t->epfd, EPOLL_CTL_ADD, u->fd, &ev);
+}
+
+/* the socket is connected: login */
+static int user_connected(gen_thread_t *t, user_t *u)
+{
+    char buf[BABBLE_BUFFER_SIZE];
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if(getsockopt(u->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err){
+        return -1;
+    }
+
+    user_watch(t, u, EPOLLIN);
+    snprintf(buf, BABBLE_BUFFER_SIZE, "%d %s_%d\n", LOGIN, prefix, u->id);
+    u->state = USER_LOGIN;
+    u->cid = LOGIN;
+    return user_send(t, u, buf);
+}
+
+/* the whole answer to the pending command was received */
+static int user_answered(gen_thread_t *t, user_t *u)
+{
+    switch(u->state){
+    case USER_LOGIN:
+        if(u->error){
+            return -1;
+        }
+        t->nb_connected++;
+        u->follows_left = nb_follows;
+        /* fall through */
+    case USER_FOLLOWING:
+        if(u->state == USER_FOLLOWING){
+            u->follows_left--;
+        }
+        if(u->follows_left > 0){
+            u->state = USER_FOLLOWING;
+            return user_follow(t, u);
+        }
+        user_think(t, u);
+        return 0;
+    case USER_WAITING:
+        if(measuring){
+            hist_record(&t->latency[u->cid], now_ns() - u->sent_ns);
+            t->nb_errors += u->error;
+        }
+        user_think(t, u);
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/* a frame of an answer: its header (nb of items, or a credit grant
+ * that is not for us), then the items */
+static int user_frame(gen_thread_t *t, user_t *u, char *payload, unsigned long size)
+{
+    if(u->items_left < 0){
+        unsigned int value;
+
+        if(size != sizeof(unsigned int)){
+            return -1;
+        }
+        memcpy(&value, payload, sizeof(unsigned int));
+        if(value & BABBLE_CREDIT_GRANT){
+            return 0;
+        }
+        u->items_left = value;
+    }
+    else{
+        /* the first item tells if the command failed */
+        if(size > 0 && payload[size - 1] == '\0'){
+            if(strstr(payload, "BUSY") != NULL){
+                u->error = 1;
+                if(measuring){
+                    t->nb_busy++;
+                }
+            }
+            else if(strstr(payload, "ERROR") != NULL){
+                u->error = 1;
+            }
+        }
+        u->items_left--;
+    }
+
+    if(u->items_left == 0){
+        return user_answered(t, u);
+    }
+    return 0;
+}
+
+static void user_event(gen_thread_t *t, user_t *u, unsigned int events)
+{
+    if(u->state == USER_CONNECTING){
+        if(user_connected(t, u)){
+            user_close(t, u, 1);
+        }
+        return;
+    }
+
+    if((events & EPOLLOUT) && user_flush(t, u)){
+        user_close(t, u, 1);
+        return;
+    }
+
+    if(events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+        int r;
+
+        while((r = frame_reader_fill(u->fd, &u->reader)) > 0){
+            unsigned long size;
+            char *payload;
+
+            while((payload = frame_reader_next(&u->reader, &size)) != NULL){
+                if(user_frame(t, u, payload, size)){
+                    user_close(t, u, 1);
+                    return;
+                }
+            }
+        }
+        if(r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+            user_close(t, u, 1);
+        }
+    }
+}
+
+static void user_timer(gen_thread_t *t, user_t *u)
+{
+    switch(u->state){
+    case USER_NEW:
+        user_connect(t, u);
+        break;
+    case USER_THINKING:
+        if(user_request(t, u)){
+            user_close(t, u, 1);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void *gen_thread_routine(void *arg)
+{
+    gen_thread_t *t = arg;
+    struct epoll_event events[GEN_MAX_EVENTS];
+    wheel_timer_t *expired, *next;
+    unsigned long start = now_tick();
+
+    fastRandomSetSeed(t->index + 1);
+    timer_wheel_init(&t->wheel, start);
+
+    /* the users of all threads connect in turn, at connect_rate */
+    for(int i = 0; i < t->nb_users; i++){
+        user_t *u = &t->users[i];
+        timer_wheel_add(&t->wheel, &u->timer, start + (unsigned long)(u->id * 1000000.0 / connect_rate / GEN_TICK));
+    }
+
+    while(keep_on_going){
+        expired = timer_wheel_advance(&t->wheel, now_tick());
+        for(; expired != NULL; expired = next){
+            next = expired->next;
+            user_timer(t, (user_t*) expired);
+        }
+
+        unsigned long next_tick = timer_wheel_next_tick(&t->wheel), now = now_tick();
+        int timeout = 100;
+        if(next_tick){
+            timeout = next_tick > now ? (next_tick - now) * GEN_TICK / 1000 : 0;
+            if(timeout > 100){
+                timeout = 100;
+            }
+        }
+
+        int n = epoll_wait(t->epfd, events, GEN_MAX_EVENTS, timeout);
+        for(int i = 0; i < n; i++){
+            user_event(t, events[i].data.ptr, events[i].events);
+        }
+    }
+
+    for(int i = 0; i < t->nb_users; i++){
+        if(t->users[i].state != USER_CLOSED){
+            user_close(t, &t->users[i], 0);
+        }
+    }
+
+    return NULL;
+}
+
+static unsigned long sum_counter(size_t offset)
+{
+    unsigned long total = 0;
+
+    for(int i = 0; i < nb_threads; i++){
+        total += __atomic_load_n((unsigned long*)((char*) &threads[i] + offset), __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+static int parse_local_addrs(char *list)
+{
+    char *save = NULL;
+
+    nb_local_addrs = 0;
+    for(char *tok = strtok_r(list, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)){
+        local_addrs = realloc(local_addrs, (nb_local_addrs + 1) * sizeof(struct in_addr));
+        if(inet_aton(tok, &local_addrs[nb_local_addrs]) == 0){
+            return -1;
+        }
+        nb_local_addrs++;
+    }
+    return 0;
+}
+
+static int resolve_server(void)
+{
+    struct addrinfo hints, *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(hostname, NULL, &hints, &res)){
+        return -1;
+    }
+    memcpy(&server_addr, res->ai_addr, sizeof(server_addr));
+    server_addr.sin_port = htons(portno);
+    freeaddrinfo(res);
+    return 0;
+}
+
+/* each user needs a file descriptor */
+static void raise_fd_limit(void)
+{
+    struct rlimit rl;
+
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t) nb_users + 64){
+        rl.rlim_cur = (rl.rlim_max < (rlim_t) nb_users + 64) ? rl.rlim_max : (rlim_t) nb_users + 64;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if(rl.rlim_cur < (rlim_t) nb_users + 64){
+            printf("Warning: at most %lu open files, some users will fail to connect\n", (unsigned long) rl.rlim_cur);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int nb_args=1;
+
+    while ((opt = getopt (argc, argv, "+hm:p:n:T:d:r:M:F:z:t:a:P:")) != -1){
+        switch (opt){
+        case 'm':
+            strncpy(hostname,optarg,BABBLE_BUFFER_SIZE-1);
+            nb_args+=2;
+            break;
+        case 'p':
+            portno = atoi(optarg);
+            nb_args+=2;
+            break;
+        case 'n':
+            nb_users = atoi(optarg);
+            nb_args+=2;
+            break;
+        case 'T':
+            nb_threads = atoi(optarg);
+            nb_args+=2;
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            nb_args+=2;
+            break;
+        case 'r':
+            connect_rate = atof(optarg);
+            nb_args+=2;
+            break;
+        case 'M':
+            if(workload_mix_parse(optarg, &mix)){
+                printf("Error: invalid mix %s\n", optarg);
+                return -1;
+            }
+            nb_args+=2;
+            break;
+        case 'F':
+            nb_follows = atoi(optarg);
+            nb_args+=2;
+            break;
+        case 'z':
+            zipf_exponent = atof(optarg);
+            nb_args+=2;
+            break;
+        case 't':
+            if(latency_profile_parse(optarg, &think_time)){
+                printf("Error: invalid think time %s\n", optarg);
+                return -1;
+            }
+            nb_args+=2;
+            break;
+        case 'a':
+            if(parse_local_addrs(optarg)){
+                printf("Error: invalid address list\n");
+                return -1;
+            }
+            nb_args+=2;
+            break;
+        case 'P':
+            prefix = optarg;
+            nb_args+=2;
+            break;
+        case 'h':
+        case '?':
+        default:
+            display_help(argv[0]);
+            return -1;
+        }
+    }
+
+    if(nb_args != argc || nb_users < 2 || nb_threads < 1 || connect_rate <= 0){
+        display_help(argv[0]);
+        return -1;
+    }
+
+    if(resolve_server()){
+        fprintf(stderr, "Error -- unknown host %s\n", hostname);
+        return -1;
+    }
+    if(zipf_init(&popularity, nb_users, zipf_exponent)){
+        printf("Error: invalid zipf exponent %lf\n", zipf_exponent);
+        return -1;
+    }
+    raise_fd_limit();
+
+    printf("load generator: %d users on %d threads, connecting at %.0lf/s to %s:%d\n",
+           nb_users, nb_threads, connect_rate, hostname, portno);
+    printf("workload: mix %u:%u:%u:%u, %d follows per user, zipf exponent %.2lf, think time ",
+           mix.weights[0], mix.weights[1], mix.weights[2], mix.weights[3], nb_follows, zipf_exponent);
+    latency_profile_print(stdout, &think_time);
+    printf("\n");
+
+    /* user i is driven by thread i % nb_threads */
+    threads = calloc(nb_threads, sizeof(gen_thread_t));
+    for(int i = 0; i < nb_threads; i++){
+        threads[i].index = i;
+        threads[i].users = malloc((nb_users / nb_threads + 1) * sizeof(user_t));
+        for(int c = 0; c < NB_COMMAND_IDS; c++){
+            hist_init(&threads[i].latency[c]);
+        }
+        if((threads[i].epfd = epoll_create1(0)) < 0){
+            perror("epoll_create1");
+            return -1;
+        }
+    }
+    for(int i = 0; i < nb_users; i++){
+        gen_thread_t *t = &threads[i % nb_threads];
+        user_t *u = &t->users[t->nb_users++];
+
+        memset(u, 0, sizeof(user_t));
+        u->id = i;
+        u->fd = -1;
+        u->state = USER_NEW;
+    }
+
+    for(int i = 0; i < nb_threads; i++){
+        if(pthread_create(&threads[i].tid, NULL, gen_thread_routine, &threads[i]) != 0){
+            fprintf(stderr, "Error -- unable to create thread\n");
+            return -1;
+        }
+    }
+
+    /* ramp up: until every user is connected (or failed), and their
+     * follows are done */
+    unsigned long connected = 0, failed = 0;
+    int elapsed = 0;
+    while(1){
+        sleep(1);
+        elapsed++;
+        connected = sum_counter(offsetof(gen_thread_t, nb_connected));
+        failed = sum_counter(offsetof(gen_thread_t, nb_failed));
+        printf("[%3ds] ramp up: %lu users connected, %lu failed\n", elapsed, connected, failed);
+        fflush(stdout);
+        if(connected + failed >= (unsigned long) nb_users){
+            break;
+        }
+    }
+    sleep(nb_follows ? 1 : 0);
+
+    /* measure */
+    measuring = 1;
+    unsigned long last = 0;
+    for(int s = 1; s <= duration; s++){
+        sleep(1);
+        unsigned long requests = sum_counter(offsetof(gen_thread_t, nb_requests));
+        printf("[%3ds] %lu users connected, %lu req/s\n", s,
+               sum_counter(offsetof(gen_thread_t, nb_connected)), requests - last);
+        fflush(stdout);
+        last = requests;
+    }
+    measuring = 0;
+    keep_on_going = 0;
+
+    for(int i = 0; i < nb_threads; i++){
+        pthread_join(threads[i].tid, NULL);
+    }
+
+    printf("\n**** load generator terminated ****\n");
+    printf(" users: %lu connected, %lu failed\n", connected, sum_counter(offsetof(gen_thread_t, nb_failed)));
+    printf(" throughput: %.2lf req/s, %lu errors, %lu busy\n", (double) last / duration,
+           sum_counter(offsetof(gen_thread_t, nb_errors)), sum_counter(offsetof(gen_thread_t, nb_busy)));
+
+    histogram_t *h = malloc(sizeof(histogram_t));
+    printf(" %-12s %10s %10s %10s %10s %10s (us)\n", "command", "count", "p50", "p99", "p999", "max");
+    for(int c = PUBLISH; c <= FOLLOW_COUNT; c++){
+        hist_init(h);
+        for(int i = 0; i < nb_threads; i++){
+            hist_merge(h, &threads[i].latency[c]);
+        }
+        if(h->total){
+            printf(" %-12s %10lu %10.1lf %10.1lf %10.1lf %10.1lf\n", command_name(c), h->total,
+                   hist_percentile(h, 0.5) / 1000.0, hist_percentile(h, 0.99) / 1000.0,
+                   hist_percentile(h, 0.999) / 1000.0, h->max / 1000.0);
+        }
+    }
+    free(h);
+
+    return 0;
+}
@@ -0,0 +1,461 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "babble_types.h"
+#include "babble_utils.h"
+#include "babble_settings.h"
+#include "babble_registration.h"
+#include "babble_timeline.h"
+#include "babble_server.h"
+#include "babble_server_answer.h"
+#include "babble_command_buffer.h"
+#include "babble_stats.h"
+#include "babble_hot_clients.h"
+#include "babble_pool.h"
+
+/* Microbenchmarks of the server subsystems: the functions are driven
+ * directly, without the network, with inputs close to what the server
+ * sees. Each benchmark reports the time per operation and the nb of
+ * heap allocations per operation (malloc, calloc and realloc are
+ * counted by the wrappers below). Multi-threaded variants report the
+ * time per operation of a thread, with 1 to max_threads threads.
+ *
+ * make bench builds and runs it. */
+
+long nb_ops = 1000000;
+int max_threads = 8;
+char *filter = NULL;
+
+/* nb of registered clients for the registry benchmarks */
+int nb_clients = 1000;
+
+/**** allocation counting ****/
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long nb_allocs;
+
+void *malloc(size_t size)
+{
+    __atomic_fetch_add(&nb_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    __atomic_fetch_add(&nb_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    __atomic_fetch_add(&nb_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+/**** harness ****/
+
+static double elapsed_ns(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec) * 1e9 + (t1->tv_nsec - t0->tv_nsec);
+}
+
+static int selected(const char *name)
+{
+    return filter == NULL || strstr(name, filter) != NULL;
+}
+
+static void report(const char *name, int nb_threads, double ns, long ops, unsigned long allocs)
+{
+    char label[BABBLE_BUFFER_SIZE];
+
+    if (nb_threads)
+    {
+        snprintf(label, sizeof(label), "%s/%d", name, nb_threads);
+    }
+    else
+    {
+        snprintf(label, sizeof(label), "%s", name);
+    }
+    printf("%-32s %12ld ops %10.1f ns/op %8.2f allocs/op\n", label, ops, ns / ops, (double)allocs / ops);
+}
+
+/* run op(i) nb_ops times, after a warm-up */
+static void bench_run(const char *name, void (*op)(long i), long ops)
+{
+    struct timespec t0, t1;
+    unsigned long allocs;
+
+    if (!selected(name))
+    {
+        return;
+    }
+
+    for (long i = 0; i < ops / 10; i++)
+    {
+        op(i);
+    }
+
+    allocs = __atomic_load_n(&nb_allocs, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long i = 0; i < ops; i++)
+    {
+        op(i);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    report(name, 0, elapsed_ns(&t0, &t1), ops, __atomic_load_n(&nb_allocs, __ATOMIC_RELAXED) - allocs);
+}
+
+typedef struct bench_thread{
+    void (*op)(long i);
+    long ops;
+    long first;
+    pthread_barrier_t *barrier;
+} bench_thread_t;
+
+static void *bench_thread_routine(void *arg)
+{
+    bench_thread_t *t = arg;
+
+    pthread_barrier_wait(t->barrier);
+    for (long i = 0; i < t->ops; i++)
+    {
+        t->op(t->first + i);
+    }
+
+    return NULL;
+}
+
+/* run op from 1, 2, 4... max_threads threads, each doing ops
+ * operations */
+static void bench_run_threads(const char *name, void (*op)(long i), long ops)
+{
+    struct timespec t0, t1;
+    unsigned long allocs;
+
+    if (!selected(name))
+    {
+        return;
+    }
+
+    for (int nb = 1; nb <= max_threads; nb *= 2)
+    {
+        pthread_t tids[nb];
+        bench_thread_t threads[nb];
+        pthread_barrier_t barrier;
+
+        pthread_barrier_init(&barrier, NULL, nb + 1);
+        for (int i = 0; i < nb; i++)
+        {
+            threads[i] = (bench_thread_t){op, ops, i * ops, &barrier};
+            pthread_create(&tids[i], NULL, bench_thread_routine, &threads[i]);
+        }
+
+        allocs = __atomic_load_n(&nb_allocs, __ATOMIC_RELAXED);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        pthread_barrier_wait(&barrier);
+        for (int i = 0; i < nb; i++)
+        {
+            pthread_join(tids[i], NULL);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        pthread_barrier_destroy(&barrier);
+
+        report(name, nb, elapsed_ns(&t0, &t1), ops, (__atomic_load_n(&nb_allocs, __ATOMIC_RELAXED) - allocs) / nb);
+    }
+}
+
+/**** parsing ****/
+
+/* commands as sent by the test clients */
+static char *commands[] = {
+    "1 ping_12",
+    "S 1 hello from a streaming client",
+    "2 client_42",
+    "3",
+    "4",
+    "5",
+    "PUBLISH some publication",
+};
+#define NB_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+static void op_str_to_command(long i)
+{
+    int ack;
+    str_to_command(commands[i % NB_COMMANDS], &ack);
+}
+
+static void op_str_to_payload(long i)
+{
+    char payload[BABBLE_PUBLICATION_SIZE];
+    str_to_payload(commands[i % 2], payload, BABBLE_PUBLICATION_SIZE);
+}
+
+/**** registry ****/
+
+static unsigned long *client_keys;
+
+static void registry_init(void)
+{
+    char name[BABBLE_ID_SIZE];
+
+    registration_init();
+    client_keys = malloc(nb_clients * sizeof(unsigned long));
+
+    for (int i = 0; i < nb_clients; i++)
+    {
+        client_bundle_t *client = calloc(1, sizeof(client_bundle_t));
+
+        snprintf(name, BABBLE_ID_SIZE, "client_%d", i);
+        strncpy(client->client_name, name, BABBLE_ID_SIZE);
+        client->key = hash(name);
+        client->timeline = timeline_create(client->key);
+        client_keys[i] = client->key;
+        registration_insert(client);
+    }
+}
+
+/* lookups spread over the table */
+static void op_registration_lookup(long i)
+{
+    if (registration_lookup(client_keys[(i * 7919) % nb_clients]) == NULL)
+    {
+        fprintf(stderr, "*** Test Failed ***\n");
+        exit(-1);
+    }
+}
+
+/**** timelines and answers ****/
+
+static timeline_t *timeline;
+static client_bundle_t *publisher;
+static char *publication = "a publication of average size";
+
+static void op_timeline_insert(long i)
+{
+    timeline_insert(timeline, publisher, publication);
+}
+
+/* a timeline with 10 new publications, as when clients poll it */
+static void op_timeline_summary(long i)
+{
+    answer_t *answer;
+
+    timeline->count_recent_adds = 10;
+    timeline_generate_summary(timeline, &answer);
+    free_answer(answer);
+}
+
+/* a full timeline */
+static void op_timeline_summary_full(long i)
+{
+    answer_t *answer;
+
+    timeline->count_recent_adds = timeline->size;
+    timeline_generate_summary(timeline, &answer);
+    free_answer(answer);
+}
+
+/* a one-line answer (most commands) */
+static void op_answer_one_msg(long i)
+{
+    char msg[BABBLE_BUFFER_SIZE] = "client_12[3]: publish ack";
+    answer_t *answer = alloc_answer(publisher->key);
+
+    add_msg_to_answer(answer, BABBLE_BUFFER_SIZE, msg);
+    free_answer(answer);
+}
+
+/* an answer that grows on the heap */
+static void op_answer_20_msgs(long i)
+{
+    char msg[BABBLE_BUFFER_SIZE] = "    client_12[3]: a publication";
+    answer_t *answer = alloc_answer(publisher->key);
+
+    for (int k = 0; k < 20; k++)
+    {
+        add_msg_to_answer(answer, BABBLE_BUFFER_SIZE, msg);
+    }
+    free_answer(answer);
+}
+
+/**** instrumentation ****/
+
+static void op_stats_record(long i)
+{
+    stats_record(PUBLISH, STATS_EXEC, i & 0xffff);
+}
+
+/* spread over the clients: most of them miss their counter */
+static void op_hot_clients_record(long i)
+{
+    hot_clients_record(client_keys[(i * 7919) % nb_clients], 1, 0, 0, i & 0xffff);
+}
+
+static void op_pool_command(long i)
+{
+    pool_free(POOL_COMMAND, pool_alloc(POOL_COMMAND));
+}
+
+/**** queues ****/
+
+/* nb of producers push in a single buffer drained by one consumer */
+static command_buffer_t *queue;
+
+static void op_queue_push(long i)
+{
+    command_t *cmd = command_buffer_reserve(queue);
+    cmd->key = i;
+    cmd->cid = PUBLISH;
+    command_buffer_commit(queue, cmd);
+}
+
+static void *queue_consumer(void *arg)
+{
+    long total = *(long *)arg;
+
+    for (long i = 0; i < total; i++)
+    {
+        command_buffer_release(queue, command_buffer_acquire(queue));
+    }
+
+    return NULL;
+}
+
+static void bench_queue(long ops)
+{
+    char name[BABBLE_BUFFER_SIZE];
+    struct timespec t0, t1;
+
+    if (!selected("command_buffer"))
+    {
+        return;
+    }
+
+    queue = malloc(sizeof(command_buffer_t));
+    command_buffer_init(queue, settings.buffer_size);
+
+    for (int nb = 1; nb <= max_threads; nb *= 2)
+    {
+        pthread_t tids[nb], consumer;
+        bench_thread_t threads[nb];
+        pthread_barrier_t barrier;
+        long total = nb * ops;
+
+        pthread_barrier_init(&barrier, NULL, nb + 1);
+        pthread_create(&consumer, NULL, queue_consumer, &total);
+        for (int i = 0; i < nb; i++)
+        {
+            threads[i] = (bench_thread_t){op_queue_push, ops, i * ops, &barrier};
+            pthread_create(&tids[i], NULL, bench_thread_routine, &threads[i]);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        pthread_barrier_wait(&barrier);
+        for (int i = 0; i < nb; i++)
+        {
+            pthread_join(tids[i], NULL);
+        }
+        pthread_join(consumer, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        pthread_barrier_destroy(&barrier);
+
+        /* time per command through the queue */
+        snprintf(name, sizeof(name), "command_buffer (%d producers)", nb);
+        report(name, 0, elapsed_ns(&t0, &t1), total, 0);
+    }
+}
+
+static void display_help(char *exec)
+{
+    printf("Usage: %s -k nb_ops -t max_threads -c nb_clients -f filter\n", exec);
+    printf("\t filter: only run the benchmarks whose name includes it\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int nb_args = 1;
+
+    while ((opt = getopt(argc, argv, "+hk:t:c:f:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'k':
+            nb_ops = atol(optarg);
+            nb_args += 2;
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            nb_args += 2;
+            break;
+        case 'c':
+            nb_clients = atoi(optarg);
+            nb_args += 2;
+            break;
+        case 'f':
+            filter = optarg;
+            nb_args += 2;
+            break;
+        case 'h':
+        case '?':
+        default:
+            display_help(argv[0]);
+            return -1;
+        }
+    }
+
+    if (nb_args != argc || nb_ops <= 0 || max_threads <= 0 || nb_clients <= 0)
+    {
+        display_help(argv[0]);
+        return -1;
+    }
+
+    if (settings_load(NULL))
+    {
+        return -1;
+    }
+    if (nb_clients > settings.max_clients)
+    {
+        printf("Error: at most %d clients (max_clients setting)\n", settings.max_clients);
+        return -1;
+    }
+
+    server_data_init();
+    registry_init();
+    publisher = registration_lookup(client_keys[0]);
+    timeline = timeline_create(publisher->key);
+    for (unsigned int i = 0; i < timeline->size; i++)
+    {
+        timeline_insert(timeline, publisher, publication);
+    }
+    stats_thread_register();
+    hot_clients_init(settings.hot_clients, settings.hot_metric);
+    hot_clients_thread_register();
+
+    printf("### %ld ops per benchmark (and thread), %d registered clients\n", nb_ops, nb_clients);
+
+    bench_run("str_to_command", op_str_to_command, nb_ops);
+    bench_run("str_to_payload", op_str_to_payload, nb_ops);
+    bench_run("registration_lookup", op_registration_lookup, nb_ops / 10);
+    bench_run("timeline_insert", op_timeline_insert, nb_ops);
+    bench_run("timeline_summary (10 msgs)", op_timeline_summary, nb_ops / 10);
+    bench_run("timeline_summary (full)", op_timeline_summary_full, nb_ops / 100);
+    bench_run("add_msg_to_answer (1 msg)", op_answer_one_msg, nb_ops);
+    bench_run("add_msg_to_answer (20 msgs)", op_answer_20_msgs, nb_ops / 10);
+    bench_run("stats_record", op_stats_record, nb_ops);
+    bench_run("hot_clients_record", op_hot_clients_record, nb_ops);
+    bench_run("pool_alloc/free", op_pool_command, nb_ops);
+
+    bench_run_threads("registration_lookup", op_registration_lookup, nb_ops / 10);
+    bench_queue(nb_ops / 4);
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+#!/bin/bash
+# Comparison of the concurrency models of the server (--model option):
+# for each model, start a server, run the same performance_test
+# workload against it and print one line of results.
+#
+# usage: ./model_compare.sh [-s] [-n nb_clients] [-d duration] [-M mix] [-o server_option] [models...]
+#   -s  run performance_test in streaming mode
+#   -M  request mix of performance_test (eg, 80:5:10:5)
+#   -o  setting given to every server, as name=value (can be repeated)
+
+PORT=5957
+NB_CLIENTS=8
+DURATION=2
+SERVER_OPTS=""
+TEST_OPTS=""
+
+while getopts "sn:d:M:o:" opt; do
+    case $opt in
+        s) TEST_OPTS="$TEST_OPTS -s" ;;
+        n) NB_CLIENTS=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        M) TEST_OPTS="$TEST_OPTS -M $OPTARG" ;;
+        o) SERVER_OPTS="$SERVER_OPTS -o $OPTARG" ;;
+        *) exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+MODELS=${@:-sequential single sharded pool}
+
+printf "%-12s %14s %10s %10s %10s\n" model "msg/s" "mean(us)" "p50(us)" "p99(us)"
+for m in $MODELS; do
+    ./babble_server.run -p $PORT --model $m $SERVER_OPTS > /dev/null 2>&1 &
+    SERVER=$!
+    sleep 0.5
+
+    OUT=$(./performance_test.run -p $PORT -n $NB_CLIENTS -d $DURATION $TEST_OPTS)
+    TPUT=$(echo "$OUT" | sed -n 's/.*throughput: \([0-9.]*\).*/\1/p')
+    LAT=$(echo "$OUT" | sed -n 's/.*mean \([0-9.]*\) us, p50 \([0-9.]*\) us, p99 \([0-9.]*\) us.*/\1 \2 \3/p')
+
+    printf "%-12s %14s %10s %10s %10s\n" $m ${TPUT:---} ${LAT:--- -- --}
+
+    kill $SERVER
+    wait $SERVER 2>/dev/null
+    PORT=$((PORT + 1))
+done
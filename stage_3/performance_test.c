@@ -10,26 +10,66 @@
 #include "babble_communication.h"
 #include "babble_utils.h"
 #include "babble_client.h"
+#include "babble_workload.h"
+#include "babble_distribution.h"
+#include "fastrand.h"
 
 typedef struct client_thread_data{
     int client_id;
     pthread_barrier_t *gbarrier;
+    pthread_barrier_t *sbarrier;    /* setup (follow graph) done */
 } client_thread_data_t;
 
 /* duration of the test in seconds */
 int duration = 2;
 
+int nb_threads=4;
+
 char hostname[BABBLE_BUFFER_SIZE]="127.0.0.1";
 int portno = BABBLE_PORT;
 
 int with_streaming = 0;
 
+/* ask the server for its latency histograms at the end */
+int with_server_stats = 0;
+
+/* open-loop mode: requests are issued on a fixed schedule at this
+ * total rate (req/s) instead of as fast as the acks return, 0 for
+ * closed-loop */
+double target_rate = 0;
+
+/* results appended as a CSV line (rate sweeps) */
+char *csv_file = NULL;
+
+/* open-loop requests sent more than one interval behind schedule */
+int64_t *nb_late;
+
+/* workload: mix of commands (PUBLISH only if not set), follows per
+ * client made before the test, popularity of the clients (targets of
+ * the follows and activity), think time between two requests */
+int with_mix = 0;
+workload_mix_t mix;
+int nb_follows = 0;
+double zipf_exponent = 0;
+zipf_t popularity;
+latency_profile_t think_time = {LATENCY_NONE, 0, 0, 0};
+
+/* nb of requests per command id */
+int64_t nb_ops[NB_COMMAND_IDS];
+
 /* reset to stop the test */
 volatile int keep_on_going = 1;
 
 /* used to aggregate the results */
 double* ops;
 
+/* request latencies in ns (non-streaming mode only), at most
+ * max_samples per thread */
+#define MAX_TOTAL_SAMPLES 4000000
+int64_t **latencies;
+int64_t *nb_latencies;
+int64_t max_samples;
+
 
 static void ALRMhandler (int sig)
 {
@@ -37,10 +77,75 @@ static void ALRMhandler (int sig)
 }
 
 
+static int64_t elapsed_ns(struct timespec *t0, struct timespec *t1)
+{
+    return (int64_t)(t1->tv_sec - t0->tv_sec) * 1000000000L + (t1->tv_nsec - t0->tv_nsec);
+}
+
+static void add_ns(struct timespec *t, int64_t ns)
+{
+    t->tv_sec += ns / 1000000000L;
+    t->tv_nsec += ns % 1000000000L;
+    if(t->tv_nsec >= 1000000000L){
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000L;
+    }
+}
+
+/* percentiles displayed in open loop and written to the csv */
+#define NB_PERCENTILES 6
+static const double percentiles[NB_PERCENTILES] = {0.5, 0.9, 0.99, 0.999, 0.9999, 1};
+
+/* value at quantile q of n sorted samples, in us */
+static double percentile_us(int64_t *sorted, int64_t n, double q)
+{
+    int64_t k = (int64_t)(n * q);
+    return sorted[k < n ? k : n - 1] / 1000.0;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
 static void display_help(char *exec)
 {
-    printf("Usage: %s -m hostname -p port_number -d duration -n nb_clients -s [activate_streaming]\n", exec);
+    printf("Usage: %s -m hostname -p port_number -d duration -n nb_clients -s [activate_streaming] -S [display_server_stats] -R rate -c csv_file\n", exec);
     printf("\t hostname can be an ip address\n" );
+    printf("\t -R: open loop, the clients send rate req/s in total on a fixed schedule\n");
+    printf("\t -c: append the results to csv_file\n");
+    printf("\t workload: -M mix -F nb_follows -z zipf_exponent -t think_time\n");
+    printf("\t -M: PUBLISH:FOLLOW:TIMELINE:FOLLOW_COUNT weights (eg, 80:5:10:5), default PUBLISH only\n");
+    printf("\t -F: each client follows nb_follows others before the test\n");
+    printf("\t -z: power law of the popularity of the clients (targets of follows, activity), default 0 (uniform)\n");
+    printf("\t -t: think time between two requests of a client (closed loop), eg exp:100 (see babble_distribution.h)\n");
+}
+
+/* a client drawn by popularity, other than self */
+static int draw_other_client(int self)
+{
+    int k = zipf_draw(&popularity);
+    return k != self ? k : (k + 1) % nb_threads;
+}
+
+/* run a request of the workload, returns -1 on error */
+static int run_request(int sockfd, int cid, int self, char *msg)
+{
+    char target[BABBLE_ID_SIZE];
+
+    switch(cid){
+    case PUBLISH:
+        return client_publish(sockfd, msg, with_streaming);
+    case FOLLOW:
+        snprintf(target, BABBLE_ID_SIZE, "client_%d", draw_other_client(self));
+        return client_follow(sockfd, target, with_streaming);
+    case TIMELINE:
+        return client_timeline(sockfd, 1) < 0 ? -1 : 0;
+    case FOLLOW_COUNT:
+        return client_follow_count(sockfd) < 0 ? -1 : 0;
+    }
+    return -1;
 }
 
 static void *working_thread (void *arg)
@@ -80,6 +185,33 @@ static void *working_thread (void *arg)
         return (void*)EXIT_FAILURE;
     }
 
+    fastRandomSetSeed(data->client_id + 1);
+
+    /* follow graph: popular clients get most of the followers (a
+     * client may follow the same one twice) */
+    for(int k = 0; k < nb_follows; k++){
+        char target[BABBLE_ID_SIZE];
+        snprintf(target, BABBLE_ID_SIZE, "client_%d", draw_other_client(data->client_id));
+        if(client_follow(sockfd, target, 0)){
+            fprintf(stderr,"*** Test Failed ***\n");
+            fprintf(stderr,"%s failed to follow %s\n", client_name, target);
+            close(sockfd);
+            exit(-1);
+        }
+    }
+
+    ret = pthread_barrier_wait(data->sbarrier);
+    if (ret != 0 && ret != PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        fprintf(stderr, "Barrier synchronization failed!\n");
+        return (void*)EXIT_FAILURE;
+    }
+
+    /* popular clients are also the most active: the mean time between
+     * their requests is scaled by 1/(n * their popularity) */
+    double activity = 1 / (nb_threads * zipf_probability(&popularity, data->client_id));
+    int64_t my_ops[NB_COMMAND_IDS] = {0};
+
 
     char my_msg[BABBLE_PUBLICATION_SIZE];
     memset(my_msg, 0, BABBLE_PUBLICATION_SIZE);
@@ -90,14 +222,58 @@ static void *working_thread (void *arg)
         exit(EXIT_FAILURE);
     }
     
+    int64_t *my_latencies = latencies[data->client_id];
+    struct timespec r0, r1;
+
+    /* open loop: request k is due at start + k * interval, the clients
+     * being spread over the interval. The latency is measured from the
+     * due date, so that the time a late request spent waiting for its
+     * predecessor counts (coordinated omission) */
+    int64_t interval = 0;
+    struct timespec due;
+    if(target_rate > 0){
+        interval = (int64_t)(1000000000.0 * nb_threads / target_rate * activity);
+        clock_gettime(CLOCK_MONOTONIC, &due);
+        add_ns(&due, interval * data->client_id / nb_threads);
+    }
+
     for (op_count = 0; keep_on_going; op_count++){
-        if(client_publish(sockfd, my_msg, with_streaming)){
+        if(interval){
+            clock_gettime(CLOCK_MONOTONIC, &r0);
+            if(elapsed_ns(&due, &r0) < 0){
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+            }
+            else if(elapsed_ns(&due, &r0) > interval){
+                nb_late[data->client_id]++;
+            }
+            r0 = due;
+            add_ns(&due, interval);
+        }
+        else if(!with_streaming){
+            clock_gettime(CLOCK_MONOTONIC, &r0);
+        }
+        int cid = with_mix ? workload_mix_draw(&mix) : PUBLISH;
+        /* at the end of the test, the followed client may already
+         * be gone */
+        if(run_request(sockfd, cid, data->client_id, my_msg) && (keep_on_going || cid != FOLLOW)){
             fprintf(stderr,"*** Test Failed ***\n");
-            fprintf(stderr,"%s failed to publish %s\n", client_name, my_msg);
+            fprintf(stderr,"%s failed to run command %d\n", client_name, cid);
             close(sockfd);
             exit(-1);
         }
+        my_ops[cid]++;
+        if(!with_streaming && op_count < max_samples){
+            clock_gettime(CLOCK_MONOTONIC, &r1);
+            my_latencies[op_count] = elapsed_ns(&r0, &r1);
+        }
+        if(think_time.dist != LATENCY_NONE){
+            usleep((useconds_t)(latency_profile_draw(&think_time) * activity));
+        }
+    }
+    for(int k = 0; k < NB_COMMAND_IDS; k++){
+        __atomic_fetch_add(&nb_ops[k], my_ops[k], __ATOMIC_RELAXED);
     }
+    nb_latencies[data->client_id] = (op_count < max_samples) ? op_count : max_samples;
 
     /* rdv to ensure that all messages have been processed */
     if(client_rdv(sockfd)){
@@ -130,8 +306,8 @@ int main(int argc, char *argv[])
     int nb_args=1;
     
     pthread_barrier_t global_barrier;
+    pthread_barrier_t setup_barrier;
 
-    int nb_threads=4;
 
     pthread_t *tids=NULL;
     client_thread_data_t *clients_data=NULL;
@@ -142,7 +318,7 @@ int main(int argc, char *argv[])
 
     
     /* parsing command options */
-    while ((opt = getopt (argc, argv, "+hm:p:d:sn:")) != -1){
+    while ((opt = getopt (argc, argv, "+hm:p:d:sSn:R:c:M:F:z:t:")) != -1){
         switch (opt){
         case 'm':
             strncpy(hostname,optarg,BABBLE_BUFFER_SIZE);
@@ -167,6 +343,41 @@ int main(int argc, char *argv[])
             with_streaming=1;
             nb_args+=1;
             break;
+        case 'S':
+            with_server_stats=1;
+            nb_args+=1;
+            break;
+        case 'R':
+            target_rate = atof(optarg);
+            nb_args+=2;
+            break;
+        case 'c':
+            csv_file = optarg;
+            nb_args+=2;
+            break;
+        case 'M':
+            if(workload_mix_parse(optarg, &mix)){
+                printf("Error: invalid mix %s\n", optarg);
+                return -1;
+            }
+            with_mix=1;
+            nb_args+=2;
+            break;
+        case 'F':
+            nb_follows = atoi(optarg);
+            nb_args+=2;
+            break;
+        case 'z':
+            zipf_exponent = atof(optarg);
+            nb_args+=2;
+            break;
+        case 't':
+            if(latency_profile_parse(optarg, &think_time)){
+                printf("Error: invalid think time %s\n", optarg);
+                return -1;
+            }
+            nb_args+=2;
+            break;
         case 'h':
         case '?':
         default:
@@ -180,16 +391,51 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    if(target_rate < 0 || (target_rate > 0 && with_streaming)){
+        printf("Error: the open-loop mode needs a positive rate, and acks to measure latencies (no -s)\n");
+        return -1;
+    }
+
+    if(think_time.dist != LATENCY_NONE && target_rate > 0){
+        printf("Error: think times are for the closed loop, the open loop follows its schedule\n");
+        return -1;
+    }
+
+    if(zipf_init(&popularity, nb_threads, zipf_exponent)){
+        printf("Error: invalid zipf exponent %lf\n", zipf_exponent);
+        return -1;
+    }
+
     ops = (double*) malloc(nb_threads * sizeof(double));
     memset(ops, 0, nb_threads * sizeof(int64_t));
+
+    max_samples = MAX_TOTAL_SAMPLES / nb_threads;
+    latencies = (int64_t**) malloc(nb_threads * sizeof(int64_t*));
+    nb_latencies = (int64_t*) calloc(nb_threads, sizeof(int64_t));
+    nb_late = (int64_t*) calloc(nb_threads, sizeof(int64_t));
+    for(i=0; i < nb_threads; i++){
+        latencies[i] = with_streaming ? NULL : (int64_t*) malloc(max_samples * sizeof(int64_t));
+    }
     
-    if(pthread_barrier_init(&global_barrier, NULL, nb_threads+1))
+    if(pthread_barrier_init(&global_barrier, NULL, nb_threads+1) ||
+       pthread_barrier_init(&setup_barrier, NULL, nb_threads+1))
     {
         printf("Could not create a barrier\n");
         return -1;
     }
 
     printf("starting performance test with %d clients (sending requests during %d seconds)\n", nb_threads, duration);
+    if(target_rate > 0){
+        printf("open loop at %.0lf req/s\n", target_rate);
+    }
+    if(with_mix || nb_follows || zipf_exponent > 0 || think_time.dist != LATENCY_NONE){
+        printf("workload: mix %u:%u:%u:%u, %d follows per client, zipf exponent %.2lf, think time ",
+               with_mix ? mix.weights[0] : 1, with_mix ? mix.weights[1] : 0,
+               with_mix ? mix.weights[2] : 0, with_mix ? mix.weights[3] : 0,
+               nb_follows, zipf_exponent);
+        latency_profile_print(stdout, &think_time);
+        printf("\n");
+    }
 
     
     tids = malloc(sizeof(pthread_t)*nb_threads);
@@ -197,6 +443,7 @@ int main(int argc, char *argv[])
     
     for(i=0; i < nb_threads; i++){
         clients_data[i].gbarrier= &global_barrier;
+        clients_data[i].sbarrier= &setup_barrier;
         clients_data[i].client_id = i;
         if(pthread_create (&tids[i], NULL, working_thread, (void*) &clients_data[i]) != 0){
             fprintf(stderr,"WARNING: Failed to create clientthread\n");
@@ -217,6 +464,14 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    /* barrier after the follow graph is built */
+    ret = pthread_barrier_wait(&setup_barrier);
+    if (ret != 0 && ret != PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        fprintf(stderr, "Barrier synchronization failed!\n");
+        return -1;
+    }
+
     /* start measuring time */
     alarm (duration);
     
@@ -235,6 +490,100 @@ int main(int argc, char *argv[])
     }
     
     printf("\n throughput: %.2lf msg/s\n", (double)totops);
+    if(with_mix){
+        printf(" requests: %ld PUBLISH, %ld FOLLOW, %ld TIMELINE, %ld FOLLOW_COUNT\n",
+               nb_ops[PUBLISH], nb_ops[FOLLOW], nb_ops[TIMELINE], nb_ops[FOLLOW_COUNT]);
+    }
+
+    int64_t late = 0;
+    for(i = 0; i < nb_threads; i++){
+        late += nb_late[i];
+    }
+    if(target_rate > 0){
+        printf(" target: %.2lf msg/s, %ld requests sent behind schedule\n", target_rate, late);
+    }
+
+    /* latency of the requests, from send (or due date, in open loop)
+     * to ack: PUBLISH only, or all the commands of the mix in a single
+     * histogram with -M */
+    double mean = 0, values[NB_PERCENTILES];
+    int64_t nb_samples = 0;
+    if(!with_streaming){
+        int64_t k = 0;
+        double sum = 0;
+
+        for(i = 0; i < nb_threads; i++){
+            nb_samples += nb_latencies[i];
+        }
+        int64_t *all = (int64_t*) malloc((nb_samples + 1) * sizeof(int64_t));
+        for(i = 0; i < nb_threads; i++){
+            memcpy(&all[k], latencies[i], nb_latencies[i] * sizeof(int64_t));
+            k += nb_latencies[i];
+        }
+
+        if(nb_samples){
+            qsort(all, nb_samples, sizeof(int64_t), compare_int64);
+            for(k = 0; k < nb_samples; k++){
+                sum += all[k];
+            }
+            mean = sum / nb_samples / 1000;
+            for(k = 0; k < NB_PERCENTILES; k++){
+                values[k] = percentile_us(all, nb_samples, percentiles[k]);
+            }
+            printf(" latency (%s): mean %.1lf us, p50 %.1lf us, p99 %.1lf us, max %.1lf us\n",
+                   with_mix ? "all commands of the mix" : "PUBLISH",
+                   mean, values[0], values[2], values[NB_PERCENTILES - 1]);
+
+            if(target_rate > 0){
+                printf("\n %10s %12s\n", "percentile", "latency(us)");
+                for(k = 0; k < NB_PERCENTILES; k++){
+                    printf(" %10.4lf %12.1lf\n", percentiles[k] * 100, values[k]);
+                }
+            }
+        }
+        free(all);
+    }
+
+    /* one line per run, the header is written with the first one */
+    if(csv_file){
+        FILE *csv = fopen(csv_file, "a");
+
+        if(csv == NULL){
+            perror("csv file");
+            return -1;
+        }
+        if(ftell(csv) == 0){
+            fprintf(csv, "mode,clients,target_rate,throughput,late,mean_us,p50_us,p90_us,p99_us,p999_us,p9999_us,max_us\n");
+        }
+        fprintf(csv, "%s,%d,%.0lf,%.2lf,%ld", with_streaming ? "stream" : (target_rate > 0 ? "open" : "closed"),
+                nb_threads, target_rate, totops, late);
+        if(nb_samples){
+            fprintf(csv, ",%.1lf", mean);
+            for(i = 0; i < NB_PERCENTILES; i++){
+                fprintf(csv, ",%.1lf", values[i]);
+            }
+        }
+        else{
+            fprintf(csv, ",,,,,,,");
+        }
+        fprintf(csv, "\n");
+        fclose(csv);
+    }
+
+    /* latency of the commands as seen by the server */
+    if(with_server_stats){
+        int sockfd = connect_to_server(hostname, portno);
+
+        if(sockfd == -1 || client_login(sockfd, "perf_stats") == 0){
+            fprintf(stderr,"failed to get the server stats\n");
+            return -1;
+        }
+        printf("\n server latencies:\n");
+        if(client_stats(sockfd, 0) < 0){
+            fprintf(stderr,"failed to get the server stats\n");
+        }
+        close(sockfd);
+    }
   
     
     return 0;
@@ -0,0 +1,42 @@
+#!/bin/bash
+# Latency sweep over the offered load: for each target rate, start a
+# server, run performance_test in open loop (-R) against it and append
+# one line of results to a csv file, printing a summary.
+#
+# usage: ./rate_sweep.sh [-w] [-n nb_clients] [-d duration] [-o csv_file] [rates...]
+#   -w  run the server with the work-stealing executor pool
+#   -o  csv file (default rate_sweep.csv), appended to
+
+PORT=5857
+NB_CLIENTS=8
+DURATION=2
+SERVER_OPTS=""
+CSV=rate_sweep.csv
+
+while getopts "wn:d:o:" opt; do
+    case $opt in
+        w) SERVER_OPTS="$SERVER_OPTS -w" ;;
+        n) NB_CLIENTS=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        o) CSV=$OPTARG ;;
+        *) exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+RATES=${@:-5000 10000 20000 40000 60000 80000}
+
+printf "%10s %14s %10s %10s %10s %10s\n" rate "msg/s" "late" "p50(us)" "p99(us)" "p999(us)"
+for r in $RATES; do
+    ./babble_server.run -p $PORT $SERVER_OPTS > /dev/null 2>&1 &
+    SERVER=$!
+    sleep 0.5
+
+    ./performance_test.run -p $PORT -n $NB_CLIENTS -d $DURATION -R $r -c $CSV > /dev/null
+    # mode,clients,target_rate,throughput,late,mean,p50,p90,p99,p999,...
+    tail -1 $CSV | awk -F, '{ printf "%10s %14s %10s %10s %10s %10s\n", $3, $4, $5, $7, $9, $10 }'
+
+    kill $SERVER
+    wait $SERVER 2>/dev/null
+    PORT=$((PORT + 1))
+done